@@ -0,0 +1,684 @@
+/**
+ * bench.c - native benchmarks for hs-miner
+ * Copyright (c) 2019-2020, The Handshake Developers (MIT License).
+ *
+ * Times the hashing primitives and the CPU miner without
+ * going through node. Every case is calibrated to run for
+ * about --time milliseconds per repetition, warmed up, then
+ * repeated; the median time per operation is what gets
+ * compared against a baseline written by an earlier --out.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "../src/common.h"
+#include "../src/header.h"
+#include "../src/blake2b.h"
+#include "../src/sha3.h"
+
+#define BENCH_MAX_CASES 64
+#define BENCH_MAX_REPS 1000
+
+#define BENCH_STR_(x) #x
+#define BENCH_STR(x) BENCH_STR_(x)
+
+typedef struct bench_opts_s {
+  const char *filter;
+  const char *out;
+  const char *baseline;
+  double threshold;
+  uint32_t reps;
+  uint32_t warmup;
+  uint32_t time;
+  uint32_t threads;
+  bool json;
+} bench_opts_t;
+
+typedef struct bench_case_s {
+  char name[64];
+  // Run `iters` operations and return how many were done.
+  uint64_t (*run)(const struct bench_case_s *c, uint64_t iters);
+  size_t size;
+  uint32_t threads;
+} bench_case_t;
+
+typedef struct bench_result_s {
+  char name[64];
+  uint64_t iters;
+  uint32_t reps;
+  size_t size;
+  double median;
+  double mean;
+  double stddev;
+  double min;
+  double max;
+} bench_result_t;
+
+// Header and derived inputs shared by the cases. Filled
+// from a fixed seed so that runs are comparable.
+static uint8_t bench_raw[HEADER_SIZE];
+static hs_header_t bench_hdr;
+static uint8_t bench_share[128];
+static uint8_t bench_pad32[32];
+static uint8_t bench_input[256];
+
+// Results are folded into this so nothing is optimized out.
+static volatile uint8_t bench_sink;
+
+// Nanoseconds a case timed itself, or 0 to time the whole
+// call. Reset before every run.
+static uint64_t bench_timed;
+
+static void
+bench_init(void) {
+  uint64_t x = 0x9e3779b97f4a7c15ULL;
+
+  for (size_t i = 0; i < sizeof(bench_raw); i++) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    bench_raw[i] = (uint8_t)x;
+  }
+
+  memcpy(bench_input, bench_raw, sizeof(bench_input));
+
+  if (!hs_header_decode(bench_raw, HEADER_SIZE, &bench_hdr)) {
+    fprintf(stderr, "Could not decode the benchmark header.\n");
+    exit(1);
+  }
+
+  hs_header_share_encode(&bench_hdr, bench_share);
+  hs_header_padding(&bench_hdr, bench_pad32, 32);
+}
+
+/*
+ * Cases
+ */
+
+static uint64_t
+bench_blake2b(const bench_case_t *c, uint64_t iters) {
+  uint8_t hash[64] = { 0 };
+
+  for (uint64_t i = 0; i < iters; i++) {
+    hs_blake2b(hash, 32, bench_input, c->size, NULL, 0);
+    bench_input[0] ^= hash[0];
+  }
+
+  bench_sink ^= hash[0];
+
+  return iters;
+}
+
+static uint64_t
+bench_sha3(const bench_case_t *c, uint64_t iters) {
+  uint8_t hash[32] = { 0 };
+
+  for (uint64_t i = 0; i < iters; i++) {
+    hs_sha3_ctx ctx;
+    hs_sha3_256_init(&ctx);
+    hs_sha3_update(&ctx, bench_input, c->size);
+    hs_sha3_final(&ctx, hash);
+    bench_input[0] ^= hash[0];
+  }
+
+  bench_sink ^= hash[0];
+
+  return iters;
+}
+
+// What hs_simple_thread does per nonce.
+static uint64_t
+bench_share_pow(const bench_case_t *c, uint64_t iters) {
+  uint8_t hash[32] = { 0 };
+
+  (void)c;
+
+  for (uint64_t i = 0; i < iters; i++) {
+    uint32_t nonce = (uint32_t)i;
+    memcpy(bench_share, &nonce, 4);
+    hs_header_share_pow(bench_share, bench_pad32, hash);
+  }
+
+  bench_sink ^= hash[0];
+
+  return iters;
+}
+
+// What verification does per candidate.
+static uint64_t
+bench_header_pow(const bench_case_t *c, uint64_t iters) {
+  uint8_t hash[32] = { 0 };
+
+  (void)c;
+
+  for (uint64_t i = 0; i < iters; i++) {
+    bench_hdr.nonce = (uint32_t)i;
+    hs_header_pow(&bench_hdr, hash);
+  }
+
+  bench_sink ^= hash[0];
+
+  return iters;
+}
+
+static uint64_t
+bench_decode(const bench_case_t *c, uint64_t iters) {
+  hs_header_t hdr;
+
+  (void)c;
+
+  memset(&hdr, 0, sizeof(hdr));
+
+  for (uint64_t i = 0; i < iters; i++) {
+    bench_raw[0] = (uint8_t)i;
+    hs_header_decode(bench_raw, HEADER_SIZE, &hdr);
+  }
+
+  bench_sink ^= (uint8_t)hdr.nonce;
+
+  return iters;
+}
+
+static uint64_t
+bench_encode(const bench_case_t *c, uint64_t iters) {
+  uint8_t raw[HEADER_SIZE] = { 0 };
+
+  (void)c;
+
+  for (uint64_t i = 0; i < iters; i++) {
+    bench_hdr.nonce = (uint32_t)i;
+    hs_header_encode(&bench_hdr, raw);
+  }
+
+  bench_sink ^= raw[0];
+
+  return iters;
+}
+
+static uint64_t
+bench_share_encode(const bench_case_t *c, uint64_t iters) {
+  uint8_t share[128] = { 0 };
+
+  (void)c;
+
+  for (uint64_t i = 0; i < iters; i++) {
+    bench_hdr.nonce = (uint32_t)i;
+    hs_header_share_encode(&bench_hdr, share);
+  }
+
+  bench_sink ^= share[0];
+
+  return iters;
+}
+
+// A whole job on the CPU miner with an unreachable target.
+// Only hashing is timed: the busy time of the job's stats
+// counters, from each thread's first hash to its last,
+// averaged over threads. Spawning and joining the threads
+// is left out.
+static uint64_t
+bench_simple_run(const bench_case_t *c, uint64_t iters) {
+  hs_options_t options;
+  hs_stats_t before, after;
+  uint32_t nonce = 0;
+  bool match = false;
+  uint8_t extra_nonce[EXTRA_NONCE_SIZE];
+
+  if (iters > UINT32_MAX)
+    iters = UINT32_MAX;
+
+  if (iters < c->threads)
+    iters = c->threads;
+
+  // Every thread gets the same share of the range.
+  iters -= iters % c->threads;
+
+  memset(&options, 0, sizeof(options));
+
+  options.header_len = HEADER_SIZE;
+  options.range = (uint32_t)iters;
+  options.threads = c->threads;
+  options.running = true;
+  options.started = hs_stats_now();
+  memcpy(options.header, bench_raw, HEADER_SIZE);
+  memcpy(extra_nonce, bench_raw + 128, EXTRA_NONCE_SIZE);
+
+  hs_stats_get(HS_BACKEND_SIMPLE, options.device, &before);
+  hs_simple_run(&options, &nonce, extra_nonce, &match);
+  hs_stats_get(HS_BACKEND_SIMPLE, options.device, &after);
+
+  bench_timed = (after.busy - before.busy) / c->threads;
+  bench_sink ^= (uint8_t)nonce;
+
+  return iters;
+}
+
+static size_t
+bench_cases(const bench_opts_t *opts, bench_case_t *cases) {
+  static const size_t blake2b_sizes[] = { 32, 64, 128 };
+  size_t len = 0;
+
+#define BENCH_CASE(fn, sz, thr, ...) do {                        \
+  bench_case_t *c = &cases[len++];                              \
+  snprintf(c->name, sizeof(c->name), __VA_ARGS__);              \
+  c->run = fn;                                                  \
+  c->size = sz;                                                 \
+  c->threads = thr;                                             \
+} while (0)
+
+  for (size_t i = 0; i < 3; i++) {
+    size_t size = blake2b_sizes[i];
+    BENCH_CASE(bench_blake2b, size, 1, "blake2b/%zu", size);
+  }
+
+  // One block at the SHA3-256 rate.
+  BENCH_CASE(bench_sha3, 136, 1, "sha3/136");
+
+  BENCH_CASE(bench_share_pow, 128, 1, "header_share_pow");
+  BENCH_CASE(bench_header_pow, HEADER_SIZE, 1, "header_pow");
+  BENCH_CASE(bench_decode, HEADER_SIZE, 1, "header_decode");
+  BENCH_CASE(bench_encode, HEADER_SIZE, 1, "header_encode");
+  BENCH_CASE(bench_share_encode, 128, 1, "header_share_encode");
+
+  for (uint32_t t = 1; t <= opts->threads && len < BENCH_MAX_CASES; t++)
+    BENCH_CASE(bench_simple_run, 128, t, "simple_run/%u", t);
+
+#undef BENCH_CASE
+
+  return len;
+}
+
+/*
+ * Measurement
+ */
+
+static int
+bench_cmp(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// Run a case once. Returns the nanoseconds it took and
+// sets `done` to the operations it did.
+static uint64_t
+bench_run(const bench_case_t *c, uint64_t iters, uint64_t *done) {
+  bench_timed = 0;
+
+  uint64_t start = hs_stats_now();
+  *done = c->run(c, iters);
+  uint64_t elapsed = hs_stats_now() - start;
+
+  return bench_timed != 0 ? bench_timed : elapsed;
+}
+
+// Find an iteration count that takes about `ms` milliseconds.
+static uint64_t
+bench_calibrate(const bench_case_t *c, uint32_t ms) {
+  uint64_t target = (uint64_t)ms * 1000000;
+  uint64_t iters = c->threads;
+
+  for (;;) {
+    uint64_t done;
+    uint64_t elapsed = bench_run(c, iters, &done);
+
+    if (elapsed >= target / 4 || iters >= UINT32_MAX) {
+      double scale = (double)target / (double)(elapsed ? elapsed : 1);
+      double next = (double)done * scale;
+
+      if (next < 1)
+        next = 1;
+
+      if (next > UINT32_MAX)
+        next = UINT32_MAX;
+
+      return (uint64_t)next;
+    }
+
+    iters *= 4;
+  }
+}
+
+static void
+bench_measure(const bench_opts_t *opts, const bench_case_t *c,
+              bench_result_t *r) {
+  double samples[BENCH_MAX_REPS];
+  uint64_t iters = bench_calibrate(c, opts->time);
+  uint64_t done = iters;
+
+  for (uint32_t i = 0; i < opts->warmup; i++)
+    c->run(c, iters);
+
+  for (uint32_t i = 0; i < opts->reps; i++) {
+    uint64_t elapsed = bench_run(c, iters, &done);
+
+    samples[i] = (double)elapsed / (double)done;
+  }
+
+  double sum = 0;
+
+  for (uint32_t i = 0; i < opts->reps; i++)
+    sum += samples[i];
+
+  double mean = sum / opts->reps;
+  double var = 0;
+
+  for (uint32_t i = 0; i < opts->reps; i++)
+    var += (samples[i] - mean) * (samples[i] - mean);
+
+  qsort(samples, opts->reps, sizeof(double), bench_cmp);
+
+  memcpy(r->name, c->name, sizeof(r->name));
+
+  r->iters = done;
+  r->reps = opts->reps;
+  r->size = c->size;
+  r->mean = mean;
+  r->stddev = opts->reps > 1 ? sqrt(var / (opts->reps - 1)) : 0;
+  r->min = samples[0];
+  r->max = samples[opts->reps - 1];
+
+  if (opts->reps & 1)
+    r->median = samples[opts->reps / 2];
+  else
+    r->median = (samples[opts->reps / 2 - 1] + samples[opts->reps / 2]) / 2;
+}
+
+/*
+ * Output
+ */
+
+static void
+bench_write_json(FILE *fp, const bench_opts_t *opts,
+                 const bench_result_t *results, size_t len) {
+  fprintf(fp, "{\n");
+  fprintf(fp, "  \"version\": 1,\n");
+  fprintf(fp, "  \"network\": \"%s\",\n", BENCH_STR(HS_NETWORK));
+  fprintf(fp, "  \"reps\": %u,\n", opts->reps);
+  fprintf(fp, "  \"warmup\": %u,\n", opts->warmup);
+  fprintf(fp, "  \"cases\": [\n");
+
+  // One case per line, which is also what --baseline reads.
+  for (size_t i = 0; i < len; i++) {
+    const bench_result_t *r = &results[i];
+
+    fprintf(fp,
+      "    {\"name\": \"%s\", \"median_ns\": %.3f, \"mean_ns\": %.3f, "
+      "\"stddev_ns\": %.3f, \"min_ns\": %.3f, \"max_ns\": %.3f, "
+      "\"iterations\": %llu, \"reps\": %u, \"ops_per_sec\": %.1f, "
+      "\"bytes_per_sec\": %.1f}%s\n",
+      r->name, r->median, r->mean, r->stddev, r->min, r->max,
+      (unsigned long long)r->iters, r->reps, 1e9 / r->median,
+      1e9 / r->median * (double)r->size, i + 1 < len ? "," : "");
+  }
+
+  fprintf(fp, "  ]\n");
+  fprintf(fp, "}\n");
+}
+
+static void
+bench_print(FILE *fp, const bench_result_t *r) {
+  fprintf(fp, "%-22s %12.2f ns/op %8.2f%% %14.0f ops/s\n",
+    r->name, r->median, r->median > 0 ? 100 * r->stddev / r->median : 0,
+    1e9 / r->median);
+}
+
+/*
+ * Baseline
+ */
+
+// Median of a case in a file written with --out, or a
+// negative value when the case is not in it.
+static double
+bench_baseline_get(const char *data, const char *name) {
+  char key[96];
+
+  snprintf(key, sizeof(key), "\"name\": \"%.63s\",", name);
+
+  const char *p = strstr(data, key);
+
+  if (p == NULL)
+    return -1;
+
+  p = strstr(p, "\"median_ns\": ");
+
+  if (p == NULL)
+    return -1;
+
+  return strtod(p + 13, NULL);
+}
+
+static char *
+bench_read_file(const char *path) {
+  FILE *fp = fopen(path, "rb");
+
+  if (fp == NULL)
+    return NULL;
+
+  size_t size = 0;
+  size_t len = 0;
+  char *data = NULL;
+
+  for (;;) {
+    if (len + 4096 + 1 > size) {
+      size = size ? size * 2 : 65536;
+
+      char *next = (char *)realloc(data, size);
+
+      if (next == NULL) {
+        free(data);
+        fclose(fp);
+        return NULL;
+      }
+
+      data = next;
+    }
+
+    size_t n = fread(data + len, 1, 4096, fp);
+
+    len += n;
+
+    if (n < 4096)
+      break;
+  }
+
+  fclose(fp);
+
+  data[len] = '\0';
+
+  return data;
+}
+
+// Print the change of every case against the baseline.
+// Returns the number of cases that got slower by more
+// than the threshold.
+static int
+bench_compare(const bench_opts_t *opts, const bench_result_t *results,
+              size_t len) {
+  char *data = bench_read_file(opts->baseline);
+  int regressions = 0;
+
+  if (data == NULL) {
+    fprintf(stderr, "Could not read baseline %s.\n", opts->baseline);
+    return -1;
+  }
+
+  fprintf(stderr, "\nAgainst %s (threshold %.1f%%):\n",
+    opts->baseline, opts->threshold);
+
+  for (size_t i = 0; i < len; i++) {
+    const bench_result_t *r = &results[i];
+    double base = bench_baseline_get(data, r->name);
+
+    if (base <= 0) {
+      fprintf(stderr, "%-22s %12s\n", r->name, "new");
+      continue;
+    }
+
+    double change = 100 * (r->median - base) / base;
+    bool slower = change > opts->threshold;
+
+    if (slower)
+      regressions += 1;
+
+    fprintf(stderr, "%-22s %12.2f ns/op %+8.2f%%%s\n",
+      r->name, base, change, slower ? "  REGRESSION" : "");
+  }
+
+  free(data);
+
+  return regressions;
+}
+
+/*
+ * Main
+ */
+
+static void
+bench_usage(void) {
+  fprintf(stderr,
+    "Usage: hs_bench [options]\n"
+    "\n"
+    "  --filter <str>      only run cases whose name contains str\n"
+    "  --reps <n>          timed repetitions per case (default 10)\n"
+    "  --warmup <n>        untimed repetitions first (default 2)\n"
+    "  --time <ms>         target time per repetition (default 100)\n"
+    "  --threads <n>       run simple_run at 1..n threads (default 4)\n"
+    "  --json              write JSON to stdout instead of a table\n"
+    "  --out <file>        also write JSON to file\n"
+    "  --baseline <file>   compare with the JSON of an earlier run\n"
+    "  --threshold <pct>   slowdown of the median that fails (default 5)\n"
+    "\n"
+    "Exits with 2 when a case regressed against the baseline.\n");
+}
+
+static bool
+bench_parse(int argc, char **argv, bench_opts_t *opts) {
+  opts->filter = NULL;
+  opts->out = NULL;
+  opts->baseline = NULL;
+  opts->threshold = 5;
+  opts->reps = 10;
+  opts->warmup = 2;
+  opts->time = 100;
+  opts->threads = 4;
+  opts->json = false;
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+
+    if (strcmp(arg, "--json") == 0) {
+      opts->json = true;
+      continue;
+    }
+
+    if (strcmp(arg, "--help") == 0 || strcmp(arg, "-h") == 0)
+      return false;
+
+    if (val == NULL) {
+      fprintf(stderr, "Missing value for %s.\n", arg);
+      return false;
+    }
+
+    i += 1;
+
+    if (strcmp(arg, "--filter") == 0)
+      opts->filter = val;
+    else if (strcmp(arg, "--out") == 0)
+      opts->out = val;
+    else if (strcmp(arg, "--baseline") == 0)
+      opts->baseline = val;
+    else if (strcmp(arg, "--threshold") == 0)
+      opts->threshold = strtod(val, NULL);
+    else if (strcmp(arg, "--reps") == 0)
+      opts->reps = (uint32_t)strtoul(val, NULL, 10);
+    else if (strcmp(arg, "--warmup") == 0)
+      opts->warmup = (uint32_t)strtoul(val, NULL, 10);
+    else if (strcmp(arg, "--time") == 0)
+      opts->time = (uint32_t)strtoul(val, NULL, 10);
+    else if (strcmp(arg, "--threads") == 0)
+      opts->threads = (uint32_t)strtoul(val, NULL, 10);
+    else {
+      fprintf(stderr, "Unknown option %s.\n", arg);
+      return false;
+    }
+  }
+
+  if (opts->reps == 0 || opts->reps > BENCH_MAX_REPS) {
+    fprintf(stderr, "--reps must be 1 to %d.\n", BENCH_MAX_REPS);
+    return false;
+  }
+
+  if (opts->time == 0)
+    opts->time = 1;
+
+  if (opts->threads > HS_STATS_THREADS)
+    opts->threads = HS_STATS_THREADS;
+
+  return true;
+}
+
+int
+main(int argc, char **argv) {
+  bench_opts_t opts;
+  bench_case_t cases[BENCH_MAX_CASES];
+  bench_result_t results[BENCH_MAX_CASES];
+  size_t len = 0;
+
+  if (!bench_parse(argc, argv, &opts)) {
+    bench_usage();
+    return 1;
+  }
+
+  bench_init();
+
+  size_t total = bench_cases(&opts, cases);
+  FILE *table = opts.json ? stderr : stdout;
+
+  for (size_t i = 0; i < total; i++) {
+    const bench_case_t *c = &cases[i];
+
+    if (opts.filter != NULL && strstr(c->name, opts.filter) == NULL)
+      continue;
+
+    bench_measure(&opts, c, &results[len]);
+    bench_print(table, &results[len]);
+    fflush(table);
+
+    len += 1;
+  }
+
+  if (opts.json)
+    bench_write_json(stdout, &opts, results, len);
+
+  if (opts.out != NULL) {
+    FILE *fp = fopen(opts.out, "w");
+
+    if (fp == NULL) {
+      fprintf(stderr, "Could not write %s.\n", opts.out);
+      return 1;
+    }
+
+    bench_write_json(fp, &opts, results, len);
+    fclose(fp);
+  }
+
+  if (opts.baseline != NULL) {
+    int regressions = bench_compare(&opts, results, len);
+
+    if (regressions < 0)
+      return 1;
+
+    if (regressions > 0)
+      return 2;
+  }
+
+  return 0;
+}
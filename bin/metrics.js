@@ -0,0 +1,396 @@
+'use strict';
+
+const assert = require('assert');
+const http = require('http');
+const lib = require('../');
+
+/*
+ * Constants
+ */
+
+// Upper bounds of the RPC latency buckets, in seconds.
+const RPC_BUCKETS = [0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10];
+
+const LATENCIES = [
+  ['stop', 'stop() to the last mining thread exiting'],
+  ['start', 'job start to the first hash'],
+  ['deliver', 'a hit being found to its callback running']
+];
+
+const PERF_EVENTS = [
+  ['cycles', 'cycles'],
+  ['instructions', 'instructions'],
+  ['branch_misses', 'branchMisses'],
+  ['l1_misses', 'l1Misses']
+];
+
+/**
+ * Fixed-bucket histogram, rendered as
+ * a Prometheus histogram.
+ */
+
+class Histogram {
+  constructor(bounds = RPC_BUCKETS) {
+    this.bounds = bounds;
+    this.counts = this.bounds.map(() => 0);
+    this.count = 0;
+    this.sum = 0;
+  }
+
+  observe(value) {
+    for (let i = 0; i < this.bounds.length; i++) {
+      if (value <= this.bounds[i]) {
+        this.counts[i] += 1;
+        break;
+      }
+    }
+
+    this.count += 1;
+    this.sum += value;
+  }
+}
+
+/**
+ * Serves the miner's counters in the Prometheus text
+ * format. Hash counts come from the native per-thread
+ * counters and are read once per scrape, so the mining
+ * threads are never polled from JS.
+ */
+
+class Metrics {
+  constructor(miner, options) {
+    if (options == null)
+      options = {};
+
+    this.miner = miner;
+    this.host = options.host || '127.0.0.1';
+    this.port = options.port >>> 0;
+    this.server = null;
+  }
+
+  open() {
+    assert(!this.server, 'Metrics already open.');
+
+    const server = http.createServer((req, res) => this.handle(req, res));
+
+    this.server = server;
+
+    return new Promise((resolve, reject) => {
+      server.once('error', reject);
+      server.listen(this.port, this.host, () => {
+        server.removeListener('error', reject);
+        resolve(server.address());
+      });
+    });
+  }
+
+  close() {
+    const server = this.server;
+
+    this.server = null;
+
+    if (!server)
+      return Promise.resolve();
+
+    return new Promise(resolve => server.close(() => resolve()));
+  }
+
+  handle(req, res) {
+    const path = req.url.split('?')[0];
+
+    if (req.method !== 'GET' || path !== '/metrics') {
+      res.statusCode = 404;
+      res.end();
+      return;
+    }
+
+    let body;
+
+    try {
+      body = this.render();
+    } catch (e) {
+      res.statusCode = 500;
+      res.end(e.message);
+      return;
+    }
+
+    res.setHeader('Content-Type', 'text/plain; version=0.0.4; charset=utf-8');
+    res.end(body);
+  }
+
+  render() {
+    const out = new Writer();
+    const miner = this.miner;
+    const backend = miner.backend;
+    const devices = miner.getDeviceIndexes();
+    const stats = devices.map((device) => {
+      return [device, lib.getStats(device, backend)];
+    });
+
+    out.metric('hs_miner_hashrate', 'gauge',
+      'Hashes per second over the last window.');
+
+    for (const [device, {hashrate}] of stats) {
+      for (const window of Object.keys(hashrate))
+        out.sample('hs_miner_hashrate', {device, window}, hashrate[window]);
+    }
+
+    out.metric('hs_miner_hashes_total', 'counter',
+      'Hashes attempted.');
+
+    for (const [device, {hashes}] of stats)
+      out.sample('hs_miner_hashes_total', {device}, hashes);
+
+    out.metric('hs_miner_thread_hashes_total', 'counter',
+      'Hashes attempted by each mining thread.');
+
+    for (const [device, {threads}] of stats) {
+      for (let thread = 0; thread < threads.length; thread++)
+        out.sample('hs_miner_thread_hashes_total', {device, thread},
+          threads[thread]);
+    }
+
+    out.metric('hs_miner_hits_total', 'counter',
+      'Hashes that met the job target.');
+
+    for (const [device, {hits}] of stats)
+      out.sample('hs_miner_hits_total', {device}, hits);
+
+    out.metric('hs_miner_busy_seconds_total', 'counter',
+      'Time spent mining, summed over threads.');
+
+    for (const [device, {busy}] of stats)
+      out.sample('hs_miner_busy_seconds_total', {device}, busy / 1e3);
+
+    out.metric('hs_miner_jobs_total', 'counter',
+      'Jobs started.');
+
+    for (const [device, {jobs}] of stats)
+      out.sample('hs_miner_jobs_total', {device}, jobs);
+
+    out.metric('hs_miner_candidates_rejected_total', 'counter',
+      'Device results that failed CPU verification.');
+
+    for (const device of devices) {
+      const {candidates, confirmed} = lib.getVerifyStats(device);
+      out.sample('hs_miner_candidates_rejected_total', {device},
+        candidates - confirmed);
+    }
+
+    out.metric('hs_miner_shares_found_total', 'counter',
+      'Valid results returned by the miner.');
+    out.sample('hs_miner_shares_found_total', {}, miner.found);
+
+    out.metric('hs_miner_shares_stale_total', 'counter',
+      'Valid results dropped because the job had changed.');
+    out.sample('hs_miner_shares_stale_total', {}, miner.stale);
+
+    out.metric('hs_miner_shares_submitted_total', 'counter',
+      'Results sent with submitwork.');
+    out.sample('hs_miner_shares_submitted_total', {}, miner.submitted);
+
+    out.metric('hs_miner_shares_accepted_total', 'counter',
+      'Results accepted by the node.');
+    out.sample('hs_miner_shares_accepted_total', {}, miner.accepted);
+
+    out.metric('hs_miner_shares_rejected_total', 'counter',
+      'Results rejected by the node, or failed to submit.');
+
+    for (const [reason, count] of miner.rejected)
+      out.sample('hs_miner_shares_rejected_total', {reason}, count);
+
+    out.metric('hs_miner_latency_seconds', 'summary',
+      'Job latencies of the backend: '
+      + LATENCIES.map(([event, desc]) => `${event} is ${desc}`).join(', ')
+      + '.');
+
+    const latency = lib.getLatency(backend);
+
+    for (const [event] of LATENCIES) {
+      const {count, mean, p50, p99} = latency[event];
+      const labels = {backend, event};
+
+      out.sample('hs_miner_latency_seconds',
+        Object.assign({}, labels, {quantile: '0.5'}), p50 / 1e3);
+      out.sample('hs_miner_latency_seconds',
+        Object.assign({}, labels, {quantile: '0.99'}), p99 / 1e3);
+      out.sample('hs_miner_latency_seconds_sum', labels, mean * count / 1e3);
+      out.sample('hs_miner_latency_seconds_count', labels, count);
+    }
+
+    out.metric('hs_miner_latency_max_seconds', 'gauge',
+      'Longest job latency of the backend.');
+
+    for (const [event] of LATENCIES) {
+      out.sample('hs_miner_latency_max_seconds', {backend, event},
+        latency[event].max / 1e3);
+    }
+
+    const perf = lib.getPerf(backend);
+
+    if (perf.enabled) {
+      out.metric('hs_miner_perf_threads_total', 'counter',
+        'Mining threads by whether hardware counters could be opened.');
+      out.sample('hs_miner_perf_threads_total', {backend, result: 'ok'},
+        perf.threads);
+      out.sample('hs_miner_perf_threads_total', {backend, result: 'failed'},
+        perf.failed);
+
+      out.metric('hs_miner_perf_hashes_total', 'counter',
+        'Hashes attempted by the profiled threads.');
+      out.sample('hs_miner_perf_hashes_total', {backend}, perf.hashes);
+
+      out.metric('hs_miner_perf_events_total', 'counter',
+        'Hardware counters of the profiled threads.');
+
+      for (const [event, key] of PERF_EVENTS)
+        out.sample('hs_miner_perf_events_total', {backend, event}, perf[key]);
+    }
+
+    const energy = lib.getEnergy();
+
+    if (energy.enabled) {
+      out.metric('hs_miner_energy_joules_total', 'counter',
+        'CPU package energy used while jobs ran.');
+
+      for (const run of energy.runs) {
+        out.sample('hs_miner_energy_joules_total', energyLabels(run),
+          run.joules);
+      }
+
+      out.metric('hs_miner_energy_hashes_total', 'counter',
+        'Hashes attempted by the jobs that were metered.');
+
+      for (const run of energy.runs) {
+        out.sample('hs_miner_energy_hashes_total', energyLabels(run),
+          run.hashes);
+      }
+
+      out.metric('hs_miner_energy_seconds_total', 'counter',
+        'Time the metered jobs ran.');
+
+      for (const run of energy.runs) {
+        out.sample('hs_miner_energy_seconds_total', energyLabels(run),
+          run.seconds);
+      }
+    }
+
+    out.metric('hs_miner_rpc_seconds', 'histogram',
+      'Latency of RPC calls to the node.');
+
+    for (const [method, hist] of miner.rpc) {
+      let total = 0;
+
+      for (let i = 0; i < hist.bounds.length; i++) {
+        total += hist.counts[i];
+        out.sample('hs_miner_rpc_seconds_bucket',
+          {method, le: hist.bounds[i]}, total);
+      }
+
+      out.sample('hs_miner_rpc_seconds_bucket',
+        {method, le: '+Inf'}, hist.count);
+      out.sample('hs_miner_rpc_seconds_sum', {method}, hist.sum);
+      out.sample('hs_miner_rpc_seconds_count', {method}, hist.count);
+    }
+
+    if (backend === 'opencl') {
+      out.metric('hs_miner_kernel_info', 'gauge',
+        'Kernel variant and launch sizes picked by the autotuner.');
+
+      for (const device of devices) {
+        const {variant, localSize, globalSize} = lib.getOpenCLStats(device);
+
+        if (variant == null)
+          continue;
+
+        out.sample('hs_miner_kernel_info', {
+          device,
+          variant,
+          local_size: localSize,
+          global_size: globalSize
+        }, 1);
+      }
+
+      out.metric('hs_miner_result_overflows_total', 'counter',
+        'Launches with more hits than the result buffer, scanned again.');
+
+      for (const device of devices) {
+        const {overflows} = lib.getOpenCLStats(device);
+        out.sample('hs_miner_result_overflows_total', {device}, overflows);
+      }
+    }
+
+    return out.toString();
+  }
+}
+
+/**
+ * Prometheus text format writer.
+ */
+
+class Writer {
+  constructor() {
+    this.lines = [];
+  }
+
+  metric(name, type, help) {
+    this.lines.push(`# HELP ${name} ${help}`);
+    this.lines.push(`# TYPE ${name} ${type}`);
+  }
+
+  sample(name, labels, value) {
+    const keys = Object.keys(labels);
+
+    if (keys.length > 0) {
+      const items = keys.map(key => `${key}="${escape(labels[key])}"`);
+      name += `{${items.join(',')}}`;
+    }
+
+    this.lines.push(`${name} ${format(value)}`);
+  }
+
+  toString() {
+    return this.lines.join('\n') + '\n';
+  }
+}
+
+/*
+ * Helpers
+ */
+
+function escape(value) {
+  return String(value)
+    .replace(/\\/g, '\\\\')
+    .replace(/"/g, '\\"')
+    .replace(/\n/g, '\\n');
+}
+
+function energyLabels({backend, variant, threads}) {
+  const labels = {backend, threads};
+
+  if (variant)
+    labels.variant = variant;
+
+  return labels;
+}
+
+function format(value) {
+  if (Number.isNaN(value))
+    return 'NaN';
+
+  if (value === Infinity)
+    return '+Inf';
+
+  if (value === -Infinity)
+    return '-Inf';
+
+  return String(value);
+}
+
+/*
+ * Expose
+ */
+
+Metrics.Histogram = Histogram;
+Metrics.Metrics = Metrics;
+module.exports = Metrics;
@@ -4,6 +4,7 @@ const assert = require('assert');
 const request = require('brq');
 const crypto = require('crypto');
 const miner = require('../');
+const {Histogram} = require('./metrics');
 
 const EXTRA_NONCE = Buffer.alloc(miner.EXTRA_NONCE_SIZE);
 
@@ -30,6 +31,15 @@ class Miner {
     this.mining = false;
     this.offset = 0;
     this.maskHash = Buffer.alloc(32, 0x00);
+    this.epoch = 0;
+
+    // Share and RPC counters, read by the metrics endpoint.
+    this.found = 0;
+    this.stale = 0;
+    this.submitted = 0;
+    this.accepted = 0;
+    this.rejected = new Map();
+    this.rpc = new Map();
   }
 
   log(...args) {
@@ -138,7 +148,10 @@ class Miner {
     this.target = target;
     this.height = height;
     this.maskHash = maskHash;
+    this.epoch += 1;
 
+    // Every device loop notices the new
+    // epoch once its current job returns.
     miner.stopAll();
 
     this.log('New job: %d', height);
@@ -256,90 +269,189 @@ class Miner {
     });
   }
 
-  async mine(hdr, target) {
-    const jobs = [];
+  /**
+   * Get the device indexes to mine on. Uses a single
+   * device if specified, otherwise all of the devices.
+   * @returns {Number[]}
+   */
 
-    // Use a single device if specified, otherwise use
-    // all of the devices.
-    if (this.device !== -1) {
-      this.log('Using device: %d', this.device);
-      jobs.push(this.job(this.device, hdr, target));
-    } else {
-      for (let i = 0; i < this.count; i++) {
-        randomize(hdr, miner.EXTRA_NONCE_END - 12, miner.EXTRA_NONCE_END);
-        jobs.push(this.job(i, hdr, target));
-      }
-    }
+  getDeviceIndexes() {
+    if (this.device !== -1)
+      return [this.device];
 
-    const result = await Promise.all(jobs);
+    const indexes = [];
 
-    for (let i = 0; i < result.length; i++) {
-      const [nonce, extraNonce, match] = result[i];
+    for (let i = 0; i < this.count; i++)
+      indexes.push(i);
 
-      if (match)
-        return [nonce, extraNonce, true];
-    }
+    return indexes;
+  }
+
+  /**
+   * Run a single job on every device, each with its
+   * own copy of the header and extra nonce lane.
+   * Resolves as soon as any device finds a proof,
+   * without waiting for the slower devices.
+   * @param {Buffer} hdr    - raw header
+   * @param {Buffer} target - target (bytes)
+   * @returns {Promise} [Number, Buffer, Boolean]
+   */
+
+  mine(hdr, target) {
+    const indexes = this.getDeviceIndexes();
 
-    return [0, EXTRA_NONCE, false];
+    return new Promise((resolve, reject) => {
+      let pending = indexes.length;
+      let done = false;
+
+      for (const index of indexes) {
+        const raw = Buffer.from(hdr);
+
+        if (indexes.length > 1)
+          randomize(raw, miner.EXTRA_NONCE_END - 12, miner.EXTRA_NONCE_END);
+
+        this.job(index, raw, target).then(([nonce, extraNonce, match]) => {
+          if (done)
+            return;
+
+          if (match) {
+            done = true;
+
+            for (const other of indexes) {
+              if (other !== index)
+                miner.stop(other);
+            }
+
+            resolve([nonce, extraNonce, true]);
+            return;
+          }
+
+          pending -= 1;
+
+          if (pending === 0)
+            resolve([0, EXTRA_NONCE, false]);
+        }, (err) => {
+          if (done)
+            return;
+
+          done = true;
+          reject(err);
+        });
+      }
+    });
   }
 
   getJob() {
-    return [this.hdr, this.target, this.height, this.maskHash];
+    return [this.hdr, this.target, this.height, this.maskHash, this.epoch];
   }
 
   async work() {
+    const indexes = this.getDeviceIndexes();
+
+    if (indexes.length === 1)
+      this.log('Using device: %d', indexes[0]);
+
+    const loops = [];
+
+    for (const index of indexes)
+      loops.push(this.loop(index));
+
+    await Promise.all(loops);
+  }
+
+  async loop(index) {
     try {
-      await this._work();
+      await this._loop(index);
     } catch (e) {
       this.error(e.stack);
     }
   }
 
-  async _work() {
-    let nonce, extraNonce, valid;
+  /**
+   * Mine on a single device until the miner is stopped.
+   * Each device loop owns its header copy and a random
+   * extra nonce lane, picks up new jobs by watching the
+   * epoch, and submits its own solutions immediately.
+   * @param {Number} index - device index
+   * @returns {Promise}
+   */
+
+  async _loop(index) {
+    let hdr = null;
+    let epoch = -1;
     let i = 0;
 
     for (;;) {
       if (!this.mining)
         break;
 
+      const [, target, height, maskHash, current] = this.getJob();
+
+      // New job: take a fresh copy of the header
+      // and give this device its own lane.
+      if (current !== epoch) {
+        epoch = current;
+        hdr = Buffer.from(this.hdr);
+        randomize(hdr, miner.EXTRA_NONCE_END - 12, miner.EXTRA_NONCE_END);
+      }
+
       // Handle overflow
-      i = i++ % 1000;
-      const [hdr, target, height, maskHash] = this.getJob();
+      i = (i + 1) % 1000;
+
+      const span = miner.traceBegin();
 
       increment(hdr, this.now());
 
+      miner.traceEnd('increment', span, index);
+
       if (i % 1e2 === 0) {
-        this.log('Mining height %d (target=%s).',
-          height, target.toString('hex'));
+        this.log('Device %d mining height %d (target=%s).',
+          index, height, target.toString('hex'));
       }
 
+      let nonce, extraNonce, valid;
+
+      const job = miner.traceBegin();
+
       try {
-        [nonce, extraNonce, valid] = await this.mine(hdr, target);
+        [nonce, extraNonce, valid] = await this.job(index, hdr, target);
       } catch (e) {
         this.error(e.stack);
         continue;
+      } finally {
+        miner.traceEnd('mineAsync', job, index);
       }
 
       if (!valid)
         continue;
 
-      if (!maskHash.equals(this.maskHash)) {
+      this.found += 1;
+
+      if (epoch !== this.epoch) {
         this.log('New job. Switching.');
+        this.stale += 1;
         continue;
       }
 
-      this.log('Found valid nonce: %d, extra nonce %s',
-        nonce, extraNonce.toString('hex'));
+      this.log('Device %d found valid nonce: %d, extra nonce %s',
+        index, nonce, extraNonce.toString('hex'));
 
       const raw = this.toBlock(hdr, nonce, extraNonce);
 
       let reason = '';
 
+      this.submitted += 1;
+
       try {
         [valid, reason] = await this.submitWork(raw);
+
+        if (valid)
+          this.accepted += 1;
+        else
+          this.reject(reason || 'unknown');
       } catch (e) {
         this.error(e.stack);
+        this.reject('error');
       }
 
       if (!valid) {
@@ -356,9 +468,32 @@ class Miner {
     }
   }
 
+  reject(reason) {
+    const count = this.rejected.get(reason) || 0;
+    this.rejected.set(reason, count + 1);
+  }
+
   async execute(method, params) {
     assert(typeof method === 'string');
 
+    const start = process.hrtime();
+    const span = miner.traceBegin();
+
+    try {
+      return await this._execute(method, params);
+    } finally {
+      const [sec, nsec] = process.hrtime(start);
+
+      miner.traceEnd(method, span);
+
+      if (!this.rpc.has(method))
+        this.rpc.set(method, new Histogram());
+
+      this.rpc.get(method).observe(sec + nsec / 1e9);
+    }
+  }
+
+  async _execute(method, params) {
     if (params == null)
       params = null;
 
@@ -9,6 +9,23 @@
   },
   "targets": [{
     "target_name": "hsminer",
+    "actions": [{
+      "action_name": "embed_opencl_kernel",
+      "inputs": [
+        "./scripts/embed",
+        "./src/pow-ng.cl"
+      ],
+      "outputs": [
+        "<(SHARED_INTERMEDIATE_DIR)/pow-ng.cl.h"
+      ],
+      "action": [
+        "node",
+        "./scripts/embed",
+        "./src/pow-ng.cl",
+        "<(SHARED_INTERMEDIATE_DIR)/pow-ng.cl.h",
+        "hs_opencl_source"
+      ]
+    }],
     "sources": [
       "./src/node/hs-miner.cc",
       "./src/blake2b.c",
@@ -17,6 +34,12 @@
       "./src/verify.cc",
       "./src/opencl.c",
       "./src/simple.cc",
+      "./src/stats.c",
+      "./src/latency.c",
+      "./src/perf.c",
+      "./src/energy.c",
+      "./src/shm.c",
+      "./src/trace.c",
       "./src/utils.c"
     ],
     "cflags": [
@@ -39,7 +62,8 @@
       "-Wno-unknown-warning-option"
     ],
     "include_dirs": [
-      "<!(node -e \"require('nan')\")"
+      "<!(node -e \"require('nan')\")",
+      "<(SHARED_INTERMEDIATE_DIR)"
     ],
     "defines": [
       "HS_NETWORK=<(hs_network)",
@@ -84,5 +108,55 @@
         ],
       }]
     ]
+  }, {
+    "target_name": "hs_bench",
+    "type": "executable",
+    "sources": [
+      "./bench/bench.c",
+      "./src/blake2b.c",
+      "./src/sha3.c",
+      "./src/header.c",
+      "./src/simple.cc",
+      "./src/stats.c",
+      "./src/latency.c",
+      "./src/perf.c",
+      "./src/trace.c",
+      "./src/utils.c"
+    ],
+    "cflags": [
+      "-Wall",
+      "-Wno-implicit-fallthrough",
+      "-Wno-uninitialized",
+      "-Wno-unused-function",
+      "-Wno-unused-value",
+      "-Wextra",
+      "-O3"
+    ],
+    "cflags_c": [
+      "-std=c99"
+    ],
+    "cflags_cc+": [
+      "-std=c++11",
+      "-Wno-maybe-uninitialized",
+      "-Wno-unused-parameter",
+      "-Wno-unknown-warning-option"
+    ],
+    "defines": [
+      "HS_NETWORK=<(hs_network)"
+    ],
+    "libraries": [
+      "-lm"
+    ],
+    "conditions": [
+      ["hs_endian=='little'", {
+        "defines": [
+          "HS_LITTLE_ENDIAN"
+        ]
+      }, {
+        "defines": [
+          "HS_BIG_ENDIAN"
+        ]
+      }]
+    ]
   }]
 }
@@ -37,7 +37,12 @@ miner.mine = function mine(hdr, options) {
     opt.grids,
     opt.blocks,
     opt.threads,
-    opt.device
+    opt.device,
+    opt.blockTarget,
+    opt.jit,
+    opt.devices,
+    opt.nonces,
+    opt.extraNonces
   );
 };
 
@@ -64,7 +69,13 @@ miner.mineAsync = function mineAsync(hdr, options) {
         opt.blocks,
         opt.threads,
         opt.device,
-        callback
+        callback,
+        opt.onShare,
+        opt.blockTarget,
+        opt.jit,
+        opt.devices,
+        opt.nonces,
+        opt.extraNonces
       );
     } catch (e) {
       reject(e);
@@ -78,6 +89,260 @@ miner.stop = binding.stop;
 
 miner.stopAll = binding.stopAll;
 
+miner.getVerifyStats = function getVerifyStats(device) {
+  const [candidates, rejected] = binding.getVerifyStats(device >>> 0);
+  return {
+    candidates,
+    confirmed: candidates - rejected,
+    rejected
+  };
+};
+
+miner.verifyShare = function verifyShare(hdr, nonce, extraNonce, options) {
+  const opt = normalize(options);
+  const [valid, block] = binding.verifyShare(
+    hdr,
+    opt.target,
+    opt.blockTarget,
+    nonce >>> 0,
+    extraNonce,
+    opt.device
+  );
+  return { valid, block };
+};
+
+miner.getStats = function getStats(device, backend) {
+  if (backend == null)
+    backend = miner.BACKEND;
+
+  const [
+    hashes,
+    hits,
+    busy,
+    jobs,
+    rate1,
+    rate10,
+    rate60,
+    threads,
+    epoch,
+    lastHit
+  ] = binding.getStats(device >>> 0, backend);
+
+  // Drop the unused thread slots.
+  let len = threads.length;
+
+  while (len > 0 && threads[len - 1] === 0)
+    len -= 1;
+
+  return {
+    hashes,
+    hits,
+    busy: busy / 1e6,
+    jobs,
+    hashrate: {
+      '1s': rate1,
+      '10s': rate10,
+      '60s': rate60
+    },
+    threads: threads.slice(0, len),
+    epoch,
+    lastHit
+  };
+};
+
+miner.openSharedStats = function openSharedStats(path, interval) {
+  if (path == null)
+    path = miner.SHM_PATH;
+
+  binding.openSharedStats(path, interval);
+};
+
+miner.closeSharedStats = function closeSharedStats() {
+  binding.closeSharedStats();
+};
+
+miner.getLatency = function getLatency(backend) {
+  if (backend == null)
+    backend = miner.BACKEND;
+
+  const toMs = ([count, mean, p50, p99, max]) => {
+    return {
+      count,
+      mean: mean / 1e6,
+      p50: p50 / 1e6,
+      p99: p99 / 1e6,
+      max: max / 1e6
+    };
+  };
+
+  const [stop, start, deliver] = binding.getLatency(backend);
+
+  return {
+    stop: toMs(stop),
+    start: toMs(start),
+    deliver: toMs(deliver)
+  };
+};
+
+miner.resetLatency = function resetLatency() {
+  binding.resetLatency();
+};
+
+miner.enablePerf = function enablePerf(enabled = true) {
+  binding.enablePerf(Boolean(enabled));
+};
+
+miner.getPerf = function getPerf(backend) {
+  if (backend == null)
+    backend = miner.BACKEND;
+
+  const [
+    enabled,
+    threads,
+    failed,
+    hashes,
+    cycles,
+    instructions,
+    branchMisses,
+    l1Misses,
+    error
+  ] = binding.getPerf(backend);
+
+  const per = x => hashes > 0 ? x / hashes : 0;
+
+  return {
+    enabled,
+    threads,
+    failed,
+    error,
+    hashes,
+    cycles,
+    instructions,
+    branchMisses,
+    l1Misses,
+    cyclesPerHash: per(cycles),
+    instructionsPerHash: per(instructions),
+    branchMissesPerHash: per(branchMisses),
+    l1MissesPerHash: per(l1Misses),
+    ipc: cycles > 0 ? instructions / cycles : 0
+  };
+};
+
+miner.resetPerf = function resetPerf() {
+  binding.resetPerf();
+};
+
+miner.enableEnergy = function enableEnergy(enabled = true, root = null) {
+  binding.enableEnergy(Boolean(enabled), root);
+};
+
+miner.getEnergy = function getEnergy() {
+  const [enabled, error, items] = binding.getEnergy();
+
+  const runs = items.map(([
+    backend,
+    variant,
+    threads,
+    jobs,
+    hashes,
+    energy,
+    time
+  ]) => {
+    const joules = energy / 1e6;
+    const seconds = time / 1e9;
+
+    return {
+      backend,
+      variant: variant || null,
+      threads,
+      jobs,
+      hashes,
+      joules,
+      seconds,
+      watts: seconds > 0 ? joules / seconds : 0,
+      hashesPerJoule: joules > 0 ? hashes / joules : 0
+    };
+  });
+
+  return { enabled, error, runs };
+};
+
+miner.resetEnergy = function resetEnergy() {
+  binding.resetEnergy();
+};
+
+miner.startTrace = function startTrace() {
+  binding.startTrace();
+  miner.tracing = true;
+};
+
+miner.stopTrace = function stopTrace() {
+  binding.stopTrace();
+  miner.tracing = false;
+};
+
+miner.dumpTrace = function dumpTrace() {
+  return binding.dumpTrace();
+};
+
+miner.traceBegin = function traceBegin() {
+  if (!miner.tracing)
+    return 0;
+
+  return binding.traceNow();
+};
+
+miner.traceEnd = function traceEnd(name, start, value) {
+  if (!miner.tracing || !start)
+    return;
+
+  binding.traceSpan(name, start, value >>> 0);
+};
+
+miner.getOpenCLStats = function getOpenCLStats(device) {
+  const [
+    calls,
+    dispatches,
+    hashes,
+    setup,
+    upload,
+    kernel,
+    readback,
+    wait,
+    teardown,
+    wall,
+    variant,
+    localSize,
+    globalSize,
+    overflows,
+    rescans,
+    jit
+  ] = binding.getOpenCLStats(device >>> 0);
+
+  // Device time when the queues are profiled, wall time otherwise.
+  const busy = kernel || wall;
+
+  return {
+    calls,
+    dispatches,
+    hashes,
+    setup: setup / 1e6,
+    upload: upload / 1e6,
+    kernel: kernel / 1e6,
+    readback: readback / 1e6,
+    wait: wait / 1e6,
+    teardown: teardown / 1e6,
+    wall: wall / 1e6,
+    hashrate: busy ? hashes / (busy / 1e9) : 0,
+    variant,
+    localSize,
+    globalSize,
+    overflows,
+    rescans,
+    jit
+  };
+};
+
 miner.verify = function verify(hdr, target) {
   if (!target)
     target = miner.TARGET;
@@ -390,6 +655,8 @@ miner.HDR_SIZE = 256;
 miner.EXTRA_NONCE_SIZE = 24;
 miner.EXTRA_NONCE_START = 128;
 miner.EXTRA_NONCE_END = 152;
+miner.SHM_PATH = '/dev/shm/hs-miner';
+miner.tracing = false;
 
 /*
  * Helpers
@@ -416,6 +683,12 @@ function normalize(options) {
     grids: options.grids || 0,
     blocks: options.blocks || 0,
     threads: options.threads || 0,
-    device: options.device || 0
+    device: options.device || 0,
+    onShare: options.onShare || null,
+    blockTarget: options.blockTarget || null,
+    jit: options.jit || false,
+    devices: options.devices || null,
+    nonces: options.nonces || 0,
+    extraNonces: options.extraNonces || 0
   };
 }
@@ -0,0 +1,120 @@
+/*!
+ * shm.js - shared-memory stats segment layout
+ * Copyright (c) 2019-2020, The Handshake Developers (MIT License).
+ * https://github.com/handshake-org/hs-miner
+ */
+
+'use strict';
+
+/*
+ * Layout of src/shm.h. Keep the two in sync; shm.h
+ * checks the struct sizes at compile time.
+ */
+
+exports.MAGIC = 0x4d485348;
+exports.VERSION = 2;
+exports.DEVICES = 32;
+exports.THREADS = 64;
+exports.NO_TEMP = -0x80000000;
+
+// hs_shm_t
+exports.HEADER = 40;
+exports.DEVICE = 600;
+exports.SIZE = exports.HEADER + exports.DEVICE * exports.DEVICES;
+
+exports.segment = {
+  magic: 0,
+  version: 4,
+  size: 8,
+  pid: 12,
+  seq: 16,
+  updated: 24,
+  devicesLen: 32,
+  interval: 36
+};
+
+// hs_shm_device_t
+exports.device = {
+  hashes: 0,
+  hits: 8,
+  jobs: 16,
+  epoch: 24,
+  lastHit: 32,
+  busy: 40,
+  rates: 48,
+  temperature: 72,
+  threadsLen: 76,
+  backend: 80,
+  device: 84,
+  threads: 88
+};
+
+// HS_BACKEND_* in src/common.h.
+exports.BACKENDS = ['simple', 'cuda', 'opencl'];
+
+function readU64(buf, off) {
+  return buf.readUInt32LE(off + 4) * 0x100000000 + buf.readUInt32LE(off);
+}
+
+/**
+ * Parse a copy of the segment, taken with the
+ * seqlock protocol of hs_shm_read().
+ * @param {Buffer} buf
+ * @returns {Object}
+ */
+
+exports.parse = function parse(buf) {
+  const seg = exports.segment;
+  const dev = exports.device;
+
+  const magic = buf.readUInt32LE(seg.magic);
+  const version = buf.readUInt32LE(seg.version);
+  const size = buf.readUInt32LE(seg.size);
+
+  if (magic !== exports.MAGIC)
+    throw new Error('Not a stats segment.');
+
+  if (version !== exports.VERSION || size !== exports.SIZE)
+    throw new Error(`Unsupported stats segment version: ${version}.`);
+
+  const out = {
+    pid: buf.readUInt32LE(seg.pid),
+    updated: readU64(buf, seg.updated),
+    interval: buf.readUInt32LE(seg.interval),
+    devices: []
+  };
+
+  const len = Math.min(buf.readUInt32LE(seg.devicesLen), exports.DEVICES);
+
+  for (let i = 0; i < len; i++) {
+    const off = exports.HEADER + i * exports.DEVICE;
+    const threadsLen = Math.min(buf.readUInt32LE(off + dev.threadsLen),
+                                exports.THREADS);
+    const temp = buf.readInt32LE(off + dev.temperature);
+    const backend = buf.readUInt32LE(off + dev.backend);
+    const threads = [];
+
+    for (let j = 0; j < threadsLen; j++)
+      threads.push(readU64(buf, off + dev.threads + j * 8));
+
+    out.devices.push({
+      backend: exports.BACKENDS[backend] || String(backend),
+      id: buf.readUInt32LE(off + dev.device),
+      hashes: readU64(buf, off + dev.hashes),
+      hits: readU64(buf, off + dev.hits),
+      jobs: readU64(buf, off + dev.jobs),
+      epoch: readU64(buf, off + dev.epoch),
+      lastHit: readU64(buf, off + dev.lastHit),
+      busy: readU64(buf, off + dev.busy),
+      rates: [
+        buf.readDoubleLE(off + dev.rates),
+        buf.readDoubleLE(off + dev.rates + 8),
+        buf.readDoubleLE(off + dev.rates + 16)
+      ],
+      temperature: temp === exports.NO_TEMP ? null : temp / 1000,
+      threads
+    });
+  }
+
+  return out;
+};
@@ -16,6 +16,7 @@ extern "C" {
 
 #define HEADER_SIZE 256
 #define EXTRA_NONCE_SIZE 24
+#define HS_MAX_DEVICES 32
 
 #ifndef HS_NETWORK
 #define HS_NETWORK main
@@ -24,19 +25,64 @@ extern "C" {
 #define HS_QUOTE(name) #name
 #define HS_STR(macro) HS_QUOTE(macro)
 
+typedef struct hs_share_s {
+  uint32_t nonce;
+  uint8_t extra_nonce[EXTRA_NONCE_SIZE];
+  bool block;
+  // When the hit was found, from hs_stats_now().
+  uint64_t found;
+} hs_share_t;
+
+// Called from the mining threads for every hit when
+// streaming. Must be safe to call concurrently.
+typedef void (*hs_share_func)(const hs_share_t *share, void *arg);
+
 typedef struct hs_options_s {
   size_t header_len;
   uint32_t nonce;
   uint32_t range;
   uint8_t target[32];
+  // Hits at or below the block target are flagged as blocks
+  // and end the job. Must not be easier than `target`.
+  uint8_t block_target[32];
   uint32_t grids;
   uint32_t blocks;
   uint32_t threads;
   uint32_t device;
+  // When set, the job's range is split across all of these
+  // devices, `device` being the first (OpenCL only).
+  uint32_t devices[HS_MAX_DEVICES];
+  uint32_t devices_len;
+  // Nonces hashed by each work item, 0 for
+  // the build default (OpenCL only).
+  uint32_t nonces;
+  // Extra nonces searched after the header's own, by
+  // incrementing the last 4 bytes of the extra nonce as a
+  // little-endian number. 0 or 1 searches the header's
+  // extra nonce only (OpenCL only).
+  uint32_t extra_nonces;
   bool log;
   bool is_cuda;
+  // Specialize the kernel for the job (OpenCL only).
+  bool jit;
   bool running;
+  // Set by the backend when the result met the block target.
+  bool block;
+  // Set while a verifier checks every streamed hit. Device
+  // block hits are then streamed like shares and the verifier
+  // ends the job once it has confirmed one.
+  bool verified;
+  // Hashes attempted by the job, flushed by the mining threads.
+  uint64_t hashes;
+  // Latency timestamps from hs_stats_now(), zero when unset.
+  // `first` is claimed by the first mining thread to hash and
+  // `stopped` is set when the job is asked to stop.
+  uint64_t started;
+  uint64_t first;
+  uint64_t stopped;
   uint8_t header[HEADER_SIZE];
+  hs_share_func share_func;
+  void *share_arg;
 } hs_options_t;
 
 typedef int32_t (*hs_miner_func)(
@@ -46,11 +92,154 @@ typedef int32_t (*hs_miner_func)(
   bool *match
 );
 
+// Hash counters for one mining thread. Each thread owns a
+// cache line and adds to it in batches, so counting costs
+// no sharing between threads. Busy time is in nanoseconds.
+#define HS_CACHE_LINE 64
+#define HS_STATS_THREADS 64
+#define HS_STATS_BATCH 4096
+
+typedef struct hs_counter_s {
+  uint64_t hashes;
+  uint64_t hits;
+  uint64_t busy;
+  void *device;
+} __attribute__((aligned(HS_CACHE_LINE))) hs_counter_t;
+
+// Totals for a device, with hashrates over the last 1, 10
+// and 60 seconds. `threads` holds each thread slot's hashes.
+// `epoch` counts changes of work (previous block, tree root
+// or mask hash) and `last_hit` is the unix time of the last
+// hit in milliseconds.
+typedef struct hs_stats_s {
+  uint64_t hashes;
+  uint64_t hits;
+  uint64_t busy;
+  uint64_t jobs;
+  uint64_t epoch;
+  uint64_t last_hit;
+  double rates[3];
+  uint64_t threads[HS_STATS_THREADS];
+} hs_stats_t;
+
+// Cumulative OpenCL timings for a device, in nanoseconds.
+// `kernel` and `readback` are read from the queue's profiling
+// counters and stay zero unless HS_OPENCL_PROFILE is set.
+typedef struct hs_opencl_stats_s {
+  uint64_t calls;
+  uint64_t dispatches;
+  uint64_t hashes;
+  uint64_t setup;
+  uint64_t upload;
+  uint64_t kernel;
+  uint64_t readback;
+  uint64_t wait;
+  uint64_t teardown;
+  uint64_t wall;
+  // Launches that found more hits than the result buffer
+  // holds, and the dispatches spent scanning them again.
+  uint64_t overflows;
+  uint64_t rescans;
+  // Dispatches that ran a JIT specialization.
+  uint64_t jit;
+  // Build options of the kernel variant picked by the
+  // autotuner and its launch sizes. NULL and zero until
+  // the device is first used.
+  const char *variant;
+  uint64_t local_size;
+  uint64_t global_size;
+} hs_opencl_stats_t;
+
+// Backends with their own latency histograms.
+#define HS_BACKEND_SIMPLE 0
+#define HS_BACKEND_CUDA 1
+#define HS_BACKEND_OPENCL 2
+#define HS_BACKENDS 3
+
+// Latencies recorded per backend, in nanoseconds: stop() to
+// the last mining thread exiting, job start to the first hash,
+// and a hit being found to its JS callback running.
+#define HS_LATENCY_STOP 0
+#define HS_LATENCY_START 1
+#define HS_LATENCY_DELIVER 2
+#define HS_LATENCIES 3
+
+typedef struct hs_latency_s {
+  uint64_t count;
+  uint64_t mean;
+  uint64_t p50;
+  uint64_t p99;
+  uint64_t max;
+} hs_latency_t;
+
+// Hardware counters read per mining thread when profiling
+// is enabled, summed per backend.
+#define HS_PERF_CYCLES 0
+#define HS_PERF_INSTRUCTIONS 1
+#define HS_PERF_BRANCH_MISSES 2
+#define HS_PERF_L1_MISSES 3
+#define HS_PERF_COUNTERS 4
+
+typedef struct hs_perf_s {
+  int fds[HS_PERF_COUNTERS];
+  uint32_t backend;
+} hs_perf_t;
+
+// `threads` were profiled and `failed` could not be (the
+// last reason is in `error`, an errno). `hashes` only
+// counts the profiled threads.
+typedef struct hs_perf_stats_s {
+  uint64_t threads;
+  uint64_t failed;
+  uint64_t hashes;
+  uint64_t counters[HS_PERF_COUNTERS];
+  int error;
+} hs_perf_stats_t;
+
+// RAPL energy counters of every CPU package, in microjoules.
+#define HS_ENERGY_DOMAINS 8
+#define HS_ENERGY_RUNS 64
+
+typedef struct hs_energy_sample_s {
+  uint32_t len;
+  uint32_t ids[HS_ENERGY_DOMAINS];
+  uint64_t energy[HS_ENERGY_DOMAINS];
+  uint64_t range[HS_ENERGY_DOMAINS];
+  uint64_t time;
+} hs_energy_sample_t;
+
+// A metered job, owned by its worker and linked into the
+// meter while it runs. `hashes` is the job's live counter;
+// `energy` is its share of the packages' energy so far.
+typedef struct hs_energy_job_s {
+  const uint64_t *hashes;
+  uint64_t seen;
+  uint64_t energy;
+  uint64_t begun;
+  struct hs_energy_job_s *next;
+} hs_energy_job_t;
+
+// Energy metered for one configuration of jobs. `variant` is
+// the OpenCL kernel's build options, empty for other backends.
+// `energy` is in microjoules and `time` in nanoseconds.
+typedef struct hs_energy_run_s {
+  uint32_t backend;
+  uint32_t threads;
+  char variant[128];
+  uint64_t jobs;
+  uint64_t hashes;
+  uint64_t energy;
+  uint64_t time;
+} hs_energy_run_t;
+
 typedef struct hs_device_info_s {
   char name[513];
   uint64_t memory;
   uint32_t bits;
   uint32_t clock_rate;
+  // PCI address as "dddd:bb:dd.f" in lowercase hex, the
+  // name sysfs uses, or empty when the driver has none.
+  char pci_bus_id[16];
 } hs_device_info_t;
 
 int32_t
@@ -84,6 +273,9 @@ hs_opencl_device_count();
 bool
 hs_opencl_device_info(uint32_t device, hs_device_info_t *info);
 
+bool
+hs_opencl_stats(uint32_t device, hs_opencl_stats_t *stats);
+
 int32_t
 hs_opencl_run(
   hs_options_t *options,
@@ -99,6 +291,148 @@ hs_verify(
   uint8_t *target
 );
 
+bool
+hs_verify_share(const hs_options_t *options, const hs_share_t *share, bool *block);
+
+uint64_t
+hs_stats_now(void);
+
+hs_counter_t *
+hs_stats_counter(uint32_t backend, uint32_t device, uint32_t thread);
+
+void
+hs_stats_job(uint32_t backend, uint32_t device, const hs_options_t *options);
+
+uint32_t
+hs_stats_device_count(uint32_t backend);
+
+int32_t
+hs_shm_open(const char *path, uint32_t interval);
+
+void
+hs_shm_close(void);
+
+void
+hs_stats_flush(
+  hs_counter_t *counter,
+  hs_options_t *options,
+  uint64_t *hashes,
+  uint64_t *hits,
+  uint64_t *then
+);
+
+bool
+hs_stats_get(uint32_t backend, uint32_t device, hs_stats_t *stats);
+
+void
+hs_latency_record(uint32_t backend, uint32_t kind, uint64_t ns);
+
+void
+hs_latency_first(hs_options_t *options, uint32_t backend);
+
+bool
+hs_latency_get(uint32_t backend, uint32_t kind, hs_latency_t *latency);
+
+void
+hs_latency_reset(void);
+
+void
+hs_perf_enable(bool enabled);
+
+bool
+hs_perf_enabled(void);
+
+void
+hs_perf_begin(hs_perf_t *perf, uint32_t backend);
+
+void
+hs_perf_end(hs_perf_t *perf, uint64_t hashes);
+
+bool
+hs_perf_get(uint32_t backend, hs_perf_stats_t *stats);
+
+void
+hs_perf_reset(void);
+
+void
+hs_energy_enable(bool enabled, const char *root);
+
+bool
+hs_energy_enabled(void);
+
+bool
+hs_energy_begin(hs_energy_job_t *job, const uint64_t *hashes);
+
+void
+hs_energy_end(
+  hs_energy_job_t *job,
+  uint32_t backend,
+  const char *variant,
+  uint32_t threads,
+  uint64_t hashes
+);
+
+size_t
+hs_energy_get(hs_energy_run_t *runs, size_t size, int *error);
+
+void
+hs_energy_reset(void);
+
+// Trace recorder. Each thread writes its own buffer, so
+// recording takes no locks, and every call returns at once
+// unless a trace was started. Timestamps are hs_stats_now().
+void
+hs_trace_start(void);
+
+void
+hs_trace_stop(void);
+
+bool
+hs_trace_enabled(void);
+
+void
+hs_trace_thread(const char *name);
+
+void
+hs_trace_complete(const char *name, uint64_t start, uint64_t end, uint64_t arg);
+
+void
+hs_trace_span(const char *name, uint64_t start, uint64_t arg);
+
+void
+hs_trace_instant(const char *name, uint64_t arg);
+
+const char *
+hs_trace_intern(const char *name);
+
+char *
+hs_trace_dump(size_t *len);
+
+// Candidate pipeline for device backends. Nonces pushed by
+// the mining threads are re-hashed on a dedicated CPU thread
+// and only confirmed shares reach the wrapped share_func.
+// The first confirmed block stops the job and is reported
+// by hs_verifier_free().
+typedef struct hs_verifier_s hs_verifier_t;
+
+hs_verifier_t *
+hs_verifier_alloc(
+  hs_options_t *options,
+  hs_share_func share_func,
+  void *share_arg
+);
+
+void
+hs_verifier_push(const hs_share_t *share, void *arg);
+
+bool
+hs_verifier_free(
+  hs_verifier_t *verifier,
+  uint64_t *candidates,
+  uint64_t *rejected,
+  hs_share_t *block
+);
+
 #ifdef __cplusplus
 }
 #endif
@@ -10,6 +10,7 @@
 #include "sha3.h"
 #include "header.h"
 #include "error.h"
+#include "probes.h"
 
 typedef unsigned char BYTE;
 typedef unsigned int  WORD;
@@ -681,6 +682,7 @@ __global__ void kernel_keccak_hash(BYTE* indata, WORD inlen, BYTE* outdata, WORD
 // Global memory is underscore prefixed
 __constant__ uint8_t _pre_header[96];
 __constant__ uint8_t _target[32];
+__constant__ uint8_t _block_target[32];
 __constant__ uint8_t _padding[32];
 __constant__ uint8_t _commit_hash[32];
 
@@ -700,6 +702,7 @@ __device__ int cuda_memcmp(const void *s1, const void *s2, size_t n) {
 __global__ void kernel_hs_hash(
     uint32_t *out_nonce,
     bool *out_match,
+    bool *out_block,
     unsigned int start_nonce,
     unsigned int range,
     unsigned int threads
@@ -754,8 +757,11 @@ __global__ void kernel_hs_hash(
     // Do a bytewise comparison to see if the
     // hash satisfies the target. This could be
     // either the network target or the pool target.
+    // Hits that also satisfy the block target are
+    // flagged so the host can treat them as urgent.
     if (cuda_memcmp(hash, _target, 32) <= 0) {
         *out_nonce = nonce;
+        *out_block = cuda_memcmp(hash, _block_target, 32) <= 0;
         *out_match = true;
         return;
     }
@@ -806,11 +812,20 @@ int32_t hs_cuda_run(hs_options_t *options, uint32_t *result, uint8_t *extra_nonc
 {
     uint32_t *out_nonce;
     bool *out_match;
+    bool *out_block;
+    bool block = false;
+
+    hs_counter_t *counter =
+      hs_stats_counter(HS_BACKEND_CUDA, options->device, 0);
+    uint64_t then = hs_stats_now();
+    hs_stats_job(HS_BACKEND_CUDA, options->device, options);
 
     cudaSetDevice(options->device);
     cudaMalloc(&out_nonce, sizeof(uint32_t));
     cudaMalloc(&out_match, sizeof(bool));
+    cudaMalloc(&out_block, sizeof(bool));
     cudaMemset(out_match, 0, sizeof(bool));
+    cudaMemset(out_block, 0, sizeof(bool));
 
     // preheader + mask hash
     // nonce       - 4 bytes
@@ -832,21 +847,28 @@ int32_t hs_cuda_run(hs_options_t *options, uint32_t *result, uint8_t *extra_nonc
 
     cudaMemcpyToSymbol(_pre_header, options->header, 96);
     cudaMemcpyToSymbol(_target, options->target, 32);
+    cudaMemcpyToSymbol(_block_target, options->block_target, 32);
 
     // Pointers to prev block and tree root.
     hs_padding(options->header + 32, options->header + 64, 32);
     // Pointers to the subheader and mask hash
     hs_commit_hash(options->header + 128, options->header + 96);
 
+    hs_latency_first(options, HS_BACKEND_CUDA);
+
+    uint64_t launched = hs_stats_now();
+
     kernel_hs_hash<<<options->grids, options->blocks>>>(
         out_nonce,
         out_match,
+        out_block,
         options->nonce,
         options->range,
         options->threads
     );
     cudaMemcpy(result, out_nonce, sizeof(uint32_t), cudaMemcpyDeviceToHost);
     cudaMemcpy(match, out_match, sizeof(bool), cudaMemcpyDeviceToHost);
+    cudaMemcpy(&block, out_block, sizeof(bool), cudaMemcpyDeviceToHost);
 
     cudaError_t error = cudaGetLastError();
     if (error != cudaSuccess) {
@@ -856,9 +878,43 @@ int32_t hs_cuda_run(hs_options_t *options, uint32_t *result, uint8_t *extra_nonc
     }
     cudaFree(out_nonce);
     cudaFree(out_match);
+    cudaFree(out_block);
+
+    hs_trace_span("launch", launched, options->grids);
+
+    if (*match) {
+      HS_PROBE3(found, options->device, *result, block);
+      hs_trace_instant("match", *result);
+    }
+
+    // Each thread of the launch hashes one nonce.
+    uint64_t hashes = (uint64_t)options->grids * options->blocks;
+    uint64_t hits = *match ? 1 : 0;
 
-    if (*match)
+    if (hashes > options->threads)
+      hashes = options->threads;
+
+    if (hashes > options->range)
+      hashes = options->range;
+
+    hs_stats_flush(counter, options, &hashes, &hits, &then);
+
+    // Stream the hit. Only a block hit ends the job,
+    // and under a verifier only once confirmed.
+    if (*match && options->share_func != NULL) {
+      hs_share_t share;
+      share.nonce = *result;
+      memcpy(share.extra_nonce, extra_nonce, EXTRA_NONCE_SIZE);
+      share.block = block;
+      share.found = hs_stats_now();
+      options->share_func(&share, options->share_arg);
+      *match = block && !options->verified;
+    }
+
+    if (*match) {
+      options->block = block;
       return HS_SUCCESS;
+    }
 
     return HS_ENOSOLUTION;
 }
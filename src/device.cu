@@ -1,5 +1,6 @@
 #include <assert.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include "common.h"
 
 uint32_t
@@ -37,5 +38,8 @@ hs_cuda_device_info(uint32_t device, hs_device_info_t *info) {
   info->bits = prop.memoryBusWidth;
   info->clock_rate = prop.memoryClockRate;
 
+  snprintf(info->pci_bus_id, sizeof(info->pci_bus_id), "%04x:%02x:%02x.0",
+           prop.pciDomainID, prop.pciBusID, prop.pciDeviceID);
+
   return true;
 }
@@ -0,0 +1,334 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+#include "common.h"
+
+// Package energy from the powercap RAPL driver, sampled when
+// a metered job starts or ends. The counters cover the whole
+// package, so there is one meter per process: the energy of
+// each interval between samples is split between the jobs
+// running in it by the hashes each did, and intervals with no
+// job running are not charged to anyone. Each top-level
+// `intel-rapl:N` domain is one CPU package (AMD parts use the
+// same names); the `intel-rapl:N:M` subdomains are parts of a
+// package and are skipped.
+#define HS_ENERGY_ROOT "/sys/class/powercap"
+
+static pthread_mutex_t hs_energy_lock = PTHREAD_MUTEX_INITIALIZER;
+static int hs_energy_on = 0;
+static int hs_energy_errno = 0;
+static char hs_energy_root[256] = HS_ENERGY_ROOT;
+static hs_energy_run_t hs_energy_runs[HS_ENERGY_RUNS];
+static size_t hs_energy_runs_len = 0;
+static hs_energy_job_t *hs_energy_jobs = NULL;
+static hs_energy_sample_t hs_energy_last;
+static bool hs_energy_last_ok = false;
+
+static bool
+hs_energy_read_u64(const char *root, const char *name, const char *file,
+                   uint64_t *out) {
+  char path[512];
+  int len = snprintf(path, sizeof(path), "%s/%s/%s", root, name, file);
+
+  if (len < 0 || (size_t)len >= sizeof(path)) {
+    errno = ENAMETOOLONG;
+    return false;
+  }
+
+  FILE *fp = fopen(path, "r");
+
+  if (fp == NULL)
+    return false;
+
+  unsigned long long value;
+  int ret = fscanf(fp, "%llu", &value);
+
+  fclose(fp);
+
+  if (ret != 1) {
+    errno = EIO;
+    return false;
+  }
+
+  *out = (uint64_t)value;
+
+  return true;
+}
+
+// Read every package domain under `root`. Returns
+// false with errno set if none could be read.
+static bool
+hs_energy_sample(const char *root, hs_energy_sample_t *sample) {
+  DIR *dir = opendir(root);
+  int error = ENOENT;
+
+  sample->len = 0;
+
+  if (dir == NULL)
+    return false;
+
+  struct dirent *entry;
+
+  while ((entry = readdir(dir)) != NULL) {
+    unsigned int id;
+    int end = 0;
+
+    if (sscanf(entry->d_name, "intel-rapl:%u%n", &id, &end) != 1)
+      continue;
+
+    if (entry->d_name[end] != '\0')
+      continue;
+
+    if (sample->len == HS_ENERGY_DOMAINS)
+      break;
+
+    uint32_t i = sample->len;
+
+    if (!hs_energy_read_u64(root, entry->d_name, "energy_uj",
+                            &sample->energy[i])) {
+      // Root only since Linux 5.10 (CVE-2020-8694).
+      error = errno;
+      continue;
+    }
+
+    if (!hs_energy_read_u64(root, entry->d_name, "max_energy_range_uj",
+                            &sample->range[i])) {
+      sample->range[i] = 0;
+    }
+
+    sample->ids[i] = (uint32_t)id;
+    sample->len += 1;
+  }
+
+  closedir(dir);
+
+  if (sample->len == 0) {
+    errno = error;
+    return false;
+  }
+
+  sample->time = hs_stats_now();
+
+  return true;
+}
+
+// Meter jobs started from now on. `root` replaces the
+// powercap directory, for tests; NULL for the default.
+void
+hs_energy_enable(bool enabled, const char *root) {
+  pthread_mutex_lock(&hs_energy_lock);
+
+  if (root == NULL)
+    root = HS_ENERGY_ROOT;
+
+  snprintf(hs_energy_root, sizeof(hs_energy_root), "%s", root);
+  __atomic_store_n(&hs_energy_on, enabled ? 1 : 0, __ATOMIC_RELAXED);
+
+  // The next sample may be of other counters.
+  hs_energy_last_ok = false;
+
+  pthread_mutex_unlock(&hs_energy_lock);
+}
+
+bool
+hs_energy_enabled(void) {
+  return __atomic_load_n(&hs_energy_on, __ATOMIC_RELAXED) != 0;
+}
+
+// Microjoules used between two samples of the same domains.
+static uint64_t
+hs_energy_delta(const hs_energy_sample_t *a, const hs_energy_sample_t *b) {
+  uint64_t energy = 0;
+
+  for (uint32_t i = 0; i < a->len; i++) {
+    for (uint32_t j = 0; j < b->len; j++) {
+      if (b->ids[j] != a->ids[i])
+        continue;
+
+      // The counter wraps at max_energy_range_uj.
+      if (b->energy[j] >= a->energy[i])
+        energy += b->energy[j] - a->energy[i];
+      else if (b->range[j] > a->energy[i])
+        energy += b->range[j] - a->energy[i] + b->energy[j];
+
+      break;
+    }
+  }
+
+  return energy;
+}
+
+// Sample the packages and split the energy used since the
+// last sample between the running jobs, by the hashes each
+// did since then (evenly if none hashed). Caller must hold
+// hs_energy_lock.
+static bool
+hs_energy_tick(void) {
+  hs_energy_sample_t sample;
+
+  if (!hs_energy_sample(hs_energy_root, &sample)) {
+    __atomic_store_n(&hs_energy_errno, errno, __ATOMIC_RELAXED);
+    hs_energy_last_ok = false;
+    return false;
+  }
+
+  uint64_t energy = 0;
+
+  if (hs_energy_last_ok)
+    energy = hs_energy_delta(&hs_energy_last, &sample);
+
+  uint64_t total = 0;
+  uint64_t count = 0;
+
+  for (hs_energy_job_t *job = hs_energy_jobs; job; job = job->next) {
+    total += __atomic_load_n(job->hashes, __ATOMIC_RELAXED) - job->seen;
+    count += 1;
+  }
+
+  for (hs_energy_job_t *job = hs_energy_jobs; job; job = job->next) {
+    uint64_t hashes = __atomic_load_n(job->hashes, __ATOMIC_RELAXED);
+
+    if (total > 0)
+      job->energy += (uint64_t)((double)energy * (hashes - job->seen) / total);
+    else
+      job->energy += energy / count;
+
+    job->seen = hashes;
+  }
+
+  hs_energy_last = sample;
+  hs_energy_last_ok = true;
+
+  return true;
+}
+
+// Start metering a job whose hash counter is `hashes`.
+// Returns false when metering is off or no counter could
+// be read.
+bool
+hs_energy_begin(hs_energy_job_t *job, const uint64_t *hashes) {
+  if (!hs_energy_enabled())
+    return false;
+
+  pthread_mutex_lock(&hs_energy_lock);
+
+  if (!hs_energy_tick()) {
+    pthread_mutex_unlock(&hs_energy_lock);
+    return false;
+  }
+
+  job->hashes = hashes;
+  job->seen = __atomic_load_n(hashes, __ATOMIC_RELAXED);
+  job->energy = 0;
+  job->begun = hs_energy_last.time;
+  job->next = hs_energy_jobs;
+
+  hs_energy_jobs = job;
+
+  pthread_mutex_unlock(&hs_energy_lock);
+
+  return true;
+}
+
+static hs_energy_run_t *
+hs_energy_run(uint32_t backend, const char *variant, uint32_t threads) {
+  if (variant == NULL)
+    variant = "";
+
+  for (size_t i = 0; i < hs_energy_runs_len; i++) {
+    hs_energy_run_t *run = &hs_energy_runs[i];
+
+    if (run->backend == backend
+        && run->threads == threads
+        && strncmp(run->variant, variant, sizeof(run->variant) - 1) == 0) {
+      return run;
+    }
+  }
+
+  if (hs_energy_runs_len == HS_ENERGY_RUNS)
+    return NULL;
+
+  hs_energy_run_t *run = &hs_energy_runs[hs_energy_runs_len++];
+
+  memset(run, 0, sizeof(hs_energy_run_t));
+
+  run->backend = backend;
+  run->threads = threads;
+  snprintf(run->variant, sizeof(run->variant), "%s", variant);
+
+  return run;
+}
+
+// Stop metering a job and add its share of the energy to
+// its configuration. If the closing sample fails, the job
+// keeps what it was charged up to the last one.
+void
+hs_energy_end(
+  hs_energy_job_t *job,
+  uint32_t backend,
+  const char *variant,
+  uint32_t threads,
+  uint64_t hashes
+) {
+  pthread_mutex_lock(&hs_energy_lock);
+
+  hs_energy_tick();
+
+  hs_energy_job_t **link = &hs_energy_jobs;
+
+  while (*link != NULL && *link != job)
+    link = &(*link)->next;
+
+  if (*link != NULL)
+    *link = job->next;
+
+  hs_energy_run_t *run = hs_energy_run(backend, variant, threads);
+
+  if (run != NULL) {
+    run->jobs += 1;
+    run->hashes += hashes;
+    run->energy += job->energy;
+    run->time += hs_stats_now() - job->begun;
+  }
+
+  pthread_mutex_unlock(&hs_energy_lock);
+}
+
+// Copy up to `size` configurations. Returns how many there
+// are; `error` is the errno of the last failed read, or 0.
+size_t
+hs_energy_get(hs_energy_run_t *runs, size_t size, int *error) {
+  pthread_mutex_lock(&hs_energy_lock);
+
+  size_t len = hs_energy_runs_len;
+
+  if (size > len)
+    size = len;
+
+  memcpy(runs, hs_energy_runs, size * sizeof(hs_energy_run_t));
+
+  pthread_mutex_unlock(&hs_energy_lock);
+
+  if (error != NULL)
+    *error = __atomic_load_n(&hs_energy_errno, __ATOMIC_RELAXED);
+
+  return len;
+}
+
+void
+hs_energy_reset(void) {
+  pthread_mutex_lock(&hs_energy_lock);
+  hs_energy_runs_len = 0;
+  pthread_mutex_unlock(&hs_energy_lock);
+
+  __atomic_store_n(&hs_energy_errno, 0, __ATOMIC_RELAXED);
+}
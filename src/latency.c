@@ -0,0 +1,160 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+
+// Log-linear buckets in the style of HdrHistogram. Values
+// below 2^HS_LATENCY_BITS get a bucket each and every power
+// of two above that is split into 2^HS_LATENCY_BITS buckets,
+// so a value is reported within 1/32 of what was recorded.
+#define HS_LATENCY_BITS 5
+#define HS_LATENCY_SUB (1 << HS_LATENCY_BITS)
+#define HS_LATENCY_BUCKETS ((64 - HS_LATENCY_BITS + 1) * HS_LATENCY_SUB)
+
+typedef struct hs_histogram_s {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+  uint64_t buckets[HS_LATENCY_BUCKETS];
+} hs_histogram_t;
+
+static hs_histogram_t hs_histograms[HS_BACKENDS][HS_LATENCIES];
+
+static size_t
+hs_latency_bucket(uint64_t value) {
+  if (value < HS_LATENCY_SUB)
+    return (size_t)value;
+
+  int shift = 63 - __builtin_clzll(value) - HS_LATENCY_BITS;
+
+  return (size_t)(shift + 1) * HS_LATENCY_SUB
+       + (size_t)((value >> shift) - HS_LATENCY_SUB);
+}
+
+// Highest value that lands in the bucket.
+static uint64_t
+hs_latency_value(size_t bucket) {
+  if (bucket < HS_LATENCY_SUB)
+    return (uint64_t)bucket;
+
+  size_t shift = bucket / HS_LATENCY_SUB - 1;
+  uint64_t sub = bucket % HS_LATENCY_SUB + HS_LATENCY_SUB;
+
+  return ((sub + 1) << shift) - 1;
+}
+
+// Lock-free, safe to call from any mining thread.
+void
+hs_latency_record(uint32_t backend, uint32_t kind, uint64_t ns) {
+  if (backend >= HS_BACKENDS || kind >= HS_LATENCIES)
+    return;
+
+  hs_histogram_t *hist = &hs_histograms[backend][kind];
+  uint64_t max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+
+  __atomic_fetch_add(&hist->buckets[hs_latency_bucket(ns)], 1,
+                     __ATOMIC_RELAXED);
+  __atomic_fetch_add(&hist->count, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&hist->sum, ns, __ATOMIC_RELAXED);
+
+  while (ns > max) {
+    if (__atomic_compare_exchange_n(&hist->max, &max, ns, true,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+      break;
+    }
+  }
+}
+
+// Called by every mining thread before it starts hashing.
+// The first one records the time since the job started,
+// the rest only pay for a load.
+void
+hs_latency_first(hs_options_t *options, uint32_t backend) {
+  uint64_t first = 0;
+
+  if (options->started == 0)
+    return;
+
+  if (__atomic_load_n(&options->first, __ATOMIC_RELAXED) != 0)
+    return;
+
+  uint64_t now = hs_stats_now();
+
+  if (__atomic_compare_exchange_n(&options->first, &first, now, false,
+                                  __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    if (now > options->started)
+      hs_latency_record(backend, HS_LATENCY_START, now - options->started);
+  }
+}
+
+bool
+hs_latency_get(uint32_t backend, uint32_t kind, hs_latency_t *latency) {
+  memset(latency, 0, sizeof(hs_latency_t));
+
+  if (backend >= HS_BACKENDS || kind >= HS_LATENCIES)
+    return false;
+
+  hs_histogram_t *hist = &hs_histograms[backend][kind];
+  uint64_t counts[HS_LATENCY_BUCKETS];
+  uint64_t total = 0;
+
+  // Snapshot the buckets so the percentiles agree with
+  // each other while records keep coming in.
+  for (size_t i = 0; i < HS_LATENCY_BUCKETS; i++) {
+    counts[i] = __atomic_load_n(&hist->buckets[i], __ATOMIC_RELAXED);
+    total += counts[i];
+  }
+
+  if (total == 0)
+    return true;
+
+  uint64_t max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+  uint64_t sum = __atomic_load_n(&hist->sum, __ATOMIC_RELAXED);
+  uint64_t count = __atomic_load_n(&hist->count, __ATOMIC_RELAXED);
+  uint64_t p50 = (total * 50 + 99) / 100;
+  uint64_t p99 = (total * 99 + 99) / 100;
+  uint64_t seen = 0;
+
+  for (size_t i = 0; i < HS_LATENCY_BUCKETS; i++) {
+    if (counts[i] == 0)
+      continue;
+
+    uint64_t value = hs_latency_value(i);
+
+    if (value > max)
+      value = max;
+
+    if (seen < p50 && seen + counts[i] >= p50)
+      latency->p50 = value;
+
+    seen += counts[i];
+
+    if (seen >= p99) {
+      latency->p99 = value;
+      break;
+    }
+  }
+
+  latency->count = total;
+  latency->mean = count ? sum / count : 0;
+  latency->max = max;
+
+  return true;
+}
+
+void
+hs_latency_reset(void) {
+  for (size_t b = 0; b < HS_BACKENDS; b++) {
+    for (size_t k = 0; k < HS_LATENCIES; k++) {
+      hs_histogram_t *hist = &hs_histograms[b][k];
+
+      for (size_t i = 0; i < HS_LATENCY_BUCKETS; i++)
+        __atomic_store_n(&hist->buckets[i], 0, __ATOMIC_RELAXED);
+
+      __atomic_store_n(&hist->count, 0, __ATOMIC_RELAXED);
+      __atomic_store_n(&hist->sum, 0, __ATOMIC_RELAXED);
+      __atomic_store_n(&hist->max, 0, __ATOMIC_RELAXED);
+    }
+  }
+}
@@ -20,45 +20,70 @@
 #include "../blake2b.h"
 #include "../sha3.h"
 #include "../common.h"
+#include "../probes.h"
 #include "../error.h"
 
+typedef struct hs_verify_stats_s {
+  uint64_t candidates;
+  uint64_t rejected;
+} hs_verify_stats_t;
+
 typedef std::unordered_map<uint32_t, hs_options_t *> job_map_t;
+typedef std::unordered_map<uint32_t, hs_verify_stats_t> verify_map_t;
 
 static std::mutex m;
 static job_map_t job_map;
+static verify_map_t verify_map;
 
-class MinerWorker : public Nan::AsyncWorker {
+class MinerWorker : public Nan::AsyncProgressQueueWorker<hs_share_t> {
 public:
   MinerWorker (
     hs_options_t *options,
     hs_miner_func mine_func,
-    Nan::Callback *callback
+    Nan::Callback *callback,
+    Nan::Callback *share_callback,
+    bool verify,
+    uint32_t backend
   );
 
   virtual ~MinerWorker();
-  virtual void Execute();
+  virtual void Execute(const ExecutionProgress &progress);
+  void HandleProgressCallback(const hs_share_t *shares, size_t count);
   void HandleOKCallback();
 
 private:
+  static void SendShare(const hs_share_t *share, void *arg);
+
   hs_options_t *options;
   hs_miner_func mine_func;
+  Nan::Callback *share_callback;
+  bool verify;
+  uint32_t backend;
   int32_t rc;
   uint32_t nonce;
   uint8_t extra_nonce[EXTRA_NONCE_SIZE];
   bool match;
+  uint64_t found;
 };
 
 MinerWorker::MinerWorker (
   hs_options_t *options,
   hs_miner_func mine_func,
-  Nan::Callback *callback
-) : Nan::AsyncWorker(callback)
+  Nan::Callback *callback,
+  Nan::Callback *share_callback,
+  bool verify,
+  uint32_t backend
+) : Nan::AsyncProgressQueueWorker<hs_share_t>(callback)
   , options(options)
   , mine_func(mine_func)
+  , share_callback(share_callback)
+  , verify(verify)
+  , backend(backend)
   , rc(0)
   , nonce(0)
   , extra_nonce()
   , match(false)
+  , found(0)
 {
   Nan::HandleScope scope;
 }
@@ -67,33 +92,207 @@ MinerWorker::~MinerWorker() {
   assert(options);
   free(options);
   options = NULL;
+
+  if (share_callback) {
+    delete share_callback;
+    share_callback = NULL;
+  }
 }
 
+// Runs on the mining threads. The progress queue
+// is locked internally, so concurrent sends are safe.
 void
-MinerWorker::Execute() {
+MinerWorker::SendShare(const hs_share_t *share, void *arg) {
+  const ExecutionProgress *progress = (const ExecutionProgress *)arg;
+  progress->Send(share, 1);
+}
+
+// A job is registered under every device it runs
+// on, so stopping any of them stops the whole job.
+static bool
+register_job(hs_options_t *options) {
+  uint32_t len = options->devices_len ? options->devices_len : 1;
+  const uint32_t *devices = options->devices_len
+    ? options->devices
+    : &options->device;
+
   m.lock();
 
-  job_map_t::iterator it = job_map.find(options->device);
+  for (uint32_t i = 0; i < len; i++) {
+    if (job_map.find(devices[i]) != job_map.end()) {
+      m.unlock();
+      return false;
+    }
+  }
 
-  if (it != job_map.end()) {
-    m.unlock();
-    SetErrorMessage("Job already in progress.");
+  for (uint32_t i = 0; i < len; i++)
+    job_map.insert(job_map_t::value_type(devices[i], options));
+
+  m.unlock();
+
+  return true;
+}
+
+// Caller must hold the lock.
+static void
+unregister_job(hs_options_t *options) {
+  uint32_t len = options->devices_len ? options->devices_len : 1;
+  const uint32_t *devices = options->devices_len
+    ? options->devices
+    : &options->device;
+
+  for (uint32_t i = 0; i < len; i++)
+    job_map.erase(devices[i]);
+}
+
+// Re-hash a device result on the CPU and clear it when
+// it misses the target. `counted` is set when the verifier
+// already counted it as a candidate.
+static void
+verify_result(
+  hs_options_t *options,
+  uint32_t *nonce,
+  const uint8_t *extra_nonce,
+  bool *match,
+  bool counted,
+  hs_verify_stats_t *stats
+) {
+  hs_share_t share;
+  share.nonce = *nonce;
+  memcpy(share.extra_nonce, extra_nonce, EXTRA_NONCE_SIZE);
+
+  bool block = false;
+
+  if (!counted)
+    stats->candidates += 1;
+
+  if (hs_verify_share(options, &share, &block)) {
+    options->block = block;
     return;
   }
 
-  job_map.insert(job_map_t::value_type(options->device, options));
+  if (!counted)
+    stats->rejected += 1;
 
-  m.unlock();
+  *nonce = 0;
+  *match = false;
+  options->block = false;
+}
+
+// Caller must hold the lock.
+static void
+add_verify_stats(uint32_t device, const hs_verify_stats_t *stats) {
+  hs_verify_stats_t *total = &verify_map[device];
+  total->candidates += stats->candidates;
+  total->rejected += stats->rejected;
+}
+
+// Build options of the device's OpenCL kernel, or
+// NULL for other backends.
+static const char *
+get_variant(uint32_t backend, uint32_t device) {
+#ifdef HS_HAS_OPENCL
+  if (backend == HS_BACKEND_OPENCL) {
+    hs_opencl_stats_t stats;
+    memset(&stats, 0, sizeof(hs_opencl_stats_t));
+
+    if (hs_opencl_stats(device, &stats))
+      return stats.variant;
+  }
+#endif
+
+  return NULL;
+}
+
+void
+MinerWorker::Execute(const ExecutionProgress &progress) {
+  uint64_t begun = hs_stats_now();
+
+  hs_trace_thread("worker");
+
+  if (!register_job(options)) {
+    SetErrorMessage("Job already in progress.");
+    return;
+  }
+
+  HS_PROBE2(job_start, options->device, backend);
 
   // Copy the extra nonce out of the header so that it can
   // be freely searched by the miner_func.
   memcpy(extra_nonce, options->header + 128, EXTRA_NONCE_SIZE);
 
+  // Stream every hit back to JS and keep mining
+  // when a share callback was passed in.
+  if (share_callback) {
+    options->share_func = SendShare;
+    options->share_arg = (void *)&progress;
+  }
+
+  // Device backends may report false positives (OpenCL only
+  // compares 64 bits), so every candidate is re-hashed on a
+  // CPU thread and only confirmed shares are streamed.
+  hs_verifier_t *verifier = NULL;
+
+  if (verify && options->share_func != NULL) {
+    verifier = hs_verifier_alloc(options, options->share_func,
+                                 options->share_arg);
+
+    if (verifier != NULL) {
+      options->share_func = hs_verifier_push;
+      options->share_arg = (void *)verifier;
+      options->verified = true;
+    }
+  }
+
+  hs_energy_job_t energy;
+  bool metered = hs_energy_begin(&energy, &options->hashes);
+
   rc = mine_func(options, &nonce, extra_nonce, &match);
 
+  // Every mining thread has exited by now.
+  uint64_t done = hs_stats_now();
+
+  if (metered) {
+    hs_energy_end(&energy, backend, get_variant(backend, options->device),
+                  options->threads, options->hashes);
+  }
+
+  HS_PROBE4(job_done, options->device, rc, match, done - begun);
+  hs_trace_complete("job", begun, done, options->device);
+
+  hs_verify_stats_t stats = { 0, 0 };
+
+  if (verifier != NULL) {
+    hs_share_t block;
+
+    // The backend mined on past any block it flagged, and the
+    // verifier stopped the job at the first one it confirmed.
+    if (hs_verifier_free(verifier, &stats.candidates,
+                         &stats.rejected, &block)) {
+      rc = HS_SUCCESS;
+      nonce = block.nonce;
+      memcpy(extra_nonce, block.extra_nonce, EXTRA_NONCE_SIZE);
+      match = true;
+    }
+  }
+
+  // A streamed result was already counted by the verifier.
+  if (verify && rc == HS_SUCCESS && match)
+    verify_result(options, &nonce, extra_nonce, &match,
+                  verifier != NULL, &stats);
+
+  if (match)
+    found = done;
+
   m.lock();
 
-  assert(job_map.erase(options->device) == 1);
+  if (options->stopped != 0 && done > options->stopped)
+    hs_latency_record(backend, HS_LATENCY_STOP, done - options->stopped);
+
+  unregister_job(options);
+
+  if (verify)
+    add_verify_stats(options->device, &stats);
 
   m.unlock();
 
@@ -150,6 +349,30 @@ MinerWorker::Execute() {
   }
 }
 
+void
+MinerWorker::HandleProgressCallback(const hs_share_t *shares, size_t count) {
+  Nan::HandleScope scope;
+
+  if (!share_callback)
+    return;
+
+  for (size_t i = 0; i < count; i++) {
+    const hs_share_t *share = &shares[i];
+    uint64_t now = hs_stats_now();
+
+    if (share->found != 0 && now > share->found)
+      hs_latency_record(backend, HS_LATENCY_DELIVER, now - share->found);
+
+    v8::Local<v8::Array> ret = Nan::New<v8::Array>();
+    Nan::Set(ret, 0, Nan::New<v8::Uint32>(share->nonce));
+    Nan::Set(ret, 1, Nan::CopyBuffer((char *)share->extra_nonce, EXTRA_NONCE_SIZE).ToLocalChecked());
+    Nan::Set(ret, 2, Nan::New<v8::Boolean>(share->block));
+
+    v8::Local<v8::Value> argv[] = { ret };
+    share_callback->Call(1, argv, async_resource);
+  }
+}
+
 void
 MinerWorker::HandleOKCallback() {
   Nan::HandleScope scope;
@@ -159,16 +382,28 @@ MinerWorker::HandleOKCallback() {
     Nan::Set(ret, 0, Nan::New<v8::Uint32>(0));
     Nan::Set(ret, 1, Nan::CopyBuffer((char *)extra_nonce, EXTRA_NONCE_SIZE).ToLocalChecked());
     Nan::Set(ret, 2, Nan::New<v8::Boolean>(false));
+    Nan::Set(ret, 3, Nan::New<v8::Boolean>(false));
+    Nan::Set(ret, 4, Nan::New<v8::Number>((double)options->hashes));
     v8::Local<v8::Value> argv[] = { Nan::Null(), ret };
     callback->Call(3, argv, async_resource);
     return;
   }
 
+  // A streamed result was already timed as a share.
+  if (match && !share_callback) {
+    uint64_t now = hs_stats_now();
+
+    if (now > found)
+      hs_latency_record(backend, HS_LATENCY_DELIVER, now - found);
+  }
+
   v8::Local<v8::Array> ret = Nan::New<v8::Array>();
 
   Nan::Set(ret, 0, Nan::New<v8::Uint32>(nonce));
   Nan::Set(ret, 1, Nan::CopyBuffer((char *)extra_nonce, EXTRA_NONCE_SIZE).ToLocalChecked());
   Nan::Set(ret, 2, Nan::New<v8::Boolean>(match));
+  Nan::Set(ret, 3, Nan::New<v8::Boolean>(match && options->block));
+  Nan::Set(ret, 4, Nan::New<v8::Number>((double)options->hashes));
 
   v8::Local<v8::Value> argv[] = { Nan::Null(), ret };
   callback->Call(3, argv, async_resource);
@@ -199,6 +434,60 @@ get_miner_func(const char *backend, bool *is_cuda) {
   return NULL;
 }
 
+// Histogram slot for a backend name,
+// HS_BACKENDS when it is unknown.
+static uint32_t
+get_backend_id(const char *backend) {
+  if (strcmp(backend, "simple") == 0)
+    return HS_BACKEND_SIMPLE;
+
+  if (strcmp(backend, "cuda") == 0)
+    return HS_BACKEND_CUDA;
+
+  if (strcmp(backend, "opencl") == 0)
+    return HS_BACKEND_OPENCL;
+
+  return HS_BACKENDS;
+}
+
+// Parses an optional array of device ids. Returns
+// an error message, or NULL on success.
+static const char *
+get_devices(v8::Local<v8::Value> arg, uint32_t *devices, uint32_t *len) {
+  *len = 0;
+
+  if (arg->IsUndefined() || arg->IsNull())
+    return NULL;
+
+  if (!arg->IsArray())
+    return "`devices` must be an array.";
+
+  v8::Local<v8::Array> arr = arg.As<v8::Array>();
+
+  if (arr->Length() > HS_MAX_DEVICES)
+    return "Too many devices.";
+
+  for (uint32_t i = 0; i < arr->Length(); i++) {
+    v8::Local<v8::Value> item = Nan::Get(arr, i).ToLocalChecked();
+
+    if (!item->IsNumber())
+      return "`devices` must be an array of numbers.";
+
+    uint32_t device = Nan::To<uint32_t>(item).FromJust();
+
+    for (uint32_t j = 0; j < i; j++) {
+      if (devices[j] == device)
+        return "Duplicate device.";
+    }
+
+    devices[i] = device;
+  }
+
+  *len = arr->Length();
+
+  return NULL;
+}
+
 NAN_METHOD(mine) {
   if (info.Length() < 9)
     return Nan::ThrowError("mine() requires arguments.");
@@ -246,6 +535,58 @@ NAN_METHOD(mine) {
   if (target_len != 32)
     return Nan::ThrowError("Invalid target size.");
 
+  // Without a block target, every hit is a block.
+  const uint8_t *block_target = target;
+
+  if (info.Length() > 9 && !info[9]->IsUndefined() && !info[9]->IsNull()) {
+    v8::Local<v8::Object> block_buf = info[9].As<v8::Object>();
+
+    if (!node::Buffer::HasInstance(block_buf))
+      return Nan::ThrowTypeError("`blockTarget` must be a buffer.");
+
+    if (node::Buffer::Length(block_buf) != 32)
+      return Nan::ThrowError("Invalid block target size.");
+
+    block_target = (const uint8_t *)node::Buffer::Data(block_buf);
+  }
+
+  bool jit = false;
+
+  if (info.Length() > 10 && !info[10]->IsUndefined() && !info[10]->IsNull()) {
+    if (!info[10]->IsBoolean())
+      return Nan::ThrowTypeError("`jit` must be a boolean.");
+
+    jit = Nan::To<bool>(info[10]).FromJust();
+  }
+
+  uint32_t devices[HS_MAX_DEVICES];
+  uint32_t devices_len = 0;
+
+  if (info.Length() > 11) {
+    const char *err = get_devices(info[11], devices, &devices_len);
+
+    if (err != NULL)
+      return Nan::ThrowTypeError(err);
+  }
+
+  uint32_t nonces = 0;
+
+  if (info.Length() > 12 && !info[12]->IsUndefined() && !info[12]->IsNull()) {
+    if (!info[12]->IsNumber())
+      return Nan::ThrowTypeError("`nonces` must be a number.");
+
+    nonces = Nan::To<uint32_t>(info[12]).FromJust();
+  }
+
+  uint32_t extra_nonces = 0;
+
+  if (info.Length() > 13 && !info[13]->IsUndefined() && !info[13]->IsNull()) {
+    if (!info[13]->IsNumber())
+      return Nan::ThrowTypeError("`extraNonces` must be a number.");
+
+    extra_nonces = Nan::To<uint32_t>(info[13]).FromJust();
+  }
+
   Nan::Utf8String backend_(info[0]);
   const char *backend = (const char *)*backend_;
 
@@ -254,6 +595,12 @@ NAN_METHOD(mine) {
   if (mine_func == NULL)
     return Nan::ThrowError("Unknown miner function.");
 
+  if (devices_len > 0 && strcmp(backend, "opencl") != 0)
+    return Nan::ThrowError("Multiple devices require the OpenCL backend.");
+
+  if (extra_nonces > 1 && strcmp(backend, "opencl") != 0)
+    return Nan::ThrowError("Extra nonces require the OpenCL backend.");
+
   uint32_t nonce = Nan::To<uint32_t>(info[2]).FromJust();
   uint32_t range = Nan::To<uint32_t>(info[3]).FromJust();
   uint32_t grids = Nan::To<uint32_t>(info[5]).FromJust();
@@ -267,15 +614,29 @@ NAN_METHOD(mine) {
   options.nonce = nonce;
   options.range = range;
   memcpy(&options.target[0], target, 32);
+  memcpy(&options.block_target[0], block_target, 32);
   options.grids = grids;
   options.blocks = blocks;
   options.threads = threads;
-  options.device = device;
+  options.device = devices_len > 0 ? devices[0] : device;
+  memcpy(&options.devices[0], devices, devices_len * sizeof(uint32_t));
+  options.devices_len = devices_len;
+  options.nonces = nonces;
+  options.extra_nonces = extra_nonces;
   options.log = false;
   options.is_cuda = false;
+  options.jit = jit;
   options.running = true;
+  options.block = false;
+  options.verified = false;
+  options.hashes = 0;
+  options.started = hs_stats_now();
+  options.first = 0;
+  options.stopped = 0;
+  options.share_func = NULL;
+  options.share_arg = NULL;
 
-  bool match;
+  bool match = false;
 
   // Allow miner_func to update the extra nonce, use the
   // default value in the header as the initial value.
@@ -284,6 +645,17 @@ NAN_METHOD(mine) {
 
   int32_t rc = mine_func(&options, &nonce, extra_nonce, &match);
 
+  // Device results are checked as in mineAsync().
+  if (strcmp(backend, "simple") != 0 && rc == HS_SUCCESS && match) {
+    hs_verify_stats_t stats = { 0, 0 };
+
+    verify_result(&options, &nonce, extra_nonce, &match, false, &stats);
+
+    m.lock();
+    add_verify_stats(options.device, &stats);
+    m.unlock();
+  }
+
   switch (rc) {
     case HS_SUCCESS: {
       break;
@@ -318,6 +690,8 @@ NAN_METHOD(mine) {
       Nan::Set(ret, 0, Nan::New<v8::Uint32>(0));
       Nan::Set(ret, 1, Nan::CopyBuffer((char *)extra_nonce, EXTRA_NONCE_SIZE).ToLocalChecked());
       Nan::Set(ret, 2, Nan::New<v8::Boolean>(false));
+      Nan::Set(ret, 3, Nan::New<v8::Boolean>(false));
+      Nan::Set(ret, 4, Nan::New<v8::Number>((double)options.hashes));
       return info.GetReturnValue().Set(ret);
     }
     default: {
@@ -335,6 +709,8 @@ NAN_METHOD(mine) {
   Nan::Set(ret, 0, Nan::New<v8::Uint32>(nonce));
   Nan::Set(ret, 1, Nan::CopyBuffer((char *)extra_nonce, EXTRA_NONCE_SIZE).ToLocalChecked());
   Nan::Set(ret, 2, Nan::New<v8::Boolean>(match));
+  Nan::Set(ret, 3, Nan::New<v8::Boolean>(match && options.block));
+  Nan::Set(ret, 4, Nan::New<v8::Number>((double)options.hashes));
 
   info.GetReturnValue().Set(ret);
 }
@@ -377,6 +753,62 @@ NAN_METHOD(mine_async) {
   if (!info[9]->IsFunction())
     return Nan::ThrowTypeError("`callback` must be a function.");
 
+  if (info.Length() > 10 && !info[10]->IsFunction()
+      && !info[10]->IsUndefined() && !info[10]->IsNull()) {
+    return Nan::ThrowTypeError("`onShare` must be a function.");
+  }
+
+  const uint8_t *block_target = NULL;
+
+  if (info.Length() > 11 && !info[11]->IsUndefined() && !info[11]->IsNull()) {
+    v8::Local<v8::Object> block_buf = info[11].As<v8::Object>();
+
+    if (!node::Buffer::HasInstance(block_buf))
+      return Nan::ThrowTypeError("`blockTarget` must be a buffer.");
+
+    if (node::Buffer::Length(block_buf) != 32)
+      return Nan::ThrowError("Invalid block target size.");
+
+    block_target = (const uint8_t *)node::Buffer::Data(block_buf);
+  }
+
+  bool jit = false;
+
+  if (info.Length() > 12 && !info[12]->IsUndefined() && !info[12]->IsNull()) {
+    if (!info[12]->IsBoolean())
+      return Nan::ThrowTypeError("`jit` must be a boolean.");
+
+    jit = Nan::To<bool>(info[12]).FromJust();
+  }
+
+  uint32_t devices[HS_MAX_DEVICES];
+  uint32_t devices_len = 0;
+
+  if (info.Length() > 13) {
+    const char *err = get_devices(info[13], devices, &devices_len);
+
+    if (err != NULL)
+      return Nan::ThrowTypeError(err);
+  }
+
+  uint32_t nonces = 0;
+
+  if (info.Length() > 14 && !info[14]->IsUndefined() && !info[14]->IsNull()) {
+    if (!info[14]->IsNumber())
+      return Nan::ThrowTypeError("`nonces` must be a number.");
+
+    nonces = Nan::To<uint32_t>(info[14]).FromJust();
+  }
+
+  uint32_t extra_nonces = 0;
+
+  if (info.Length() > 15 && !info[15]->IsUndefined() && !info[15]->IsNull()) {
+    if (!info[15]->IsNumber())
+      return Nan::ThrowTypeError("`extraNonces` must be a number.");
+
+    extra_nonces = Nan::To<uint32_t>(info[15]).FromJust();
+  }
+
   const uint8_t *hdr = (const uint8_t *)node::Buffer::Data(hdr_buf);
   size_t hdr_len = node::Buffer::Length(hdr_buf);
 
@@ -397,6 +829,12 @@ NAN_METHOD(mine_async) {
   if (mine_func == NULL)
     return Nan::ThrowError("Unknown miner function.");
 
+  if (devices_len > 0 && strcmp(backend, "opencl") != 0)
+    return Nan::ThrowError("Multiple devices require the OpenCL backend.");
+
+  if (extra_nonces > 1 && strcmp(backend, "opencl") != 0)
+    return Nan::ThrowError("Extra nonces require the OpenCL backend.");
+
   uint32_t nonce = Nan::To<uint32_t>(info[2]).FromJust();
   uint32_t range = Nan::To<uint32_t>(info[3]).FromJust();
   uint32_t grids = Nan::To<uint32_t>(info[5]).FromJust();
@@ -419,17 +857,49 @@ NAN_METHOD(mine_async) {
   options->grids = grids;
   options->blocks = blocks;
   options->threads = threads;
-  options->device = device;
+  options->device = devices_len > 0 ? devices[0] : device;
+  memcpy(&options->devices[0], devices, devices_len * sizeof(uint32_t));
+  options->devices_len = devices_len;
+  options->nonces = nonces;
+  options->extra_nonces = extra_nonces;
   options->log = false;
   options->is_cuda = is_cuda;
+  options->jit = jit;
   options->running = true;
+  options->block = false;
+  options->verified = false;
+  options->hashes = 0;
+  options->started = hs_stats_now();
+  options->first = 0;
+  options->stopped = 0;
+  options->share_func = NULL;
+  options->share_arg = NULL;
+
+  Nan::Callback *share_callback = NULL;
+
+  if (info.Length() > 10 && info[10]->IsFunction())
+    share_callback = new Nan::Callback(info[10].As<v8::Function>());
+
+  // Without a block target, a streaming job treats every
+  // hit as a share, otherwise every hit is a block.
+  if (block_target != NULL)
+    memcpy(&options->block_target[0], block_target, 32);
+  else if (share_callback != NULL)
+    memset(&options->block_target[0], 0x00, 32);
+  else
+    memcpy(&options->block_target[0], target, 32);
 
   MinerWorker *worker = new MinerWorker(
     options,
     mine_func,
-    new Nan::Callback(callback)
+    new Nan::Callback(callback),
+    share_callback,
+    strcmp(backend, "simple") != 0,
+    get_backend_id(backend)
   );
 
+  hs_trace_instant("accepted", options->device);
+
   Nan::AsyncQueueWorker(worker);
 }
 
@@ -470,6 +940,8 @@ NAN_METHOD(stop) {
   job_map_t::iterator it = job_map.find(device);
 
   if (it != job_map.end()) {
+    if (it->second->stopped == 0)
+      it->second->stopped = hs_stats_now();
     it->second->running = false;
     ret = true;
   }
@@ -490,6 +962,8 @@ NAN_METHOD(stop_all) {
   job_map_t::iterator it = job_map.begin();
 
   while (it != job_map.end()) {
+    if (it->second->stopped == 0)
+      it->second->stopped = hs_stats_now();
     it->second->running = false;
     ret = true;
     it++;
@@ -500,6 +974,476 @@ NAN_METHOD(stop_all) {
   info.GetReturnValue().Set(Nan::New<v8::Boolean>(ret));
 }
 
+NAN_METHOD(get_verify_stats) {
+  if (info.Length() != 1)
+    return Nan::ThrowError("get_verify_stats() requires arguments.");
+
+  if (!info[0]->IsNumber())
+    return Nan::ThrowTypeError("`device` must be a number.");
+
+  uint32_t device = Nan::To<uint32_t>(info[0]).FromJust();
+  hs_verify_stats_t stats = { 0, 0 };
+
+  m.lock();
+
+  verify_map_t::iterator it = verify_map.find(device);
+
+  if (it != verify_map.end())
+    stats = it->second;
+
+  m.unlock();
+
+  v8::Local<v8::Array> ret = Nan::New<v8::Array>();
+  Nan::Set(ret, 0, Nan::New<v8::Number>((double)stats.candidates));
+  Nan::Set(ret, 1, Nan::New<v8::Number>((double)stats.rejected));
+
+  info.GetReturnValue().Set(ret);
+}
+
+static void
+collect_share(const hs_share_t *share, void *arg) {
+  *(hs_share_t *)arg = *share;
+}
+
+// Runs one candidate through a verifier thread, as a device
+// hit would be, and adds it to the device's verify stats.
+NAN_METHOD(verify_share) {
+  if (info.Length() < 6)
+    return Nan::ThrowError("verify_share() requires arguments.");
+
+  v8::Local<v8::Object> hdr_buf = info[0].As<v8::Object>();
+
+  if (!node::Buffer::HasInstance(hdr_buf))
+    return Nan::ThrowTypeError("`header` must be a buffer.");
+
+  v8::Local<v8::Object> target_buf = info[1].As<v8::Object>();
+
+  if (!node::Buffer::HasInstance(target_buf))
+    return Nan::ThrowTypeError("`target` must be a buffer.");
+
+  if (!info[3]->IsNumber())
+    return Nan::ThrowTypeError("`nonce` must be a number.");
+
+  v8::Local<v8::Object> extra_buf = info[4].As<v8::Object>();
+
+  if (!node::Buffer::HasInstance(extra_buf))
+    return Nan::ThrowTypeError("`extraNonce` must be a buffer.");
+
+  if (!info[5]->IsNumber())
+    return Nan::ThrowTypeError("`device` must be a number.");
+
+  if (node::Buffer::Length(hdr_buf) != HEADER_SIZE)
+    return Nan::ThrowError("Invalid header size.");
+
+  if (node::Buffer::Length(target_buf) != 32)
+    return Nan::ThrowError("Invalid target size.");
+
+  if (node::Buffer::Length(extra_buf) != EXTRA_NONCE_SIZE)
+    return Nan::ThrowError("Invalid extra nonce size.");
+
+  const uint8_t *target = (const uint8_t *)node::Buffer::Data(target_buf);
+  const uint8_t *block_target = target;
+
+  if (!info[2]->IsUndefined() && !info[2]->IsNull()) {
+    v8::Local<v8::Object> block_buf = info[2].As<v8::Object>();
+
+    if (!node::Buffer::HasInstance(block_buf))
+      return Nan::ThrowTypeError("`blockTarget` must be a buffer.");
+
+    if (node::Buffer::Length(block_buf) != 32)
+      return Nan::ThrowError("Invalid block target size.");
+
+    block_target = (const uint8_t *)node::Buffer::Data(block_buf);
+  }
+
+  hs_options_t options;
+  memset(&options, 0, sizeof(hs_options_t));
+
+  options.header_len = HEADER_SIZE;
+  memcpy(&options.header[0], node::Buffer::Data(hdr_buf), HEADER_SIZE);
+  memcpy(&options.target[0], target, 32);
+  memcpy(&options.block_target[0], block_target, 32);
+  options.device = Nan::To<uint32_t>(info[5]).FromJust();
+  options.running = true;
+
+  hs_share_t share;
+  memset(&share, 0, sizeof(hs_share_t));
+  share.nonce = Nan::To<uint32_t>(info[3]).FromJust();
+  memcpy(share.extra_nonce, node::Buffer::Data(extra_buf), EXTRA_NONCE_SIZE);
+
+  hs_share_t confirmed;
+  memset(&confirmed, 0, sizeof(hs_share_t));
+
+  hs_verifier_t *verifier = hs_verifier_alloc(&options, collect_share,
+                                              (void *)&confirmed);
+
+  if (verifier == NULL)
+    return Nan::ThrowError("Out of memory.");
+
+  hs_verifier_push(&share, (void *)verifier);
+
+  hs_verify_stats_t stats = { 0, 0 };
+
+  hs_verifier_free(verifier, &stats.candidates, &stats.rejected, NULL);
+
+  m.lock();
+  add_verify_stats(options.device, &stats);
+  m.unlock();
+
+  v8::Local<v8::Array> ret = Nan::New<v8::Array>();
+  Nan::Set(ret, 0, Nan::New<v8::Boolean>(stats.rejected == 0));
+  Nan::Set(ret, 1, Nan::New<v8::Boolean>(confirmed.block));
+
+  info.GetReturnValue().Set(ret);
+}
+
+NAN_METHOD(get_stats) {
+  if (info.Length() != 2)
+    return Nan::ThrowError("get_stats() requires arguments.");
+
+  if (!info[0]->IsNumber())
+    return Nan::ThrowTypeError("`device` must be a number.");
+
+  if (!info[1]->IsString())
+    return Nan::ThrowTypeError("`backend` must be a string.");
+
+  uint32_t device = Nan::To<uint32_t>(info[0]).FromJust();
+  Nan::Utf8String backend_(info[1]);
+  uint32_t backend = get_backend_id((const char *)*backend_);
+
+  if (backend == HS_BACKENDS)
+    return Nan::ThrowError("Unknown backend.");
+
+  hs_stats_t stats;
+
+  hs_stats_get(backend, device, &stats);
+
+  v8::Local<v8::Array> threads = Nan::New<v8::Array>();
+
+  for (uint32_t i = 0; i < HS_STATS_THREADS; i++)
+    Nan::Set(threads, i, Nan::New<v8::Number>((double)stats.threads[i]));
+
+  v8::Local<v8::Array> ret = Nan::New<v8::Array>();
+  Nan::Set(ret, 0, Nan::New<v8::Number>((double)stats.hashes));
+  Nan::Set(ret, 1, Nan::New<v8::Number>((double)stats.hits));
+  Nan::Set(ret, 2, Nan::New<v8::Number>((double)stats.busy));
+  Nan::Set(ret, 3, Nan::New<v8::Number>((double)stats.jobs));
+  Nan::Set(ret, 4, Nan::New<v8::Number>(stats.rates[0]));
+  Nan::Set(ret, 5, Nan::New<v8::Number>(stats.rates[1]));
+  Nan::Set(ret, 6, Nan::New<v8::Number>(stats.rates[2]));
+  Nan::Set(ret, 7, threads);
+  Nan::Set(ret, 8, Nan::New<v8::Number>((double)stats.epoch));
+  Nan::Set(ret, 9, Nan::New<v8::Number>((double)stats.last_hit));
+
+  info.GetReturnValue().Set(ret);
+}
+
+NAN_METHOD(open_shared_stats) {
+  if (info.Length() < 1)
+    return Nan::ThrowError("open_shared_stats() requires arguments.");
+
+  if (!info[0]->IsString())
+    return Nan::ThrowTypeError("`path` must be a string.");
+
+  uint32_t interval = 0;
+
+  if (info.Length() > 1 && !info[1]->IsUndefined() && !info[1]->IsNull()) {
+    if (!info[1]->IsNumber())
+      return Nan::ThrowTypeError("`interval` must be a number.");
+
+    interval = Nan::To<uint32_t>(info[1]).FromJust();
+  }
+
+  Nan::Utf8String path(info[0]);
+
+  if (hs_shm_open((const char *)*path, interval) != HS_SUCCESS)
+    return Nan::ThrowError("Could not open the stats segment.");
+}
+
+NAN_METHOD(close_shared_stats) {
+  if (info.Length() != 0)
+    return Nan::ThrowError("close_shared_stats() requires no arguments.");
+
+  hs_shm_close();
+}
+
+NAN_METHOD(get_latency) {
+  if (info.Length() != 1)
+    return Nan::ThrowError("get_latency() requires arguments.");
+
+  if (!info[0]->IsString())
+    return Nan::ThrowTypeError("`backend` must be a string.");
+
+  Nan::Utf8String backend_(info[0]);
+  uint32_t backend = get_backend_id((const char *)*backend_);
+
+  if (backend == HS_BACKENDS)
+    return Nan::ThrowError("Unknown backend.");
+
+  v8::Local<v8::Array> ret = Nan::New<v8::Array>();
+
+  for (uint32_t kind = 0; kind < HS_LATENCIES; kind++) {
+    hs_latency_t latency;
+
+    hs_latency_get(backend, kind, &latency);
+
+    v8::Local<v8::Array> item = Nan::New<v8::Array>();
+    Nan::Set(item, 0, Nan::New<v8::Number>((double)latency.count));
+    Nan::Set(item, 1, Nan::New<v8::Number>((double)latency.mean));
+    Nan::Set(item, 2, Nan::New<v8::Number>((double)latency.p50));
+    Nan::Set(item, 3, Nan::New<v8::Number>((double)latency.p99));
+    Nan::Set(item, 4, Nan::New<v8::Number>((double)latency.max));
+    Nan::Set(ret, kind, item);
+  }
+
+  info.GetReturnValue().Set(ret);
+}
+
+NAN_METHOD(reset_latency) {
+  if (info.Length() != 0)
+    return Nan::ThrowError("reset_latency() requires no arguments.");
+
+  hs_latency_reset();
+}
+
+NAN_METHOD(enable_perf) {
+  if (info.Length() != 1)
+    return Nan::ThrowError("enable_perf() requires arguments.");
+
+  if (!info[0]->IsBoolean())
+    return Nan::ThrowTypeError("`enabled` must be a boolean.");
+
+  hs_perf_enable(Nan::To<bool>(info[0]).FromJust());
+}
+
+NAN_METHOD(get_perf) {
+  if (info.Length() != 1)
+    return Nan::ThrowError("get_perf() requires arguments.");
+
+  if (!info[0]->IsString())
+    return Nan::ThrowTypeError("`backend` must be a string.");
+
+  Nan::Utf8String backend_(info[0]);
+  uint32_t backend = get_backend_id((const char *)*backend_);
+
+  if (backend == HS_BACKENDS)
+    return Nan::ThrowError("Unknown backend.");
+
+  hs_perf_stats_t stats;
+
+  hs_perf_get(backend, &stats);
+
+  v8::Local<v8::Array> ret = Nan::New<v8::Array>();
+  Nan::Set(ret, 0, Nan::New<v8::Boolean>(hs_perf_enabled()));
+  Nan::Set(ret, 1, Nan::New<v8::Number>((double)stats.threads));
+  Nan::Set(ret, 2, Nan::New<v8::Number>((double)stats.failed));
+  Nan::Set(ret, 3, Nan::New<v8::Number>((double)stats.hashes));
+
+  for (uint32_t i = 0; i < HS_PERF_COUNTERS; i++)
+    Nan::Set(ret, 4 + i, Nan::New<v8::Number>((double)stats.counters[i]));
+
+  // Why the last thread could not be profiled.
+  if (stats.error != 0) {
+    const char *error = strerror(stats.error);
+    Nan::Set(ret, 4 + HS_PERF_COUNTERS,
+      Nan::New<v8::String>(error).ToLocalChecked());
+  } else {
+    Nan::Set(ret, 4 + HS_PERF_COUNTERS, Nan::Null());
+  }
+
+  info.GetReturnValue().Set(ret);
+}
+
+NAN_METHOD(enable_energy) {
+  if (info.Length() < 1 || info.Length() > 2)
+    return Nan::ThrowError("enable_energy() requires arguments.");
+
+  if (!info[0]->IsBoolean())
+    return Nan::ThrowTypeError("`enabled` must be a boolean.");
+
+  bool enabled = Nan::To<bool>(info[0]).FromJust();
+
+  if (info.Length() > 1 && !info[1]->IsNull() && !info[1]->IsUndefined()) {
+    if (!info[1]->IsString())
+      return Nan::ThrowTypeError("`root` must be a string.");
+
+    Nan::Utf8String root_(info[1]);
+    hs_energy_enable(enabled, (const char *)*root_);
+  } else {
+    hs_energy_enable(enabled, NULL);
+  }
+}
+
+NAN_METHOD(get_energy) {
+  if (info.Length() != 0)
+    return Nan::ThrowError("get_energy() requires no arguments.");
+
+  static const char *backends[HS_BACKENDS] = { "simple", "cuda", "opencl" };
+  hs_energy_run_t runs[HS_ENERGY_RUNS];
+  int error = 0;
+  size_t len = hs_energy_get(runs, HS_ENERGY_RUNS, &error);
+
+  if (len > HS_ENERGY_RUNS)
+    len = HS_ENERGY_RUNS;
+
+  v8::Local<v8::Array> items = Nan::New<v8::Array>();
+
+  for (size_t i = 0; i < len; i++) {
+    hs_energy_run_t *run = &runs[i];
+    const char *variant = run->variant;
+    v8::Local<v8::Array> item = Nan::New<v8::Array>();
+    Nan::Set(item, 0,
+      Nan::New<v8::String>(backends[run->backend]).ToLocalChecked());
+    Nan::Set(item, 1, Nan::New<v8::String>(variant).ToLocalChecked());
+    Nan::Set(item, 2, Nan::New<v8::Number>((double)run->threads));
+    Nan::Set(item, 3, Nan::New<v8::Number>((double)run->jobs));
+    Nan::Set(item, 4, Nan::New<v8::Number>((double)run->hashes));
+    Nan::Set(item, 5, Nan::New<v8::Number>((double)run->energy));
+    Nan::Set(item, 6, Nan::New<v8::Number>((double)run->time));
+    Nan::Set(items, (uint32_t)i, item);
+  }
+
+  v8::Local<v8::Array> ret = Nan::New<v8::Array>();
+  Nan::Set(ret, 0, Nan::New<v8::Boolean>(hs_energy_enabled()));
+
+  // Why the last sample could not be taken.
+  if (error != 0) {
+    const char *message = strerror(error);
+    Nan::Set(ret, 1, Nan::New<v8::String>(message).ToLocalChecked());
+  } else {
+    Nan::Set(ret, 1, Nan::Null());
+  }
+
+  Nan::Set(ret, 2, items);
+
+  info.GetReturnValue().Set(ret);
+}
+
+NAN_METHOD(reset_energy) {
+  if (info.Length() != 0)
+    return Nan::ThrowError("reset_energy() requires no arguments.");
+
+  hs_energy_reset();
+}
+
+NAN_METHOD(reset_perf) {
+  if (info.Length() != 0)
+    return Nan::ThrowError("reset_perf() requires no arguments.");
+
+  hs_perf_reset();
+}
+
+NAN_METHOD(start_trace) {
+  if (info.Length() != 0)
+    return Nan::ThrowError("start_trace() requires no arguments.");
+
+  hs_trace_start();
+  hs_trace_thread("js");
+}
+
+NAN_METHOD(stop_trace) {
+  if (info.Length() != 0)
+    return Nan::ThrowError("stop_trace() requires no arguments.");
+
+  hs_trace_stop();
+}
+
+NAN_METHOD(dump_trace) {
+  if (info.Length() != 0)
+    return Nan::ThrowError("dump_trace() requires no arguments.");
+
+  size_t len;
+  char *json = hs_trace_dump(&len);
+
+  if (json == NULL)
+    return Nan::ThrowError("Out of memory.");
+
+  v8::Local<v8::String> ret = Nan::New<v8::String>(json, (int)len)
+    .ToLocalChecked();
+
+  free(json);
+
+  info.GetReturnValue().Set(ret);
+}
+
+NAN_METHOD(trace_now) {
+  if (info.Length() != 0)
+    return Nan::ThrowError("trace_now() requires no arguments.");
+
+  info.GetReturnValue().Set(Nan::New<v8::Number>((double)hs_stats_now()));
+}
+
+NAN_METHOD(trace_span) {
+  if (info.Length() < 2)
+    return Nan::ThrowError("trace_span() requires arguments.");
+
+  if (!info[0]->IsString())
+    return Nan::ThrowTypeError("`name` must be a string.");
+
+  if (!info[1]->IsNumber())
+    return Nan::ThrowTypeError("`start` must be a number.");
+
+  uint32_t value = 0;
+
+  if (info.Length() > 2 && !info[2]->IsUndefined() && !info[2]->IsNull()) {
+    if (!info[2]->IsNumber())
+      return Nan::ThrowTypeError("`value` must be a number.");
+
+    value = Nan::To<uint32_t>(info[2]).FromJust();
+  }
+
+  if (!hs_trace_enabled())
+    return;
+
+  Nan::Utf8String name_(info[0]);
+  const char *name = hs_trace_intern((const char *)*name_);
+  double start = Nan::To<double>(info[1]).FromJust();
+
+  if (name != NULL)
+    hs_trace_span(name, (uint64_t)start, value);
+}
+
+NAN_METHOD(get_opencl_stats) {
+  if (info.Length() != 1)
+    return Nan::ThrowError("get_opencl_stats() requires arguments.");
+
+  if (!info[0]->IsNumber())
+    return Nan::ThrowTypeError("`device` must be a number.");
+
+  hs_opencl_stats_t stats;
+  memset(&stats, 0, sizeof(hs_opencl_stats_t));
+
+#ifdef HS_HAS_OPENCL
+  uint32_t device = Nan::To<uint32_t>(info[0]).FromJust();
+  hs_opencl_stats(device, &stats);
+#endif
+
+  v8::Local<v8::Array> ret = Nan::New<v8::Array>();
+  Nan::Set(ret, 0, Nan::New<v8::Number>((double)stats.calls));
+  Nan::Set(ret, 1, Nan::New<v8::Number>((double)stats.dispatches));
+  Nan::Set(ret, 2, Nan::New<v8::Number>((double)stats.hashes));
+  Nan::Set(ret, 3, Nan::New<v8::Number>((double)stats.setup));
+  Nan::Set(ret, 4, Nan::New<v8::Number>((double)stats.upload));
+  Nan::Set(ret, 5, Nan::New<v8::Number>((double)stats.kernel));
+  Nan::Set(ret, 6, Nan::New<v8::Number>((double)stats.readback));
+  Nan::Set(ret, 7, Nan::New<v8::Number>((double)stats.wait));
+  Nan::Set(ret, 8, Nan::New<v8::Number>((double)stats.teardown));
+  Nan::Set(ret, 9, Nan::New<v8::Number>((double)stats.wall));
+
+  if (stats.variant != NULL)
+    Nan::Set(ret, 10, Nan::New<v8::String>(stats.variant).ToLocalChecked());
+  else
+    Nan::Set(ret, 10, Nan::Null());
+
+  Nan::Set(ret, 11, Nan::New<v8::Number>((double)stats.local_size));
+  Nan::Set(ret, 12, Nan::New<v8::Number>((double)stats.global_size));
+  Nan::Set(ret, 13, Nan::New<v8::Number>((double)stats.overflows));
+  Nan::Set(ret, 14, Nan::New<v8::Number>((double)stats.rescans));
+  Nan::Set(ret, 15, Nan::New<v8::Number>((double)stats.jit));
+
+  info.GetReturnValue().Set(ret);
+}
+
 NAN_METHOD(verify) {
   if (info.Length() < 2)
     return Nan::ThrowError("verify() requires arguments.");
@@ -768,6 +1712,25 @@ NAN_MODULE_INIT(init) {
   Nan::Export(target, "isRunning", is_running);
   Nan::Export(target, "stop", stop);
   Nan::Export(target, "stopAll", stop_all);
+  Nan::Export(target, "getVerifyStats", get_verify_stats);
+  Nan::Export(target, "verifyShare", verify_share);
+  Nan::Export(target, "getStats", get_stats);
+  Nan::Export(target, "openSharedStats", open_shared_stats);
+  Nan::Export(target, "closeSharedStats", close_shared_stats);
+  Nan::Export(target, "getLatency", get_latency);
+  Nan::Export(target, "startTrace", start_trace);
+  Nan::Export(target, "stopTrace", stop_trace);
+  Nan::Export(target, "dumpTrace", dump_trace);
+  Nan::Export(target, "traceNow", trace_now);
+  Nan::Export(target, "traceSpan", trace_span);
+  Nan::Export(target, "resetLatency", reset_latency);
+  Nan::Export(target, "enablePerf", enable_perf);
+  Nan::Export(target, "getPerf", get_perf);
+  Nan::Export(target, "resetPerf", reset_perf);
+  Nan::Export(target, "enableEnergy", enable_energy);
+  Nan::Export(target, "getEnergy", get_energy);
+  Nan::Export(target, "resetEnergy", reset_energy);
+  Nan::Export(target, "getOpenCLStats", get_opencl_stats);
   Nan::Export(target, "verify", verify);
   Nan::Export(target, "blake2b", blake2b);
   Nan::Export(target, "sha3", sha3);
@@ -9,6 +9,25 @@ NAN_METHOD(mine_async);
 NAN_METHOD(is_running);
 NAN_METHOD(stop);
 NAN_METHOD(stop_all);
+NAN_METHOD(get_verify_stats);
+NAN_METHOD(verify_share);
+NAN_METHOD(get_stats);
+NAN_METHOD(open_shared_stats);
+NAN_METHOD(close_shared_stats);
+NAN_METHOD(get_latency);
+NAN_METHOD(reset_latency);
+NAN_METHOD(enable_perf);
+NAN_METHOD(get_perf);
+NAN_METHOD(reset_perf);
+NAN_METHOD(enable_energy);
+NAN_METHOD(get_energy);
+NAN_METHOD(reset_energy);
+NAN_METHOD(start_trace);
+NAN_METHOD(stop_trace);
+NAN_METHOD(dump_trace);
+NAN_METHOD(trace_now);
+NAN_METHOD(trace_span);
+NAN_METHOD(get_opencl_stats);
 NAN_METHOD(verify);
 NAN_METHOD(blake2b);
 NAN_METHOD(sha3);
@@ -1,12 +1,58 @@
 #define CL_USE_DEPRECATED_OPENCL_1_2_APIS
-#define H_HEADER_SIZE 192
-#define KERNEL_FILE "./src/pow-ng.cl"
+#define H_HEADER_SIZE 384
+#define H_JOB_SIZE 224
 #define KERNEL_FUNC "pow_ng"
+#define MAX_RESULTS 64
+#define RESULTS_SIZE ((1 + MAX_RESULTS * 3) * sizeof(uint32_t))
+#define JIT_SLOTS 4
+#define PIPELINE_DEPTH 2
+#define JIT_KEY_SIZE (H_JOB_SIZE - 32)
+#define MAX_NONCES 65536
+#define MAX_BATCH 0x80000000
+#define TUNE_RUNS 3
+#define TUNE_MIN_NS 20000000
+#define TUNE_LAUNCH_NS 50000000
+#define TUNE_MAX_ITEMS (1 << 26)
+#define TUNE_NONCES 2
+
+/**
+ * Part of the profile key. Bump it when
+ * tuning changes so old profiles are redone.
+ */
+#define TUNE_VERSION 2
+
+/**
+ * Nonces hashed per work-item when the
+ * job does not ask for a number.
+ */
+#ifndef HS_OPENCL_NONCE_STRIDE
+#define HS_OPENCL_NONCE_STRIDE 1
+#endif
+
+/**
+ * Kernel constants fixed for the life of
+ * the process. These are passed as -D build
+ * options so the compiler can fold them.
+ */
+#ifndef HS_OPENCL_FULL_COMPARE
+#define HS_OPENCL_FULL_COMPARE 1
+#endif
+
+#define _POSIX_C_SOURCE 200809L
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <time.h>
 #include "common.h"
 #include "error.h"
 #include "header.h"
+#include "blake2b.h"
+#include "utils.h"
+#include "probes.h"
 
 #ifdef HS_HAS_OPENCL
 
@@ -19,6 +65,38 @@
 #include <CL/cl.h>
 #endif /* __APPLE__ */
 
+/**
+ * pow-ng.cl, embedded at build time
+ * by scripts/embed.
+ */
+#include "pow-ng.cl.h"
+
+/**
+ * Vendor queries for a device's PCI address,
+ * from cl_khr_pci_bus_info, cl_amd_device_
+ * attribute_query and cl_nv_device_attribute_
+ * query. Older headers lack them.
+ */
+#ifndef CL_DEVICE_PCI_BUS_INFO_KHR
+#define CL_DEVICE_PCI_BUS_INFO_KHR 0x410F
+#endif
+
+#ifndef CL_DEVICE_TOPOLOGY_AMD
+#define CL_DEVICE_TOPOLOGY_AMD 0x4037
+#endif
+
+#ifndef CL_DEVICE_PCI_BUS_ID_NV
+#define CL_DEVICE_PCI_BUS_ID_NV 0x4008
+#endif
+
+#ifndef CL_DEVICE_PCI_SLOT_ID_NV
+#define CL_DEVICE_PCI_SLOT_ID_NV 0x4009
+#endif
+
+#ifndef CL_DEVICE_PCI_DOMAIN_ID_NV
+#define CL_DEVICE_PCI_DOMAIN_ID_NV 0x400A
+#endif
+
 static inline void
 commit_hash(
   const uint8_t *sub_header,
@@ -63,369 +141,2183 @@ padding(
   memcpy(padding, p, len);
 }
 
-int32_t
-hs_opencl_run(
-  hs_options_t *options,
-  uint32_t *result,
-  uint8_t *extra_nonce,
-  bool *match
-) {
-  cl_int err;
-  cl_platform_id pid;
-  cl_device_id *dids;
-  cl_uint count;
-  cl_context ctx;
+/**
+ * Persistent per-device state. Compiling the
+ * program can take longer than a mining range,
+ * so everything is created on first use and
+ * kept for the life of the process.
+ */
+typedef struct hs_opencl_jit_s {
+  uint8_t key[JIT_KEY_SIZE];
   cl_program clp;
+  cl_kernel kernel;
+} hs_opencl_jit_t;
+
+/**
+ * A batch of a job: `size` nonces from
+ * `offset` in each of `rows` extra nonces
+ * from `row`.
+ */
+typedef struct hs_opencl_batch_s {
+  uint64_t offset;
+  uint64_t size;
+  uint64_t row;
+  uint64_t rows;
+} hs_opencl_batch_t;
+
+/**
+ * Launch settings shared by every batch
+ * of a job on one device.
+ */
+typedef struct hs_opencl_launch_s {
+  cl_kernel kernel;
+  cl_uint nonces;
+  cl_uint work_dim;
+  size_t global_size;
+  size_t local_size;
+} hs_opencl_launch_t;
+
+/**
+ * One in-flight dispatch. Each slot has its
+ * own in-order queue and a pinned result
+ * buffer that is mapped for reading once
+ * the kernel is done.
+ */
+typedef struct hs_opencl_slot_s {
   cl_command_queue queue;
+  cl_mem d_results;
+  cl_event kernel;
+  cl_event mapped;
+  uint32_t *h_results;
+  hs_opencl_batch_t batch;
+  uint64_t hashes;
+  uint64_t hits;
+  uint64_t enqueued;
+  bool done;
+} hs_opencl_slot_t;
+
+typedef struct hs_opencl_ctx_s {
+  cl_device_id did;
+  bool busy;
+  bool profile;
+  cl_context ctx;
+  cl_program clp;
   cl_kernel kernel;
 
   /**
-   * Identify platform.
-   *
-   * Note: this function call will only
-   * detect the first platform found.
+   * Kernel variant and launch sizes picked
+   * by the autotuner.
    */
-  err = clGetPlatformIDs(1, &pid, NULL);
-  if (err != CL_SUCCESS) {
-    printf("failed to identify a platform: %d\n", err);
-    exit(1);
-  }
+  int variant;
+  size_t local_size;
+  size_t global_size;
 
-  /* Access devices. */
-  err = clGetDeviceIDs(pid, CL_DEVICE_TYPE_GPU, 0, NULL, &count);
-  if (err != CL_SUCCESS) {
-    printf("failed to access any devices: %d\n", err);
-    exit(1);
-  }
+  cl_mem d_header;
+  uint8_t h_header[H_HEADER_SIZE];
 
-  dids = (cl_device_id *)malloc(sizeof(cl_device_id) * count);
-  err = clGetDeviceIDs(pid, CL_DEVICE_TYPE_GPU, count, dids, NULL);
-  if (err != CL_SUCCESS) {
-    printf("failed to access any devices: %d\n", err);
-    free(dids);
-    exit(1);
-  }
+  /**
+   * Dispatch pipeline. Map events signal
+   * `pipe_cond` from the runtime's callback
+   * thread as slots complete.
+   */
+  hs_opencl_slot_t slots[PIPELINE_DEPTH];
+  pthread_mutex_t pipe_lock;
+  pthread_cond_t pipe_cond;
 
-  /* Create context. */
-  ctx = clCreateContext(NULL, count, dids, NULL, NULL, &err);
-  if(err != CL_SUCCESS) {
-    printf("failed to create a context: %d\n", err);
-    free(dids);
-    exit(1);
-  }
+  /**
+   * Job specializations, most recently used
+   * first. Only the mining thread touches the
+   * list; the compile thread hands its result
+   * over through `jit_ready` under `jit_lock`.
+   */
+  hs_opencl_jit_t jit[JIT_SLOTS];
+  size_t jit_len;
+  pthread_mutex_t jit_lock;
+  hs_opencl_jit_t jit_ready;
+  bool jit_busy;
+  bool jit_failed;
 
-  /* Read kernel file. */
-  FILE *fp = fopen(KERNEL_FILE, "r");
-  if(fp == NULL) {
-    printf("failed to find the program file: %s\n", KERNEL_FILE);
-    free(dids);
-    exit(1);
-  }
+  /**
+   * Totals over every job on the device,
+   * guarded by `hs_opencl_lock`.
+   */
+  hs_opencl_stats_t stats;
+} hs_opencl_ctx_t;
 
-  /* Get size in bytes. */
-  fseek(fp, 0, SEEK_END);
-  size_t sz = ftell(fp);
-  rewind(fp);
+typedef struct hs_opencl_entry_s {
+  cl_platform_id pid;
+  cl_device_id did;
+} hs_opencl_entry_t;
+
+static pthread_mutex_t hs_opencl_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t hs_opencl_cond = PTHREAD_COND_INITIALIZER;
+static hs_opencl_ctx_t **hs_opencl_ctxs = NULL;
+static bool *hs_opencl_inits = NULL;
+static uint32_t hs_opencl_ctxs_len = 0;
+static hs_opencl_entry_t *hs_opencl_registry = NULL;
+static uint32_t hs_opencl_registry_len = 0;
+static bool hs_opencl_registry_ready = false;
 
-  /* Read bytes into buffer. */
-  char *buf = (char*)malloc(sz + 1);
-  buf[sz] = '\0';
-  if (fread(buf, sizeof(char), sz, fp) != sz) {
-    printf("failed to read the program file: %s\n", KERNEL_FILE);
-    free(dids);
-    free(buf);
-    exit(1);
-  }
-  fclose(fp);
+/**
+ * Kernel code shapes tried by the autotuner,
+ * as build options for the LANES,
+ * KECCAK_UNROLL and SIGMA knobs in pow-ng.cl.
+ * The first is used when tuning is skipped.
+ */
+static const char *hs_opencl_variants[] = {
+  "-D LANES=1 -D KECCAK_UNROLL=24 -D SIGMA=0",
+  "-D LANES=2 -D KECCAK_UNROLL=24 -D SIGMA=0",
+  "-D LANES=1 -D KECCAK_UNROLL=2 -D SIGMA=1",
+  "-D LANES=1 -D KECCAK_UNROLL=24 -D SIGMA=1",
+  "-D LANES=1 -D KECCAK_UNROLL=24 -D SIGMA=2"
+};
 
-  /* Create program from buffer. */
-  clp = clCreateProgramWithSource(ctx, 1, (const char**)&buf, &sz, &err);
-  if(err != CL_SUCCESS) {
-    printf("failed to create the program: %d\n", err);
-    free(dids);
-    free(buf);
-    exit(1);
+#define VARIANTS \
+  ((int)(sizeof(hs_opencl_variants) / sizeof(hs_opencl_variants[0])))
+
+/**
+ * Nonces each variant hashes per step, its
+ * LANES. A work-item's `nonces` is rounded
+ * up to a multiple, or the last step hashes
+ * a lane only to throw it away.
+ */
+static const uint32_t hs_opencl_lanes[] = { 1, 2, 1, 1, 1 };
+
+/**
+ * Compiled binaries are cached in
+ * $HS_OPENCL_CACHE, falling back to
+ * $XDG_CACHE_HOME/hs-miner and then
+ * $HOME/.cache/hs-miner. Setting
+ * HS_OPENCL_CACHE to an empty string
+ * disables the cache.
+ */
+static bool
+hs_opencl_cache_dir(char *dir, size_t size) {
+  const char *env = getenv("HS_OPENCL_CACHE");
+  int len;
+
+  if (env != NULL) {
+    if (env[0] == '\0')
+      return false;
+    len = snprintf(dir, size, "%s", env);
+  } else if ((env = getenv("XDG_CACHE_HOME")) != NULL && env[0] != '\0') {
+    mkdir(env, 0755);
+    len = snprintf(dir, size, "%s/hs-miner", env);
+  } else if ((env = getenv("HOME")) != NULL && env[0] != '\0') {
+    len = snprintf(dir, size, "%s/.cache", env);
+    if (len < 0 || (size_t)len >= size)
+      return false;
+    mkdir(dir, 0755);
+    len = snprintf(dir, size, "%s/.cache/hs-miner", env);
+  } else {
+    return false;
   }
 
-  free(buf);
+  if (len < 0 || (size_t)len >= size)
+    return false;
 
-  /* Build program. */
-  err = clBuildProgram(clp, 0, NULL, NULL, NULL, NULL);
-  if(err != CL_SUCCESS) {
-    clGetProgramBuildInfo(clp, dids[options->device], CL_PROGRAM_BUILD_LOG,
-      0, NULL, &sz);
+  if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+    return false;
 
-    char *log = (char*)malloc(sz + 1);
-    log[sz] = '\0';
+  return true;
+}
 
-    clGetProgramBuildInfo(clp, dids[options->device], CL_PROGRAM_BUILD_LOG,
-      sz + 1, log, NULL);
+static void
+hs_opencl_hash_info(hs_blake2b_ctx *ctx, cl_device_id did, cl_uint param) {
+  char value[256];
+  size_t len = 0;
 
-    printf("%s\n", log);
-    free(dids);
-    free(log);
-    exit(1);
-  }
+  if (clGetDeviceInfo(did, param, sizeof(value), value, &len) != CL_SUCCESS)
+    len = 0;
 
-  /**
-   * h_header serialization:
-   *
-   * nonce:        4 bytes
-   * timestamp:    8 bytes
-   * padding:     20 bytes
-   * prev_block:  32 bytes
-   * tree_root:   32 bytes
-   * commit hash: 32 bytes
-   * padding:     32 bytes
-   * target:      32 bytes
-   */
-  uint8_t h_header[H_HEADER_SIZE];
-  memcpy(h_header, options->header, 96);
-  commit_hash(options->header + 128, options->header + 96, h_header + 96);
-  padding(options->header + 32, options->header + 64, h_header + 128, 32);
-  memcpy(h_header + 160, options->target, 32);
+  hs_blake2b_update(ctx, &len, sizeof(len));
+  hs_blake2b_update(ctx, value, len);
+}
 
-  /* Create on-device memory buffers. */
-  cl_mem d_header = clCreateBuffer(ctx, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR
-      | CL_MEM_COPY_HOST_PTR, H_HEADER_SIZE, h_header, &err);
+/**
+ * Cache key: blake2b-256 of the device name,
+ * device and driver versions, build options
+ * and kernel source.
+ */
+static bool
+hs_opencl_cache_path(
+  cl_device_id did,
+  const char *src,
+  size_t src_len,
+  const char *build_options,
+  char *path,
+  size_t size
+) {
+  char dir[1024];
 
-  if (err != CL_SUCCESS) {
-    printf("failed to create d_header buffer: %d\n", err);
-    free(dids);
-    exit(1);
-  }
+  if (!hs_opencl_cache_dir(dir, sizeof(dir)))
+    return false;
 
-  cl_mem d_nonce = clCreateBuffer(ctx, CL_MEM_WRITE_ONLY |
-    CL_MEM_ALLOC_HOST_PTR, sizeof(uint32_t), NULL, &err);
+  uint8_t key[32];
+  char hex[65];
 
-  if (err != CL_SUCCESS) {
-    printf("failed to create d_nonce buffer: %d\n", err);
-    free(dids);
-    exit(1);
-  }
+  hs_blake2b_ctx ctx;
+  hs_blake2b_init(&ctx, 32);
+  hs_opencl_hash_info(&ctx, did, CL_DEVICE_NAME);
+  hs_opencl_hash_info(&ctx, did, CL_DEVICE_VERSION);
+  hs_opencl_hash_info(&ctx, did, CL_DRIVER_VERSION);
+  hs_blake2b_update(&ctx, build_options, strlen(build_options) + 1);
+  hs_blake2b_update(&ctx, src, src_len);
+  hs_blake2b_final(&ctx, key, 32);
 
-  cl_mem d_start_nonce = clCreateBuffer(ctx, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR
-    | CL_MEM_COPY_HOST_PTR, sizeof(uint32_t), &options->nonce, &err);
+  hs_hex_encode(key, 32, hex);
 
-  if (err != CL_SUCCESS) {
-    printf("failed to create d_start_nonce buffer: %d\n", err);
-    free(dids);
-    exit(1);
-  }
+  int len = snprintf(path, size, "%s/%s.bin", dir, hex);
 
-  cl_mem d_range = clCreateBuffer(ctx, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR
-    | CL_MEM_COPY_HOST_PTR, sizeof(uint32_t), &options->range, &err);
+  return len >= 0 && (size_t)len < size;
+}
 
-  if (err != CL_SUCCESS) {
-    printf("failed to create d_range buffer: %d\n", err);
-    free(dids);
-    exit(1);
+static cl_program
+hs_opencl_cache_load(
+  cl_context ctx,
+  cl_device_id did,
+  const char *path,
+  const char *build_options
+) {
+  FILE *fp = fopen(path, "rb");
+
+  if (fp == NULL)
+    return NULL;
+
+  fseek(fp, 0, SEEK_END);
+  long sz = ftell(fp);
+  rewind(fp);
+
+  if (sz <= 0) {
+    fclose(fp);
+    return NULL;
   }
 
-  cl_mem d_match = clCreateBuffer(ctx, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR
-    | CL_MEM_COPY_HOST_PTR, sizeof(bool), match, &err);
+  unsigned char *bin = (unsigned char *)malloc(sz);
 
-  if (err != CL_SUCCESS) {
-    printf("failed to create d_match buffer: %d\n", err);
-    free(dids);
-    exit(1);
+  if (bin == NULL || fread(bin, 1, sz, fp) != (size_t)sz) {
+    fclose(fp);
+    free(bin);
+    return NULL;
   }
 
-  /* Create a command queue. */
-  queue = clCreateCommandQueue(ctx, dids[options->device], 0, &err);
-  if(err != CL_SUCCESS) {
-    printf("failed to create a command queue: %d\n", err);
-    free(dids);
-    exit(1);
-  };
+  fclose(fp);
 
-  free(dids);
+  size_t len = sz;
+  cl_int status;
+  cl_int err;
 
-  /* Create a kernel. */
-  kernel = clCreateKernel(clp, KERNEL_FUNC, &err);
-  if(err != CL_SUCCESS) {
-    printf("failed create a kernel: %d\n", err);
-    exit(1);
-  };
+  cl_program clp = clCreateProgramWithBinary(ctx, 1, &did, &len,
+    (const unsigned char **)&bin, &status, &err);
 
-  /* Create kernel arguments. */
-  err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &d_header);
-  err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &d_nonce);
-  err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &d_start_nonce);
-  err |= clSetKernelArg(kernel, 3, sizeof(cl_mem), &d_range);
-  err |= clSetKernelArg(kernel, 4, sizeof(cl_mem), &d_match);
-  if(err != CL_SUCCESS) {
-    printf("failed to create kernel arguments: %d\n", err);
-    exit(1);
+  free(bin);
+
+  if (err != CL_SUCCESS || status != CL_SUCCESS)
+    return NULL;
+
+  /* A stale or corrupt binary falls back to source. */
+  if (clBuildProgram(clp, 1, &did, build_options, NULL, NULL) != CL_SUCCESS) {
+    clReleaseProgram(clp);
+    return NULL;
   }
 
-  size_t global_size = options->threads;
-  size_t local_size = options->blocks;
+  return clp;
+}
 
-  /* Enqueue kernel. */
-  err = clEnqueueNDRangeKernel(queue, kernel, 1, NULL,
-    &global_size, &local_size, 0, NULL, NULL);
+static void
+hs_opencl_cache_save(cl_program clp, const char *path) {
+  size_t sz = 0;
 
-  if (err != CL_SUCCESS) {
-    printf("failed to enqueue the kernel: %d\n", err);
-    exit(1);
+  if (clGetProgramInfo(clp, CL_PROGRAM_BINARY_SIZES,
+                       sizeof(size_t), &sz, NULL) != CL_SUCCESS || sz == 0) {
+    return;
   }
 
-  /* Read kernel output. */
-  err = clEnqueueReadBuffer(queue, d_nonce, CL_TRUE, 0,
-    sizeof(uint32_t), result, 0, NULL, NULL);
+  unsigned char *bin = (unsigned char *)malloc(sz);
 
-  if (err != CL_SUCCESS) {
-    printf("failed to read the buffer: %d\n", err);
-    exit(1);
+  if (bin == NULL)
+    return;
+
+  if (clGetProgramInfo(clp, CL_PROGRAM_BINARIES,
+                       sizeof(unsigned char *), &bin, NULL) != CL_SUCCESS) {
+    free(bin);
+    return;
   }
 
-  err = clEnqueueReadBuffer(queue, d_match, CL_TRUE, 0,
-    sizeof(bool), match, 0, NULL, NULL);
+  /* Write then rename so readers never see a partial file. */
+  char tmp[1100];
+  int len = snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
 
-  if (err != CL_SUCCESS) {
-    printf("failed to read the buffer: %d\n", err);
-    exit(1);
+  if (len < 0 || (size_t)len >= sizeof(tmp)) {
+    free(bin);
+    return;
   }
 
-  /* Deallocate resources. */
-  clReleaseKernel(kernel);
-  clReleaseMemObject(d_header);
-  clReleaseMemObject(d_nonce);
-  clReleaseMemObject(d_start_nonce);
-  clReleaseMemObject(d_range);
-  clReleaseMemObject(d_match);
-  clReleaseCommandQueue(queue);
-  clReleaseProgram(clp);
-  clReleaseContext(ctx);
+  FILE *fp = fopen(tmp, "wb");
 
-  if (*match)
-    return HS_SUCCESS;
+  if (fp == NULL) {
+    free(bin);
+    return;
+  }
 
-  return HS_ENOSOLUTION;
+  bool ok = fwrite(bin, 1, sz, fp) == sz;
+
+  if (fclose(fp) != 0)
+    ok = false;
+
+  if (!ok || rename(tmp, path) != 0)
+    unlink(tmp);
+
+  free(bin);
 }
 
-uint32_t
-hs_opencl_device_count() {
-  cl_uint p_count, d_count;
-  cl_platform_id *pids;
-  cl_uint total = 0;
+static int
+hs_opencl_build_options(char *build_options, size_t size, int variant) {
+  return snprintf(build_options, size,
+    "-D MAX_RESULTS=%d -D FULL_COMPARE=%d %s",
+    MAX_RESULTS, HS_OPENCL_FULL_COMPARE, hs_opencl_variants[variant]);
+}
+
+/**
+ * Returns NULL if the variant does not
+ * build on this device.
+ */
+static cl_program
+hs_opencl_build(cl_context ctx, cl_device_id did, int variant) {
   cl_int err;
+  size_t sz = hs_opencl_source_len;
+  const char *src = hs_opencl_source;
+  char build_options[256];
 
-  err = clGetPlatformIDs(0, NULL, &p_count);
-  if (err != CL_SUCCESS || !p_count) {
-    printf("failed to retrieve platform count: %d\n", err);
-    exit(1);
+  hs_opencl_build_options(build_options, sizeof(build_options), variant);
+
+  char path[1024];
+  bool cache = hs_opencl_cache_path(did, src, sz, build_options,
+                                    path, sizeof(path));
+
+  if (cache) {
+    cl_program clp = hs_opencl_cache_load(ctx, did, path, build_options);
+
+    if (clp != NULL)
+      return clp;
   }
 
-  pids = (cl_platform_id *)malloc(sizeof(cl_platform_id) * p_count);
-  err = clGetPlatformIDs(p_count, pids, NULL);
-  if (err != CL_SUCCESS) {
-    printf("failed to retreive platform ids: %d\n", err);
-    free(pids);
+  /* Create program from the embedded source. */
+  cl_program clp = clCreateProgramWithSource(ctx, 1, &src, &sz, &err);
+
+  if(err != CL_SUCCESS) {
+    printf("failed to create the program: %d\n", err);
     exit(1);
   }
 
-  for (cl_uint i = 0; i < p_count; i++) {
-    err = clGetDeviceIDs(pids[i], CL_DEVICE_TYPE_GPU, 0, NULL, &d_count);
-    if (err != CL_SUCCESS)
-      continue;
-    total += d_count;
+  /* Build program. */
+  err = clBuildProgram(clp, 1, &did, build_options, NULL, NULL);
+  if(err != CL_SUCCESS) {
+    clGetProgramBuildInfo(clp, did, CL_PROGRAM_BUILD_LOG, 0, NULL, &sz);
+
+    char *log = (char*)malloc(sz + 1);
+    log[sz] = '\0';
+
+    clGetProgramBuildInfo(clp, did, CL_PROGRAM_BUILD_LOG, sz + 1, log, NULL);
+
+    printf("%s\n", log);
+    free(log);
+    clReleaseProgram(clp);
+    return NULL;
   }
 
-  free(pids);
-  return total;
+  if (cache)
+    hs_opencl_cache_save(clp, path);
+
+  return clp;
 }
 
-bool
-hs_opencl_device_info(uint32_t device, hs_device_info_t *info) {
-  cl_uint p_count, d_count;
-  cl_platform_id *pids;
-  cl_device_id *dids;
-  cl_uint total = 0;
-  cl_int err;
+/**
+ * Autotuning. On first use of a device each
+ * variant is timed at a few work group sizes
+ * on a fixed job that can never hit. The
+ * winner and its launch sizes are kept in a
+ * profile file next to the binary cache,
+ * keyed like the cache so that a new driver
+ * or kernel gets tuned again.
+ */
+static bool
+hs_opencl_profile_path(char *path, size_t size) {
+  char dir[1024];
 
-  err = clGetPlatformIDs(0, NULL, &p_count);
-  if (err != CL_SUCCESS || !p_count) {
-    printf("failed to retrieve platform count: %d\n", err);
-    exit(1);
-  }
+  if (!hs_opencl_cache_dir(dir, sizeof(dir)))
+    return false;
 
-  pids = (cl_platform_id *)malloc(sizeof(cl_platform_id) * p_count);
-  err = clGetPlatformIDs(p_count, pids, NULL);
-  if (err != CL_SUCCESS) {
-    printf("failed to retreive platform ids: %d\n", err);
-    free(pids);
-    exit(1);
-  }
+  int len = snprintf(path, size, "%s/profile", dir);
 
-  /**
-   * For each platform, get the devices on it.
-   * This algo flattens the list of devices
-   * per platform.
-   */
-  for (cl_uint i = 0; i < p_count; i++) {
-    err = clGetDeviceIDs(pids[i], CL_DEVICE_TYPE_GPU, 0, NULL, &d_count);
-    if (err != CL_SUCCESS || !d_count)
-      continue;
+  return len >= 0 && (size_t)len < size;
+}
 
-    dids = (cl_device_id *)malloc(sizeof(cl_device_id) * d_count);
-    err = clGetDeviceIDs(pids[i], CL_DEVICE_TYPE_GPU, d_count, dids, NULL);
-    if (err != CL_SUCCESS) {
-      free(dids);
-      continue;
-    }
+static void
+hs_opencl_profile_key(cl_device_id did, char *hex) {
+  char build_options[256];
+  uint8_t key[32];
+  uint8_t version = TUNE_VERSION;
 
-    /* Handles devices that do not belong to the first platform. */
-    if (total + d_count > device) {
-      int index = device - total;
+  hs_opencl_build_options(build_options, sizeof(build_options), 0);
 
-      err = clGetDeviceInfo(dids[index], CL_DEVICE_NAME,
-        sizeof(info->name), info->name, NULL);
+  hs_blake2b_ctx ctx;
+  hs_blake2b_init(&ctx, 32);
+  hs_opencl_hash_info(&ctx, did, CL_DEVICE_NAME);
+  hs_opencl_hash_info(&ctx, did, CL_DEVICE_VERSION);
+  hs_opencl_hash_info(&ctx, did, CL_DRIVER_VERSION);
+  hs_blake2b_update(&ctx, build_options, strlen(build_options) + 1);
+  hs_blake2b_update(&ctx, hs_opencl_source, hs_opencl_source_len);
+  hs_blake2b_update(&ctx, &version, 1);
+  hs_blake2b_final(&ctx, key, 32);
+
+  hs_hex_encode(key, 32, hex);
+}
 
-      if (err != CL_SUCCESS) {
-        printf("failed to access device name: %d\n", err);
-        free(pids);
-        free(dids);
-        exit(1);
-      }
+/**
+ * Profile lines are:
+ *
+ *   <key> <variant> <local size> <global size>
+ *
+ * Later lines win.
+ */
+static bool
+hs_opencl_profile_load(
+  const char *key,
+  int *variant,
+  size_t *local_size,
+  size_t *global_size
+) {
+  char path[1100];
+  char line[256];
+  bool found = false;
 
-      err = clGetDeviceInfo(dids[index], CL_DEVICE_GLOBAL_MEM_SIZE,
-        sizeof(uint64_t), &info->memory, NULL);
+  if (!hs_opencl_profile_path(path, sizeof(path)))
+    return false;
 
-      if (err != CL_SUCCESS) {
-        printf("failed to access device global mem size: %d\n", err);
-        free(pids);
-        free(dids);
-        exit(1);
-      }
+  FILE *fp = fopen(path, "r");
 
-      /**
-       * TODO(tynes): figure out how to query for memory bus size and
-       * set at info->bits. I can't seem to find a good api for it,
-       * just set to 0 for now.
-       */
-      info->bits = 0;
+  if (fp == NULL)
+    return false;
 
-      err = clGetDeviceInfo(dids[index], CL_DEVICE_MAX_CLOCK_FREQUENCY,
-        sizeof(uint32_t), &info->clock_rate, NULL);
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    char k[65];
+    int v;
+    size_t l, g;
 
-      if (err != CL_SUCCESS) {
-        printf("failed to access device max clock freq: %d\n", err);
-        free(pids);
-        free(dids);
-        exit(1);
-      }
+    if (sscanf(line, "%64s %d %zu %zu", k, &v, &l, &g) != 4)
+      continue;
 
-      return true;
-    }
+    if (strcmp(k, key) != 0 || v < 0 || v >= VARIANTS || l == 0 || g == 0)
+      continue;
 
-    total += d_count;
+    *variant = v;
+    *local_size = l;
+    *global_size = g;
+    found = true;
   }
 
-  free(pids);
-  free(dids);
-  return false;
+  fclose(fp);
+
+  return found;
+}
+
+static void
+hs_opencl_profile_save(
+  const char *key,
+  int variant,
+  size_t local_size,
+  size_t global_size
+) {
+  char path[1100];
+
+  if (!hs_opencl_profile_path(path, sizeof(path)))
+    return;
+
+  /* A single short append, so concurrent writers do not interleave. */
+  FILE *fp = fopen(path, "a");
+
+  if (fp == NULL)
+    return;
+
+  fprintf(fp, "%s %d %zu %zu\n", key, variant, local_size, global_size);
+  fclose(fp);
+}
+
+static int64_t
+hs_opencl_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static cl_kernel
+hs_opencl_kernel_create(hs_opencl_ctx_t *dev, cl_program clp) {
+  cl_int err;
+  cl_kernel kernel = clCreateKernel(clp, KERNEL_FUNC, &err);
+
+  if (err != CL_SUCCESS)
+    return NULL;
+
+  /**
+   * The header never moves. The result buffer,
+   * start nonce and range are set per dispatch.
+   */
+  err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &dev->d_header);
+
+  if (err != CL_SUCCESS) {
+    clReleaseKernel(kernel);
+    return NULL;
+  }
+
+  return kernel;
+}
+
+/**
+ * Time one launch, in nanoseconds. Each
+ * work-item hashes TUNE_NONCES nonces, a
+ * multiple of every variant's LANES, so
+ * all variants do their full work.
+ */
+static int64_t
+hs_opencl_time_launch(
+  hs_opencl_ctx_t *dev,
+  cl_kernel kernel,
+  size_t global_size,
+  size_t local_size
+) {
+  static const uint32_t zero = 0;
+  hs_opencl_slot_t *slot = &dev->slots[0];
+  cl_uint start_nonce = 0;
+  cl_uint range = (cl_uint)(global_size * TUNE_NONCES);
+  cl_uint nonces = TUNE_NONCES;
+  cl_uint extra_start = 0;
+  cl_int err;
+
+  err = clEnqueueWriteBuffer(slot->queue, slot->d_results, CL_TRUE, 0,
+    sizeof(uint32_t), &zero, 0, NULL, NULL);
+  err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &slot->d_results);
+  err |= clSetKernelArg(kernel, 2, sizeof(cl_uint), &start_nonce);
+  err |= clSetKernelArg(kernel, 3, sizeof(cl_uint), &range);
+  err |= clSetKernelArg(kernel, 4, sizeof(cl_uint), &nonces);
+  err |= clSetKernelArg(kernel, 5, sizeof(cl_uint), &extra_start);
+
+  if (err != CL_SUCCESS)
+    return -1;
+
+  int64_t then = hs_opencl_now_ns();
+
+  err = clEnqueueNDRangeKernel(slot->queue, kernel, 1, NULL,
+    &global_size, &local_size, 0, NULL, NULL);
+
+  if (err != CL_SUCCESS || clFinish(slot->queue) != CL_SUCCESS)
+    return -1;
+
+  return hs_opencl_now_ns() - then;
+}
+
+/**
+ * Pick the kernel variant and launch sizes
+ * for a device, from the profile if it has
+ * been tuned before. HS_OPENCL_VARIANT
+ * restricts tuning to one variant and skips
+ * the profile.
+ */
+static void
+hs_opencl_tune(hs_opencl_ctx_t *dev) {
+  static const size_t local_sizes[] = { 64, 128, 256, 512 };
+  char key[65];
+  int first = 0;
+  int last = VARIANTS - 1;
+  bool forced = false;
+
+  const char *env = getenv("HS_OPENCL_VARIANT");
+
+  if (env != NULL && env[0] != '\0') {
+    first = last = atoi(env);
+
+    if (first < 0 || first >= VARIANTS)
+      first = last = 0;
+
+    forced = true;
+  }
+
+  hs_opencl_profile_key(dev->did, key);
+
+  if (!forced && hs_opencl_profile_load(key, &dev->variant,
+                                        &dev->local_size,
+                                        &dev->global_size)) {
+    dev->clp = hs_opencl_build(dev->ctx, dev->did, dev->variant);
+
+    if (dev->clp != NULL) {
+      dev->kernel = hs_opencl_kernel_create(dev, dev->clp);
+
+      if (dev->kernel != NULL)
+        return;
+
+      clReleaseProgram(dev->clp);
+      dev->clp = NULL;
+    }
+  }
+
+  /* A fixed job with an unreachable target. */
+  uint8_t h_header[H_HEADER_SIZE];
+
+  for (int i = 0; i < H_HEADER_SIZE; i++)
+    h_header[i] = (uint8_t)(i * 7 + 3);
+
+  memset(h_header + 160, 0, 64);
+
+  cl_int err = clEnqueueWriteBuffer(dev->slots[0].queue, dev->d_header,
+    CL_TRUE, 0, H_HEADER_SIZE, h_header, 0, NULL, NULL);
+
+  if (err != CL_SUCCESS) {
+    printf("failed to write the buffers: %d\n", err);
+    exit(1);
+  }
+
+  cl_uint units = 1;
+
+  if (clGetDeviceInfo(dev->did, CL_DEVICE_MAX_COMPUTE_UNITS,
+                      sizeof(cl_uint), &units, NULL) != CL_SUCCESS
+      || units == 0) {
+    units = 1;
+  }
+
+  double best_rate = 0;
+  int best = -1;
+
+  for (int v = first; v <= last; v++) {
+    cl_program clp = hs_opencl_build(dev->ctx, dev->did, v);
+
+    if (clp == NULL)
+      continue;
+
+    cl_kernel kernel = hs_opencl_kernel_create(dev, clp);
+
+    if (kernel == NULL) {
+      clReleaseProgram(clp);
+      continue;
+    }
+
+    size_t max_local = 0;
+
+    if (clGetKernelWorkGroupInfo(kernel, dev->did, CL_KERNEL_WORK_GROUP_SIZE,
+                                 sizeof(size_t), &max_local, NULL)
+        != CL_SUCCESS || max_local == 0) {
+      max_local = 1;
+    }
+
+    for (size_t i = 0; i < sizeof(local_sizes) / sizeof(size_t); i++) {
+      size_t local = local_sizes[i];
+
+      /* Devices with small groups get a single try. */
+      if (local > max_local) {
+        if (i > 0)
+          break;
+        local = max_local;
+      }
+
+      /**
+       * Grow the launch until it is long
+       * enough to time, then keep the best
+       * of a few runs.
+       */
+      size_t items = (size_t)units * local * 8;
+      int64_t ns = hs_opencl_time_launch(dev, kernel, items, local);
+
+      while (ns >= 0 && ns < TUNE_MIN_NS && items * 2 <= TUNE_MAX_ITEMS) {
+        items *= 2;
+        ns = hs_opencl_time_launch(dev, kernel, items, local);
+      }
+
+      for (int r = 0; r < TUNE_RUNS && ns >= 0; r++) {
+        int64_t t = hs_opencl_time_launch(dev, kernel, items, local);
+
+        if (t < 0 || t < ns)
+          ns = t;
+      }
+
+      if (ns <= 0)
+        continue;
+
+      /* Hashes per nanosecond. */
+      double rate = (double)items * TUNE_NONCES / (double)ns;
+
+      if (rate <= best_rate)
+        continue;
+
+      /**
+       * Size launches to hash for about
+       * TUNE_LAUNCH_NS, as a work-item count
+       * at one nonce per item.
+       */
+      double global = rate * TUNE_LAUNCH_NS;
+
+      if (global > TUNE_MAX_ITEMS)
+        global = TUNE_MAX_ITEMS;
+
+      dev->local_size = local;
+      dev->global_size = ((size_t)global + local - 1) / local * local;
+
+      if (best != v) {
+        if (dev->kernel != NULL) {
+          clReleaseKernel(dev->kernel);
+          clReleaseProgram(dev->clp);
+        }
+
+        dev->clp = clp;
+        dev->kernel = kernel;
+        dev->variant = v;
+        best = v;
+      }
+
+      best_rate = rate;
+    }
+
+    if (best != v) {
+      clReleaseKernel(kernel);
+      clReleaseProgram(clp);
+    }
+  }
+
+  if (best < 0) {
+    printf("failed to build any kernel variant\n");
+    exit(1);
+  }
+
+  if (!forced)
+    hs_opencl_profile_save(key, dev->variant, dev->local_size,
+                           dev->global_size);
+}
+
+/**
+ * Unified device registry: every device of
+ * every platform, ordered by platform and
+ * then by device. It is built once, so a
+ * device id means the same device for the
+ * life of the process.
+ *
+ * Must be called with `hs_opencl_lock` held.
+ */
+static void
+hs_opencl_registry_init() {
+  cl_uint p_count, d_count;
+  cl_platform_id *pids;
+  cl_int err;
+
+  if (hs_opencl_registry_ready)
+    return;
+
+  hs_opencl_registry_ready = true;
+
+  err = clGetPlatformIDs(0, NULL, &p_count);
+  if (err != CL_SUCCESS || !p_count)
+    return;
+
+  pids = (cl_platform_id *)malloc(sizeof(cl_platform_id) * p_count);
+
+  if (pids == NULL)
+    return;
+
+  err = clGetPlatformIDs(p_count, pids, NULL);
+  if (err != CL_SUCCESS) {
+    printf("failed to retreive platform ids: %d\n", err);
+    free(pids);
+    return;
+  }
+
+  for (cl_uint i = 0; i < p_count; i++) {
+    err = clGetDeviceIDs(pids[i], CL_DEVICE_TYPE_ALL, 0, NULL, &d_count);
+    if (err != CL_SUCCESS || !d_count)
+      continue;
+
+    hs_opencl_entry_t *registry = (hs_opencl_entry_t *)realloc(
+      hs_opencl_registry,
+      (hs_opencl_registry_len + d_count) * sizeof(hs_opencl_entry_t));
+
+    if (registry == NULL)
+      break;
+
+    hs_opencl_registry = registry;
+
+    cl_device_id *dids = (cl_device_id *)malloc(sizeof(cl_device_id) * d_count);
+
+    if (dids == NULL)
+      break;
+
+    err = clGetDeviceIDs(pids[i], CL_DEVICE_TYPE_ALL, d_count, dids, NULL);
+    if (err != CL_SUCCESS) {
+      free(dids);
+      continue;
+    }
+
+    for (cl_uint j = 0; j < d_count; j++) {
+      hs_opencl_entry_t *entry = &hs_opencl_registry[hs_opencl_registry_len++];
+      entry->pid = pids[i];
+      entry->did = dids[j];
+    }
+
+    free(dids);
+  }
+
+  free(pids);
+}
+
+/**
+ * Look up a device in the registry.
+ */
+static bool
+hs_opencl_registry_get(uint32_t device, hs_opencl_entry_t *entry) {
+  bool found = false;
+
+  pthread_mutex_lock(&hs_opencl_lock);
+
+  hs_opencl_registry_init();
+
+  if (device < hs_opencl_registry_len) {
+    *entry = hs_opencl_registry[device];
+    found = true;
+  }
+
+  pthread_mutex_unlock(&hs_opencl_lock);
+
+  return found;
+}
+
+static hs_opencl_ctx_t *
+hs_opencl_ctx_create(const hs_opencl_entry_t *entry) {
+  cl_int err;
+
+  hs_opencl_ctx_t *dev = (hs_opencl_ctx_t *)calloc(1, sizeof(hs_opencl_ctx_t));
+
+  if (dev == NULL)
+    return NULL;
+
+  dev->did = entry->did;
+  dev->profile = getenv("HS_OPENCL_PROFILE") != NULL
+              && strcmp(getenv("HS_OPENCL_PROFILE"), "") != 0
+              && strcmp(getenv("HS_OPENCL_PROFILE"), "0") != 0;
+  pthread_mutex_init(&dev->jit_lock, NULL);
+  pthread_mutex_init(&dev->pipe_lock, NULL);
+  pthread_cond_init(&dev->pipe_cond, NULL);
+
+  /**
+   * Devices may come from any platform, so
+   * name it rather than relying on a default.
+   */
+  cl_context_properties props[] = {
+    CL_CONTEXT_PLATFORM, (cl_context_properties)entry->pid, 0
+  };
+
+  /* Create context. */
+  dev->ctx = clCreateContext(props, 1, &dev->did, NULL, NULL, &err);
+  if(err != CL_SUCCESS) {
+    printf("failed to create a context: %d\n", err);
+    exit(1);
+  }
+
+  /* Create on-device memory buffers. */
+  dev->d_header = clCreateBuffer(dev->ctx, CL_MEM_READ_ONLY,
+    H_HEADER_SIZE, NULL, &err);
+
+  if (err != CL_SUCCESS) {
+    printf("failed to create d_header buffer: %d\n", err);
+    exit(1);
+  }
+
+  for (int i = 0; i < PIPELINE_DEPTH; i++) {
+    hs_opencl_slot_t *slot = &dev->slots[i];
+
+    /* Pinned, so the mapped results need no copy. */
+    slot->d_results = clCreateBuffer(dev->ctx, CL_MEM_READ_WRITE
+      | CL_MEM_ALLOC_HOST_PTR, RESULTS_SIZE, NULL, &err);
+
+    if (err != CL_SUCCESS) {
+      printf("failed to create d_results buffer: %d\n", err);
+      exit(1);
+    }
+
+    /* Create a command queue. */
+    slot->queue = clCreateCommandQueue(dev->ctx, dev->did,
+      dev->profile ? CL_QUEUE_PROFILING_ENABLE : 0, &err);
+    if(err != CL_SUCCESS) {
+      printf("failed to create a command queue: %d\n", err);
+      exit(1);
+    };
+  }
+
+  /* Build the kernel that suits the device best. */
+  hs_opencl_tune(dev);
+
+  return dev;
+}
+
+/**
+ * Claim a device for a job, creating its
+ * context on first use. A device runs one
+ * job at a time; the lock guards the table,
+ * the busy flags and the init flags, not
+ * the contexts.
+ */
+static int32_t
+hs_opencl_ctx_acquire(uint32_t device, hs_opencl_ctx_t **out) {
+  hs_opencl_entry_t entry;
+  hs_opencl_ctx_t *dev = NULL;
+  int32_t rc = HS_SUCCESS;
+
+  if (!hs_opencl_registry_get(device, &entry))
+    return HS_ENODEVICE;
+
+  pthread_mutex_lock(&hs_opencl_lock);
+
+  if (device >= hs_opencl_ctxs_len) {
+    hs_opencl_ctx_t **ctxs = (hs_opencl_ctx_t **)realloc(hs_opencl_ctxs,
+      (device + 1) * sizeof(hs_opencl_ctx_t *));
+
+    if (ctxs == NULL) {
+      rc = HS_ENOMEM;
+      goto done;
+    }
+
+    hs_opencl_ctxs = ctxs;
+
+    bool *inits = (bool *)realloc(hs_opencl_inits,
+      (device + 1) * sizeof(bool));
+
+    if (inits == NULL) {
+      rc = HS_ENOMEM;
+      goto done;
+    }
+
+    hs_opencl_inits = inits;
+
+    for (uint32_t i = hs_opencl_ctxs_len; i <= device; i++) {
+      ctxs[i] = NULL;
+      inits[i] = false;
+    }
+
+    hs_opencl_ctxs_len = device + 1;
+  }
+
+  /**
+   * Creating a context builds and tunes the
+   * kernel, which takes seconds. The first
+   * job on a device does it without the lock,
+   * so stats and device queries from the JS
+   * thread and other devices' setup go on.
+   * Jobs for the same device wait for it.
+   */
+  while (hs_opencl_inits[device])
+    pthread_cond_wait(&hs_opencl_cond, &hs_opencl_lock);
+
+  if (hs_opencl_ctxs[device] == NULL) {
+    hs_opencl_inits[device] = true;
+    pthread_mutex_unlock(&hs_opencl_lock);
+
+    dev = hs_opencl_ctx_create(&entry);
+
+    pthread_mutex_lock(&hs_opencl_lock);
+    hs_opencl_ctxs[device] = dev;
+    hs_opencl_inits[device] = false;
+    pthread_cond_broadcast(&hs_opencl_cond);
+  }
+
+  dev = hs_opencl_ctxs[device];
+
+  if (dev == NULL) {
+    rc = HS_ENOMEM;
+    goto done;
+  }
+
+  if (dev->busy) {
+    rc = HS_EMAXLOAD;
+    goto done;
+  }
+
+  dev->busy = true;
+  *out = dev;
+
+done:
+  pthread_mutex_unlock(&hs_opencl_lock);
+  return rc;
+}
+
+/**
+ * Hand a device back, adding the job's
+ * timings to its totals.
+ */
+static void
+hs_opencl_ctx_release(hs_opencl_ctx_t *dev, const hs_opencl_stats_t *stats) {
+  pthread_mutex_lock(&hs_opencl_lock);
+
+  dev->busy = false;
+  dev->stats.calls += stats->calls;
+  dev->stats.dispatches += stats->dispatches;
+  dev->stats.hashes += stats->hashes;
+  dev->stats.setup += stats->setup;
+  dev->stats.upload += stats->upload;
+  dev->stats.kernel += stats->kernel;
+  dev->stats.readback += stats->readback;
+  dev->stats.wait += stats->wait;
+  dev->stats.teardown += stats->teardown;
+  dev->stats.wall += stats->wall;
+  dev->stats.overflows += stats->overflows;
+  dev->stats.rescans += stats->rescans;
+  dev->stats.jit += stats->jit;
+
+  pthread_mutex_unlock(&hs_opencl_lock);
+}
+
+/**
+ * The JIT key is the job block with the nonce
+ * and timestamp zeroed and the commit hash cut
+ * out: the nonce and commit hash change within
+ * a job and the timestamp between jobs, so none
+ * are baked. Neither is the sub-header that
+ * follows.
+ */
+static void
+hs_opencl_jit_key(const uint8_t *h_header, uint8_t *key) {
+  memcpy(key, h_header, 96);
+  memset(key, 0, 12);
+  memcpy(key + 96, h_header + 128, H_JOB_SIZE - 128);
+}
+
+typedef struct hs_opencl_jit_args_s {
+  hs_opencl_ctx_t *dev;
+  uint8_t key[JIT_KEY_SIZE];
+} hs_opencl_jit_args_t;
+
+static void *
+hs_opencl_jit_thread(void *ptr) {
+  hs_opencl_jit_args_t *args = (hs_opencl_jit_args_t *)ptr;
+  hs_opencl_ctx_t *dev = args->dev;
+  hs_opencl_jit_t jit;
+  cl_int err;
+
+  memcpy(jit.key, args->key, JIT_KEY_SIZE);
+  jit.clp = NULL;
+  jit.kernel = NULL;
+
+  free(args);
+
+  /**
+   * Bake every job word except the nonce and
+   * timestamp (words 0-1) and the commit hash
+   * (words 12-15) as a JOB_H<n> literal. Words
+   * are little-endian, as on device.
+   */
+  char build_options[256 + 24 * 40];
+  int len = hs_opencl_build_options(build_options, sizeof(build_options),
+                                    dev->variant);
+
+  len += sprintf(build_options + len, " -D JIT");
+
+  for (int i = 0; i < H_JOB_SIZE / 8; i++) {
+    if (i < 2 || (i >= 12 && i < 16))
+      continue;
+
+    const uint8_t *p = i < 12 ? &jit.key[i * 8] : &jit.key[(i - 4) * 8];
+    uint64_t word = 0;
+
+    for (int j = 7; j >= 0; j--)
+      word = (word << 8) | p[j];
+
+    len += sprintf(build_options + len, " -D JOB_H%d=0x%016llxUL",
+                   i, (unsigned long long)word);
+  }
+
+  const char *src = hs_opencl_source;
+  size_t sz = hs_opencl_source_len;
+
+  jit.clp = clCreateProgramWithSource(dev->ctx, 1, &src, &sz, &err);
+
+  if (err != CL_SUCCESS)
+    goto fail;
+
+  err = clBuildProgram(jit.clp, 1, &dev->did, build_options, NULL, NULL);
+
+  if (err != CL_SUCCESS)
+    goto fail;
+
+  jit.kernel = clCreateKernel(jit.clp, KERNEL_FUNC, &err);
+
+  if (err != CL_SUCCESS)
+    goto fail;
+
+  err = clSetKernelArg(jit.kernel, 0, sizeof(cl_mem), &dev->d_header);
+
+  if (err != CL_SUCCESS)
+    goto fail;
+
+  pthread_mutex_lock(&dev->jit_lock);
+  dev->jit_ready = jit;
+  dev->jit_busy = false;
+  pthread_mutex_unlock(&dev->jit_lock);
+
+  return NULL;
+
+fail:
+  /* The generic kernel works for every job. */
+  if (jit.kernel != NULL)
+    clReleaseKernel(jit.kernel);
+
+  if (jit.clp != NULL)
+    clReleaseProgram(jit.clp);
+
+  pthread_mutex_lock(&dev->jit_lock);
+  dev->jit_failed = true;
+  dev->jit_busy = false;
+  pthread_mutex_unlock(&dev->jit_lock);
+
+  return NULL;
+}
+
+static void
+hs_opencl_jit_release(hs_opencl_jit_t *jit) {
+  clReleaseKernel(jit->kernel);
+  clReleaseProgram(jit->clp);
+}
+
+/**
+ * Pick the kernel for a launch: the job's
+ * specialization if one has been built,
+ * otherwise the generic kernel while one is
+ * compiled in the background.
+ */
+static cl_kernel
+hs_opencl_jit_kernel(hs_opencl_ctx_t *dev, const uint8_t *h_header) {
+  uint8_t key[JIT_KEY_SIZE];
+  hs_opencl_jit_t ready;
+  bool spawn = false;
+  size_t i;
+
+  hs_opencl_jit_key(h_header, key);
+
+  pthread_mutex_lock(&dev->jit_lock);
+
+  ready = dev->jit_ready;
+  dev->jit_ready.kernel = NULL;
+
+  if (dev->jit_failed) {
+    pthread_mutex_unlock(&dev->jit_lock);
+    return dev->kernel;
+  }
+
+  pthread_mutex_unlock(&dev->jit_lock);
+
+  /* Move a finished build to the front, evicting the oldest. */
+  if (ready.kernel != NULL) {
+    if (dev->jit_len == JIT_SLOTS)
+      hs_opencl_jit_release(&dev->jit[--dev->jit_len]);
+
+    memmove(&dev->jit[1], &dev->jit[0], dev->jit_len * sizeof(hs_opencl_jit_t));
+    dev->jit[0] = ready;
+    dev->jit_len += 1;
+  }
+
+  for (i = 0; i < dev->jit_len; i++) {
+    if (memcmp(dev->jit[i].key, key, JIT_KEY_SIZE) == 0)
+      break;
+  }
+
+  if (i < dev->jit_len) {
+    hs_opencl_jit_t hit = dev->jit[i];
+    memmove(&dev->jit[1], &dev->jit[0], i * sizeof(hs_opencl_jit_t));
+    dev->jit[0] = hit;
+    return hit.kernel;
+  }
+
+  pthread_mutex_lock(&dev->jit_lock);
+
+  if (!dev->jit_busy) {
+    dev->jit_busy = true;
+    spawn = true;
+  }
+
+  pthread_mutex_unlock(&dev->jit_lock);
+
+  if (spawn) {
+    hs_opencl_jit_args_t *args =
+      (hs_opencl_jit_args_t *)malloc(sizeof(hs_opencl_jit_args_t));
+    pthread_t thread;
+    bool started = false;
+
+    if (args != NULL) {
+      args->dev = dev;
+      memcpy(args->key, key, JIT_KEY_SIZE);
+
+      if (pthread_create(&thread, NULL, hs_opencl_jit_thread, args) == 0) {
+        pthread_detach(thread);
+        started = true;
+      } else {
+        free(args);
+      }
+    }
+
+    if (!started) {
+      pthread_mutex_lock(&dev->jit_lock);
+      dev->jit_busy = false;
+      pthread_mutex_unlock(&dev->jit_lock);
+    }
+  }
+
+  return dev->kernel;
+}
+
+/**
+ * Runs on the OpenCL runtime's callback
+ * thread once a slot's results are mapped.
+ */
+static void CL_CALLBACK
+hs_opencl_mapped(cl_event event, cl_int status, void *arg) {
+  hs_opencl_ctx_t *dev = (hs_opencl_ctx_t *)arg;
+
+  (void)status;
+
+  pthread_mutex_lock(&dev->pipe_lock);
+
+  for (int i = 0; i < PIPELINE_DEPTH; i++) {
+    if (dev->slots[i].mapped == event)
+      dev->slots[i].done = true;
+  }
+
+  pthread_cond_broadcast(&dev->pipe_cond);
+  pthread_mutex_unlock(&dev->pipe_lock);
+}
+
+/**
+ * Enqueue one batch on a slot: reset the hit
+ * counter, run the kernel and map the results
+ * without blocking. A 2D batch covers `rows`
+ * extra nonces from `extra_start`.
+ */
+static void
+hs_opencl_dispatch(
+  hs_opencl_ctx_t *dev,
+  hs_opencl_slot_t *slot,
+  cl_kernel kernel,
+  cl_uint start_nonce,
+  cl_uint range,
+  cl_uint nonces,
+  cl_uint extra_start,
+  cl_uint work_dim,
+  size_t items,
+  size_t rows,
+  size_t local_size
+) {
+  static const uint32_t zero = 0;
+  size_t global[2] = { items, rows };
+  size_t local[2] = { local_size, 1 };
+  cl_int err;
+
+  err = clEnqueueWriteBuffer(slot->queue, slot->d_results, CL_FALSE, 0,
+    sizeof(uint32_t), &zero, 0, NULL, NULL);
+
+  if (err != CL_SUCCESS) {
+    printf("failed to write the buffers: %d\n", err);
+    exit(1);
+  }
+
+  /* Arguments are captured at enqueue time. */
+  err = clSetKernelArg(kernel, 1, sizeof(cl_mem), &slot->d_results);
+  err |= clSetKernelArg(kernel, 2, sizeof(cl_uint), &start_nonce);
+  err |= clSetKernelArg(kernel, 3, sizeof(cl_uint), &range);
+  err |= clSetKernelArg(kernel, 4, sizeof(cl_uint), &nonces);
+  err |= clSetKernelArg(kernel, 5, sizeof(cl_uint), &extra_start);
+
+  if (err != CL_SUCCESS) {
+    printf("failed to set kernel arguments: %d\n", err);
+    exit(1);
+  }
+
+  /* Enqueue kernel. */
+  err = clEnqueueNDRangeKernel(slot->queue, kernel, work_dim, NULL,
+    global, local, 0, NULL, dev->profile ? &slot->kernel : NULL);
+
+  if (err != CL_SUCCESS) {
+    printf("failed to enqueue the kernel: %d\n", err);
+    exit(1);
+  }
+
+  pthread_mutex_lock(&dev->pipe_lock);
+  slot->done = false;
+  pthread_mutex_unlock(&dev->pipe_lock);
+
+  slot->h_results = (uint32_t *)clEnqueueMapBuffer(slot->queue,
+    slot->d_results, CL_FALSE, CL_MAP_READ, 0, RESULTS_SIZE,
+    0, NULL, &slot->mapped, &err);
+
+  if (err != CL_SUCCESS) {
+    printf("failed to map the buffer: %d\n", err);
+    exit(1);
+  }
+
+  err = clSetEventCallback(slot->mapped, CL_COMPLETE,
+    hs_opencl_mapped, dev);
+
+  if (err != CL_SUCCESS) {
+    printf("failed to set the event callback: %d\n", err);
+    exit(1);
+  }
+
+  clFlush(slot->queue);
+}
+
+/**
+ * Device time of a finished command from
+ * its profiling counters.
+ */
+static uint64_t
+hs_opencl_event_ns(cl_event event) {
+  cl_ulong start;
+  cl_ulong end;
+
+  if (clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START,
+                              sizeof(cl_ulong), &start, NULL) != CL_SUCCESS) {
+    return 0;
+  }
+
+  if (clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END,
+                              sizeof(cl_ulong), &end, NULL) != CL_SUCCESS) {
+    return 0;
+  }
+
+  return end > start ? end - start : 0;
+}
+
+/**
+ * The extra nonce of row `extra`: the last 4
+ * bytes of the header's extra nonce plus
+ * `extra`, as a little-endian number.
+ */
+static void
+hs_opencl_extra_nonce(const uint8_t *base, uint32_t extra, uint8_t *out) {
+  uint32_t word = (uint32_t)base[20]
+                | (uint32_t)base[21] << 8
+                | (uint32_t)base[22] << 16
+                | (uint32_t)base[23] << 24;
+
+  word += extra;
+
+  memcpy(out, base, EXTRA_NONCE_SIZE - 4);
+  out[20] = word;
+  out[21] = word >> 8;
+  out[22] = word >> 16;
+  out[23] = word >> 24;
+}
+
+/**
+ * Enqueue a batch on a slot.
+ */
+static void
+hs_opencl_enqueue(
+  hs_opencl_ctx_t *dev,
+  hs_opencl_slot_t *slot,
+  const hs_options_t *options,
+  const hs_opencl_launch_t *launch,
+  const hs_opencl_batch_t *batch,
+  hs_opencl_stats_t *stats
+) {
+  /* A short batch needs fewer work-items. */
+  size_t items = (size_t)((batch->size + launch->nonces - 1) / launch->nonces);
+
+  if (launch->local_size > 0) {
+    items = (items + launch->local_size - 1)
+          / launch->local_size * launch->local_size;
+  }
+
+  if (batch->rows == 1 && items > launch->global_size)
+    items = launch->global_size;
+
+  slot->batch = *batch;
+  slot->enqueued = hs_stats_now();
+
+  hs_opencl_dispatch(dev, slot, launch->kernel,
+    (cl_uint)(options->nonce + batch->offset), (cl_uint)batch->size,
+    launch->nonces, (cl_uint)batch->row, launch->work_dim, items,
+    (size_t)batch->rows, launch->local_size);
+
+  HS_PROBE3(enqueue, options->device, (int)(slot - dev->slots),
+            batch->size * batch->rows);
+  hs_trace_span("enqueue", slot->enqueued, batch->size * batch->rows);
+
+  stats->dispatches += 1;
+}
+
+/**
+ * Wait for a slot's results to be mapped.
+ */
+static void
+hs_opencl_wait(
+  hs_opencl_ctx_t *dev,
+  hs_opencl_slot_t *slot,
+  hs_opencl_stats_t *stats
+) {
+  int64_t then = hs_opencl_now_ns();
+
+  pthread_mutex_lock(&dev->pipe_lock);
+
+  while (!slot->done)
+    pthread_cond_wait(&dev->pipe_cond, &dev->pipe_lock);
+
+  pthread_mutex_unlock(&dev->pipe_lock);
+
+  stats->wait += hs_opencl_now_ns() - then;
+
+  if (slot->kernel != NULL) {
+    stats->kernel += hs_opencl_event_ns(slot->kernel);
+    stats->readback += hs_opencl_event_ns(slot->mapped);
+    clReleaseEvent(slot->kernel);
+    slot->kernel = NULL;
+  }
+
+  clReleaseEvent(slot->mapped);
+  slot->mapped = NULL;
+}
+
+static void
+hs_opencl_unmap(hs_opencl_slot_t *slot) {
+  clEnqueueUnmapMemObject(slot->queue, slot->d_results, slot->h_results,
+    0, NULL, NULL);
+
+  slot->h_results = NULL;
+}
+
+/**
+ * The job is over: a block was found, or
+ * any hit when not streaming.
+ */
+static bool
+hs_opencl_over(const hs_options_t *options, bool match, bool block) {
+  return match && (options->share_func == NULL || block);
+}
+
+/**
+ * Pass on the hits of a slot that did not
+ * overflow and unmap it. The result is the
+ * first block found, or the first hit when
+ * not streaming. Only a block hit ends a
+ * streaming job, and under a verifier only
+ * once confirmed.
+ */
+static void
+hs_opencl_report(
+  hs_opencl_slot_t *slot,
+  hs_options_t *options,
+  uint32_t hits,
+  uint32_t *result,
+  uint8_t *extra_nonce,
+  bool *match,
+  bool *block
+) {
+  uint32_t *h_results = slot->h_results;
+
+  for (uint32_t i = 0; i < hits; i++) {
+    uint32_t nonce = h_results[1 + i * 3];
+    uint32_t extra = h_results[2 + i * 3];
+    bool is_block = h_results[3 + i * 3] != 0;
+
+    HS_PROBE3(found, options->device, nonce, is_block);
+
+    if (options->share_func != NULL) {
+      hs_share_t share;
+      share.nonce = nonce;
+      hs_opencl_extra_nonce(options->header + 128, extra, share.extra_nonce);
+      share.block = is_block;
+      share.found = hs_stats_now();
+      hs_trace_instant("share", nonce);
+      options->share_func(&share, options->share_arg);
+
+      if (!is_block || options->verified)
+        continue;
+    }
+
+    if (!*match || (is_block && !*block)) {
+      hs_trace_instant("match", nonce);
+      *match = true;
+      *result = nonce;
+      *block = is_block;
+      hs_opencl_extra_nonce(options->header + 128, extra, extra_nonce);
+    }
+  }
+
+  hs_opencl_unmap(slot);
+}
+
+/**
+ * Scan a batch whose hits overflowed the
+ * result buffer again, in halves on the same
+ * slot. None of its stored hits were passed
+ * on, so each hit is reported exactly once.
+ * An overflowing batch has more nonces than
+ * MAX_RESULTS, so the halves are never empty
+ * and the splitting ends.
+ */
+static void
+hs_opencl_rescan(
+  hs_opencl_ctx_t *dev,
+  hs_opencl_slot_t *slot,
+  hs_options_t *options,
+  const hs_opencl_launch_t *launch,
+  const hs_opencl_batch_t *batch,
+  uint32_t *result,
+  uint8_t *extra_nonce,
+  bool *match,
+  bool *block,
+  hs_opencl_stats_t *stats
+) {
+  hs_opencl_batch_t halves[2] = { *batch, *batch };
+
+  if (batch->rows > 1) {
+    halves[0].rows = batch->rows / 2;
+    halves[1].row = batch->row + halves[0].rows;
+    halves[1].rows = batch->rows - halves[0].rows;
+  } else {
+    halves[0].size = batch->size / 2;
+    halves[1].offset = batch->offset + halves[0].size;
+    halves[1].size = batch->size - halves[0].size;
+  }
+
+  for (int i = 0; i < 2; i++) {
+    if (!options->running || hs_opencl_over(options, *match, *block))
+      return;
+
+    hs_opencl_enqueue(dev, slot, options, launch, &halves[i], stats);
+    hs_opencl_wait(dev, slot, stats);
+
+    stats->rescans += 1;
+
+    uint32_t hits = slot->h_results[0];
+
+    if (hits > MAX_RESULTS) {
+      hs_opencl_unmap(slot);
+      hs_opencl_rescan(dev, slot, options, launch, &halves[i],
+                       result, extra_nonce, match, block, stats);
+      continue;
+    }
+
+    hs_opencl_report(slot, options, hits, result, extra_nonce, match, block);
+  }
+}
+
+/**
+ * Wait for a slot's results, pass its hits
+ * on and unmap it. Returns true when the job
+ * is over.
+ */
+static bool
+hs_opencl_collect(
+  hs_opencl_ctx_t *dev,
+  hs_opencl_slot_t *slot,
+  hs_options_t *options,
+  const hs_opencl_launch_t *launch,
+  uint32_t *result,
+  uint8_t *extra_nonce,
+  bool *match,
+  bool *block,
+  hs_opencl_stats_t *stats
+) {
+  hs_opencl_wait(dev, slot, stats);
+
+  uint32_t hits = slot->h_results[0];
+
+  HS_PROBE3(readback, options->device, (int)(slot - dev->slots), hits);
+
+  /**
+   * The kernel keeps counting hits past the
+   * buffer's capacity, so this is every hit
+   * in the batch.
+   */
+  slot->hits = hits;
+
+  if (hits > MAX_RESULTS) {
+    /* Keep the launch's own span for the trace. */
+    uint64_t enqueued = slot->enqueued;
+    hs_opencl_batch_t batch = slot->batch;
+
+    hs_trace_instant("overflow", hits);
+    stats->overflows += 1;
+
+    hs_opencl_unmap(slot);
+    hs_opencl_rescan(dev, slot, options, launch, &batch,
+                     result, extra_nonce, match, block, stats);
+
+    slot->enqueued = enqueued;
+  } else {
+    hs_opencl_report(slot, options, hits, result, extra_nonce, match, block);
+  }
+
+  return hs_opencl_over(options, *match, *block);
+}
+
+/**
+ * Hands out disjoint batches of a job's
+ * range, one row per extra nonce. A batch is
+ * either whole rows or part of a single row,
+ * and a row part is capped so that work-item
+ * offsets cannot overflow in the kernel.
+ * Every device on the job pulls from the same
+ * cursor, so faster devices simply take more
+ * of the range.
+ */
+typedef struct hs_opencl_cursor_s {
+  pthread_mutex_t lock;
+  uint64_t offset;
+  uint64_t range;
+  uint64_t rows;
+} hs_opencl_cursor_t;
+
+static uint64_t
+hs_opencl_cursor_next(
+  hs_opencl_cursor_t *cursor,
+  uint64_t batch,
+  uint64_t *offset,
+  uint64_t *row,
+  uint64_t *rows
+) {
+  uint64_t size = 0;
+
+  pthread_mutex_lock(&cursor->lock);
+
+  *offset = 0;
+  *row = 0;
+  *rows = 0;
+
+  if (cursor->range > 0 && cursor->offset < cursor->range * cursor->rows) {
+    *row = cursor->offset / cursor->range;
+    *offset = cursor->offset % cursor->range;
+
+    if (*offset == 0 && cursor->range <= batch
+        && cursor->range <= MAX_BATCH) {
+      *rows = batch / cursor->range;
+
+      if (*rows > cursor->rows - *row)
+        *rows = cursor->rows - *row;
+
+      size = cursor->range;
+      cursor->offset += *rows * size;
+    } else {
+      size = cursor->range - *offset;
+
+      if (size > batch)
+        size = batch;
+
+      if (size > MAX_BATCH)
+        size = MAX_BATCH;
+
+      *rows = 1;
+      cursor->offset += size;
+    }
+  }
+
+  pthread_mutex_unlock(&cursor->lock);
+
+  return size;
+}
+
+/**
+ * Mine one device's share of a job.
+ */
+static int32_t
+hs_opencl_mine(
+  hs_opencl_ctx_t *dev,
+  hs_options_t *options,
+  hs_opencl_cursor_t *cursor,
+  uint32_t *result,
+  uint8_t *extra_nonce,
+  bool *match,
+  bool *block,
+  hs_opencl_stats_t *stats,
+  hs_counter_t *counter
+) {
+  int64_t then = hs_opencl_now_ns();
+  uint64_t busy = hs_stats_now();
+  uint64_t born = busy;
+  bool stopped = false;
+  cl_int err;
+
+  /**
+   * h_header serialization:
+   *
+   * nonce:         4 bytes
+   * timestamp:     8 bytes
+   * padding:      20 bytes
+   * prev_block:   32 bytes
+   * tree_root:    32 bytes
+   * commit hash:  32 bytes
+   * padding:      32 bytes
+   * target:       32 bytes
+   * block target: 32 bytes
+   * sub-header:  128 bytes
+   * mask hash:    32 bytes
+   *
+   * The sub-header and mask hash are only
+   * read by 2D launches, which hash the commit
+   * for each extra nonce on the device.
+   */
+  uint8_t *h_header = dev->h_header;
+  memcpy(h_header, options->header, 96);
+  commit_hash(options->header + 128, options->header + 96, h_header + 96);
+  padding(options->header + 32, options->header + 64, h_header + 128, 32);
+  memcpy(h_header + 160, options->target, 32);
+  memcpy(h_header + 192, options->block_target, 32);
+  memcpy(h_header + 224, options->header + 128, 128);
+  memcpy(h_header + 352, options->header + 96, 32);
+
+  /**
+   * Both queues read the header, so wait for
+   * it once. The next job is not known until
+   * it is submitted, so it cannot be staged
+   * while this one runs; the pipeline drains
+   * at the end of every job.
+   */
+  err = clEnqueueWriteBuffer(dev->slots[0].queue, dev->d_header, CL_TRUE, 0,
+    H_HEADER_SIZE, h_header, 0, NULL, NULL);
+
+  if (err != CL_SUCCESS) {
+    printf("failed to write the buffers: %d\n", err);
+    exit(1);
+  }
+
+  stats->upload += hs_opencl_now_ns() - then;
+
+  size_t global_size = options->threads;
+  size_t local_size = options->blocks;
+  uint32_t nonces = options->nonces;
+
+  if (nonces == 0)
+    nonces = HS_OPENCL_NONCE_STRIDE;
+
+  uint32_t lanes = hs_opencl_lanes[dev->variant];
+
+  nonces = (nonces + lanes - 1) / lanes * lanes;
+
+  if (nonces > MAX_NONCES)
+    nonces = MAX_NONCES;
+
+  /**
+   * Unset sizes come from the autotuner. Its
+   * launch length holds for one nonce per
+   * work-item.
+   */
+  if (local_size == 0)
+    local_size = dev->local_size;
+
+  if (global_size == 0) {
+    global_size = dev->global_size / nonces;
+    global_size = (global_size + local_size - 1) / local_size * local_size;
+  }
+
+  hs_opencl_launch_t launch;
+  launch.kernel = dev->kernel;
+  launch.nonces = nonces;
+  launch.work_dim = options->extra_nonces > 1 ? 2 : 1;
+  launch.global_size = global_size;
+  launch.local_size = local_size;
+
+  /**
+   * Split the range into batches of one
+   * launch each and keep PIPELINE_DEPTH of
+   * them in flight: while the host collects
+   * one batch the device runs the next. With
+   * extra nonces, launches are 2D and cover
+   * as many whole rows as fit.
+   */
+  uint64_t max_size = (uint64_t)global_size * nonces;
+  int head = 0;
+  int inflight = 0;
+  bool done = false;
+
+  *match = false;
+  *block = false;
+
+  for (;;) {
+    while (inflight < PIPELINE_DEPTH && !done && options->running) {
+      hs_opencl_slot_t *slot = &dev->slots[(head + inflight) % PIPELINE_DEPTH];
+      hs_opencl_batch_t batch;
+
+      batch.size = hs_opencl_cursor_next(cursor, max_size, &batch.offset,
+                                         &batch.row, &batch.rows);
+
+      if (batch.size == 0)
+        break;
+
+      /* A specialization built mid-job takes over here. */
+      if (options->jit)
+        launch.kernel = hs_opencl_jit_kernel(dev, h_header);
+
+      if (launch.kernel != dev->kernel)
+        stats->jit += 1;
+
+      hs_opencl_enqueue(dev, slot, options, &launch, &batch, stats);
+
+      hs_latency_first(options, HS_BACKEND_OPENCL);
+
+      slot->hashes = batch.size * batch.rows;
+      stats->hashes += slot->hashes;
+      inflight += 1;
+    }
+
+    if (!options->running && !stopped) {
+      hs_trace_instant("stop", 0);
+      stopped = true;
+    }
+
+    if (inflight == 0)
+      break;
+
+    hs_opencl_slot_t *slot = &dev->slots[head];
+
+    if (hs_opencl_collect(dev, slot, options, &launch, result,
+                          extra_nonce, match, block, stats)) {
+      done = true;
+    }
+
+    /* Enqueue to results read back. */
+    hs_trace_span("launch", slot->enqueued, slot->hashes);
+
+    hs_stats_flush(counter, options, &slot->hashes, &slot->hits, &busy);
+
+    head = (head + 1) % PIPELINE_DEPTH;
+    inflight -= 1;
+  }
+
+  hs_trace_span("mine", born, 0);
+
+  if (*match)
+    return HS_SUCCESS;
+
+  return HS_ENOSOLUTION;
+}
+
+typedef struct hs_opencl_thread_args_s {
+  hs_opencl_ctx_t *dev;
+  hs_options_t *options;
+  hs_opencl_cursor_t *cursor;
+  uint8_t extra_nonce[EXTRA_NONCE_SIZE];
+  uint32_t result;
+  bool match;
+  bool block;
+  hs_opencl_stats_t stats;
+  hs_counter_t *counter;
+  pthread_t thread;
+} hs_opencl_thread_args_t;
+
+static void *
+hs_opencl_thread(void *ptr) {
+  hs_opencl_thread_args_t *args = (hs_opencl_thread_args_t *)ptr;
+
+  hs_trace_thread("opencl");
+
+  hs_opencl_mine(args->dev, args->options, args->cursor, &args->result,
+                 args->extra_nonce, &args->match, &args->block, &args->stats,
+                 args->counter);
+
+  /**
+   * A result that ends the job on one
+   * device ends it on all of them.
+   */
+  if (args->match
+      && (args->options->share_func == NULL || args->block)) {
+    args->options->running = false;
+  }
+
+  return NULL;
+}
+
+int32_t
+hs_opencl_run(
+  hs_options_t *options,
+  uint32_t *result,
+  uint8_t *extra_nonce,
+  bool *match
+) {
+  hs_opencl_thread_args_t args[HS_MAX_DEVICES];
+  hs_opencl_cursor_t cursor;
+  uint32_t len = 1;
+  const uint32_t *devices = &options->device;
+  uint32_t acquired = 0;
+  uint32_t started = 0;
+  int32_t rc = HS_SUCCESS;
+  int64_t start = hs_opencl_now_ns();
+  int64_t mined = 0;
+
+  if (options->devices_len > 0) {
+    len = options->devices_len;
+    devices = options->devices;
+  }
+
+  if (len > HS_MAX_DEVICES || options->nonces > MAX_NONCES)
+    return HS_EBADARGS;
+
+  *match = false;
+  options->block = false;
+
+  /**
+   * Setup is claiming the device, which
+   * includes creating its context, building
+   * and tuning on first use.
+   */
+  for (; acquired < len; acquired++) {
+    int64_t then = hs_opencl_now_ns();
+
+    memset(&args[acquired].stats, 0, sizeof(hs_opencl_stats_t));
+
+    rc = hs_opencl_ctx_acquire(devices[acquired], &args[acquired].dev);
+
+    hs_trace_span("setup", (uint64_t)then, devices[acquired]);
+
+    args[acquired].stats.calls = 1;
+    args[acquired].stats.setup = hs_opencl_now_ns() - then;
+
+    if (rc != HS_SUCCESS)
+      goto done;
+
+    /* A device has a single mining thread. */
+    args[acquired].counter = hs_stats_counter(HS_BACKEND_OPENCL,
+                                              devices[acquired], 0);
+    hs_stats_job(HS_BACKEND_OPENCL, devices[acquired], options);
+  }
+
+  pthread_mutex_init(&cursor.lock, NULL);
+  cursor.offset = 0;
+  cursor.range = options->range;
+  cursor.rows = options->extra_nonces > 1 ? options->extra_nonces : 1;
+
+  for (uint32_t i = 0; i < len; i++) {
+    args[i].options = options;
+    args[i].cursor = &cursor;
+    memcpy(args[i].extra_nonce, extra_nonce, EXTRA_NONCE_SIZE);
+    args[i].result = 0;
+    args[i].match = false;
+    args[i].block = false;
+  }
+
+  /* A single device mines on the calling thread. */
+  if (len == 1) {
+    hs_opencl_mine(args[0].dev, options, &cursor, &args[0].result,
+                   args[0].extra_nonce, &args[0].match, &args[0].block,
+                   &args[0].stats, args[0].counter);
+    started = 1;
+  } else {
+    for (; started < len; started++) {
+      if (pthread_create(&args[started].thread, NULL,
+                         hs_opencl_thread, &args[started]) != 0) {
+        options->running = false;
+        rc = HS_EFAILURE;
+        break;
+      }
+    }
+
+    for (uint32_t i = 0; i < started; i++)
+      pthread_join(args[i].thread, NULL);
+  }
+
+  mined = hs_opencl_now_ns();
+
+  pthread_mutex_destroy(&cursor.lock);
+
+  /* Prefer a block over a share. */
+  for (uint32_t i = 0; i < started; i++) {
+    if (!args[i].match)
+      continue;
+
+    if (!*match || (args[i].block && !options->block)) {
+      *match = true;
+      *result = args[i].result;
+      memcpy(extra_nonce, args[i].extra_nonce, EXTRA_NONCE_SIZE);
+      options->block = args[i].block;
+    }
+  }
+
+done:
+  /**
+   * Teardown is merging the results and
+   * handing the devices back. The job's wall
+   * time is charged to each of its devices.
+   */
+  for (uint32_t i = 0; i < acquired; i++) {
+    int64_t now = hs_opencl_now_ns();
+
+    if (mined != 0)
+      args[i].stats.teardown = now - mined;
+
+    args[i].stats.wall = now - start;
+
+    hs_opencl_ctx_release(args[i].dev, &args[i].stats);
+  }
+
+  if (rc != HS_SUCCESS)
+    return rc;
+
+  if (*match)
+    return HS_SUCCESS;
+
+  return HS_ENOSOLUTION;
+}
+
+/**
+ * Totals for a device. A device that has
+ * not run a job yet has none.
+ */
+bool
+hs_opencl_stats(uint32_t device, hs_opencl_stats_t *stats) {
+  bool ret = false;
+
+  memset(stats, 0, sizeof(hs_opencl_stats_t));
+
+  pthread_mutex_lock(&hs_opencl_lock);
+
+  if (device < hs_opencl_ctxs_len && hs_opencl_ctxs[device] != NULL) {
+    hs_opencl_ctx_t *dev = hs_opencl_ctxs[device];
+
+    *stats = dev->stats;
+    stats->variant = hs_opencl_variants[dev->variant];
+    stats->local_size = dev->local_size;
+    stats->global_size = dev->global_size;
+    ret = true;
+  }
+
+  pthread_mutex_unlock(&hs_opencl_lock);
+
+  return ret;
+}
+
+uint32_t
+hs_opencl_device_count() {
+  uint32_t count;
+
+  pthread_mutex_lock(&hs_opencl_lock);
+  hs_opencl_registry_init();
+  count = hs_opencl_registry_len;
+  pthread_mutex_unlock(&hs_opencl_lock);
+
+  return count;
+}
+
+/**
+ * The device's PCI address, or an empty
+ * string when no vendor query knows it.
+ */
+static void
+hs_opencl_pci_bus_id(cl_device_id did, char *out, size_t len) {
+  cl_uint domain = 0;
+  cl_uint bus = 0;
+  cl_uint dev = 0;
+  cl_uint func = 0;
+
+  struct {
+    cl_uint domain;
+    cl_uint bus;
+    cl_uint device;
+    cl_uint function;
+  } khr;
+
+  /**
+   * cl_device_topology_amd: a type word
+   * (1 for PCIe), then bus, device and
+   * function bytes at offsets 21 to 23.
+   */
+  unsigned char amd[24];
+  cl_uint amd_type = 0;
+  cl_uint nv_bus, nv_slot;
+
+  out[0] = '\0';
+
+  if (clGetDeviceInfo(did, CL_DEVICE_PCI_BUS_INFO_KHR,
+                      sizeof(khr), &khr, NULL) == CL_SUCCESS) {
+    domain = khr.domain;
+    bus = khr.bus;
+    dev = khr.device;
+    func = khr.function;
+    goto done;
+  }
+
+  if (clGetDeviceInfo(did, CL_DEVICE_TOPOLOGY_AMD,
+                      sizeof(amd), amd, NULL) == CL_SUCCESS) {
+    memcpy(&amd_type, amd, sizeof(cl_uint));
+
+    if (amd_type == 1) {
+      bus = amd[21];
+      dev = amd[22];
+      func = amd[23];
+      goto done;
+    }
+  }
+
+  if (clGetDeviceInfo(did, CL_DEVICE_PCI_BUS_ID_NV,
+                      sizeof(cl_uint), &nv_bus, NULL) == CL_SUCCESS
+      && clGetDeviceInfo(did, CL_DEVICE_PCI_SLOT_ID_NV,
+                         sizeof(cl_uint), &nv_slot, NULL) == CL_SUCCESS) {
+    if (clGetDeviceInfo(did, CL_DEVICE_PCI_DOMAIN_ID_NV,
+                        sizeof(cl_uint), &domain, NULL) != CL_SUCCESS) {
+      domain = 0;
+    }
+
+    bus = nv_bus;
+    dev = nv_slot >> 3;
+    func = nv_slot & 7;
+    goto done;
+  }
+
+  return;
+
+done:
+  snprintf(out, len, "%04x:%02x:%02x.%x",
+           domain, bus & 0xff, dev & 0x1f, func & 7);
+}
+
+bool
+hs_opencl_device_info(uint32_t device, hs_device_info_t *info) {
+  hs_opencl_entry_t entry;
+  cl_ulong memory;
+  cl_uint clock_rate;
+  cl_int err;
+
+  if (!hs_opencl_registry_get(device, &entry))
+    return false;
+
+  err = clGetDeviceInfo(entry.did, CL_DEVICE_NAME,
+    sizeof(info->name), info->name, NULL);
+
+  if (err != CL_SUCCESS) {
+    printf("failed to access device name: %d\n", err);
+    return false;
+  }
+
+  err = clGetDeviceInfo(entry.did, CL_DEVICE_GLOBAL_MEM_SIZE,
+    sizeof(cl_ulong), &memory, NULL);
+
+  if (err != CL_SUCCESS) {
+    printf("failed to access device global mem size: %d\n", err);
+    return false;
+  }
+
+  info->memory = memory;
+
+  /**
+   * TODO(tynes): figure out how to query for memory bus size and
+   * set at info->bits. I can't seem to find a good api for it,
+   * just set to 0 for now.
+   */
+  info->bits = 0;
+
+  err = clGetDeviceInfo(entry.did, CL_DEVICE_MAX_CLOCK_FREQUENCY,
+    sizeof(cl_uint), &clock_rate, NULL);
+
+  if (err != CL_SUCCESS) {
+    printf("failed to access device max clock freq: %d\n", err);
+    return false;
+  }
+
+  info->clock_rate = clock_rate;
+
+  hs_opencl_pci_bus_id(entry.did, info->pci_bus_id,
+                       sizeof(info->pci_bus_id));
+
+  return true;
 }
 
 #endif /* HS_HAS_OPENCL */
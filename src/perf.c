@@ -0,0 +1,198 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "common.h"
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+// Hardware counters per mining thread, opened as one group
+// so every counter covers the same instructions. Totals are
+// kept per backend. Off unless hs_perf_enable() was called.
+typedef struct hs_perf_total_s {
+  uint64_t threads;
+  uint64_t failed;
+  uint64_t hashes;
+  uint64_t counters[HS_PERF_COUNTERS];
+} hs_perf_total_t;
+
+static int hs_perf_on = 0;
+static int hs_perf_errno = 0;
+static hs_perf_total_t hs_perf_totals[HS_BACKENDS];
+
+void
+hs_perf_enable(bool enabled) {
+  __atomic_store_n(&hs_perf_on, enabled ? 1 : 0, __ATOMIC_RELAXED);
+}
+
+bool
+hs_perf_enabled(void) {
+  return __atomic_load_n(&hs_perf_on, __ATOMIC_RELAXED) != 0;
+}
+
+#ifdef __linux__
+static int
+hs_perf_open(uint32_t type, uint64_t config, int group) {
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.read_format = PERF_FORMAT_GROUP
+                   | PERF_FORMAT_TOTAL_TIME_ENABLED
+                   | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  attr.disabled = group == -1;
+  // Allowed at the default perf_event_paranoid of 2.
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+#endif
+
+// Start counting on the calling thread. Failures are
+// counted and leave the thread unprofiled.
+void
+hs_perf_begin(hs_perf_t *perf, uint32_t backend) {
+  for (int i = 0; i < HS_PERF_COUNTERS; i++)
+    perf->fds[i] = -1;
+
+  perf->backend = backend;
+
+  if (!hs_perf_enabled() || backend >= HS_BACKENDS)
+    return;
+
+#ifdef __linux__
+  static const struct {
+    uint32_t type;
+    uint64_t config;
+  } events[HS_PERF_COUNTERS] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+                        | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                        | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) }
+  };
+
+  perf->fds[0] = hs_perf_open(events[0].type, events[0].config, -1);
+
+  if (perf->fds[0] < 0) {
+    __atomic_store_n(&hs_perf_errno, errno, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hs_perf_totals[backend].failed, 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  // Not every PMU has every event (VMs rarely expose L1
+  // misses). Those counters just stay zero.
+  for (int i = 1; i < HS_PERF_COUNTERS; i++)
+    perf->fds[i] = hs_perf_open(events[i].type, events[i].config, perf->fds[0]);
+
+  ioctl(perf->fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(perf->fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#else
+  __atomic_store_n(&hs_perf_errno, ENOSYS, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&hs_perf_totals[backend].failed, 1, __ATOMIC_RELAXED);
+#endif
+}
+
+// Stop counting and add the counters and the thread's
+// hashes to its backend.
+void
+hs_perf_end(hs_perf_t *perf, uint64_t hashes) {
+  if (perf->fds[0] < 0)
+    return;
+
+#ifdef __linux__
+  // nr, time_enabled, time_running, values[nr].
+  uint64_t data[3 + HS_PERF_COUNTERS];
+  uint64_t values[HS_PERF_COUNTERS] = { 0 };
+  hs_perf_total_t *total = &hs_perf_totals[perf->backend];
+  uint64_t nr;
+  uint64_t j = 0;
+
+  ioctl(perf->fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+  ssize_t len = read(perf->fds[0], data, sizeof(data));
+
+  if (len < (ssize_t)(3 * sizeof(uint64_t)) || data[2] == 0) {
+    __atomic_fetch_add(&total->failed, 1, __ATOMIC_RELAXED);
+    goto done;
+  }
+
+  // Values come in the order the group was opened,
+  // skipping the counters that failed to open.
+  nr = data[0];
+
+  for (int i = 0; i < HS_PERF_COUNTERS && j < nr; i++) {
+    if (perf->fds[i] < 0)
+      continue;
+
+    // Scale up if the PMU was shared with other groups.
+    values[i] = (uint64_t)((double)data[3 + j] * data[1] / data[2]);
+    j += 1;
+  }
+
+  for (int i = 0; i < HS_PERF_COUNTERS; i++)
+    __atomic_fetch_add(&total->counters[i], values[i], __ATOMIC_RELAXED);
+
+  __atomic_fetch_add(&total->hashes, hashes, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&total->threads, 1, __ATOMIC_RELAXED);
+
+done:
+  for (int i = HS_PERF_COUNTERS - 1; i >= 0; i--) {
+    if (perf->fds[i] >= 0)
+      close(perf->fds[i]);
+    perf->fds[i] = -1;
+  }
+#else
+  (void)hashes;
+#endif
+}
+
+bool
+hs_perf_get(uint32_t backend, hs_perf_stats_t *stats) {
+  if (backend >= HS_BACKENDS)
+    return false;
+
+  hs_perf_total_t *total = &hs_perf_totals[backend];
+
+  stats->threads = __atomic_load_n(&total->threads, __ATOMIC_RELAXED);
+  stats->failed = __atomic_load_n(&total->failed, __ATOMIC_RELAXED);
+  stats->hashes = __atomic_load_n(&total->hashes, __ATOMIC_RELAXED);
+
+  for (int i = 0; i < HS_PERF_COUNTERS; i++)
+    stats->counters[i] = __atomic_load_n(&total->counters[i], __ATOMIC_RELAXED);
+
+  stats->error = __atomic_load_n(&hs_perf_errno, __ATOMIC_RELAXED);
+
+  return true;
+}
+
+void
+hs_perf_reset(void) {
+  for (int i = 0; i < HS_BACKENDS; i++) {
+    hs_perf_total_t *total = &hs_perf_totals[i];
+
+    __atomic_store_n(&total->threads, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&total->failed, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&total->hashes, 0, __ATOMIC_RELAXED);
+
+    for (int j = 0; j < HS_PERF_COUNTERS; j++)
+      __atomic_store_n(&total->counters[j], 0, __ATOMIC_RELAXED);
+  }
+
+  __atomic_store_n(&hs_perf_errno, 0, __ATOMIC_RELAXED);
+}
@@ -2,543 +2,663 @@ typedef unsigned char BYTE;
 typedef unsigned int  WORD;
 typedef unsigned long LONG;
 
-inline int
-opencl_memcmp(const void *a, const void *b, size_t n) {
-  const BYTE *ua = (const BYTE *) a;
-  const BYTE *ub = (const BYTE *) b;
+/**
+ * Result buffer capacity. The host passes
+ * the real value as a build option.
+ */
+#ifndef MAX_RESULTS
+#define MAX_RESULTS 64
+#endif
 
-  while (n--) {
-    if (*ua != *ub) {
-      return (*ua < *ub) ? -1 : 1;
-    }
-    ua++;
-    ub++;
-  }
-  return 0;
+/**
+ * Compare all 256 bits of the hash against
+ * the targets rather than the first 64.
+ */
+#ifndef FULL_COMPARE
+#define FULL_COMPARE 1
+#endif
+
+/**
+ * Code shape, picked per device by the
+ * host's autotuner:
+ *
+ *   LANES:         nonces hashed per step, 1
+ *                  with ulong or 2 with ulong2.
+ *   KECCAK_UNROLL: Keccak rounds per loop step,
+ *                  24 for a fully unrolled
+ *                  permutation.
+ *   SIGMA:         0 unrolls BLAKE2b with the
+ *                  sigma permutation applied at
+ *                  compile time, 1 loops over the
+ *                  rounds reading sigma from
+ *                  constant memory, 2 from a copy
+ *                  in local memory.
+ */
+#ifndef LANES
+#define LANES 1
+#endif
+
+#ifndef KECCAK_UNROLL
+#define KECCAK_UNROLL 24
+#endif
+
+#ifndef SIGMA
+#define SIGMA 0
+#endif
+
+#if LANES == 2
+typedef ulong2 VLONG;
+#define LANE0(x) (x).s0
+#else
+typedef LONG VLONG;
+#define LANE0(x) (x)
+#endif
+
+/**
+ * In JIT mode the host bakes the job's header
+ * words into the program as JOB_H<n> literals.
+ * The nonce and timestamp (words 0-1) change
+ * between jobs sharing a program and the commit
+ * hash (words 12-15) with the extra nonce, so
+ * they are always loaded, as are the sub-header
+ * and mask hash (words 28-47).
+ */
+#ifdef JIT
+#define JOB_H0 c_header[0]
+#define JOB_H1 c_header[1]
+#define HDR(i) JOB_H##i
+#else
+#define HDR(i) c_header[i]
+#endif
+
+#define ROTL64(a, n) (((a) << (n)) | ((a) >> (64 - (n))))
+#define ROTR64(a, n) (((a) >> (n)) | ((a) << (64 - (n))))
+
+/**
+ * Byte swap a little-endian word so that
+ * hashes and targets, which are big-endian
+ * byte strings, compare as integers.
+ */
+inline LONG
+opencl_bswap64(LONG x) {
+  x = ((x & 0x00ff00ff00ff00ffUL) << 8) | ((x >> 8) & 0x00ff00ff00ff00ffUL);
+  x = ((x & 0x0000ffff0000ffffUL) << 16) | ((x >> 16) & 0x0000ffff0000ffffUL);
+  return (x << 32) | (x >> 32);
 }
 
+/**
+ * Compare the first `n` words of two
+ * hashes as big-endian byte strings.
+ * `n` is a compile-time constant, so
+ * the loop is unrolled.
+ */
 inline int
-opencl_memcpy(void *a, const void *b, size_t n) {
-  BYTE *ua = (BYTE *) a;
-  const BYTE *ub = (BYTE *) b;
-
-  while (n--)
-    *(ua++) = *(ub++);
+opencl_hashcmp(const LONG *a, const LONG *b, const int n) {
+#pragma unroll
+  for (int i = 0; i < n; i++) {
+    LONG x = opencl_bswap64(a[i]);
+    LONG y = opencl_bswap64(b[i]);
+
+    if (x != y)
+      return x < y ? -1 : 1;
+  }
 
   return 0;
 }
 
-inline int
-opencl_memset(void *a, int c, size_t n) {
-  BYTE *dst = (BYTE *) a;
-  while(n--)
-    *(dst++) = (BYTE) c;
-
-  return 0;
+/**
+ * Keccak-f[1600] on a state that lives in
+ * registers: every lane index is a constant
+ * and KECCAK_UNROLL rounds are unrolled per
+ * loop step.
+ */
+#define KECCAK_ROUND(rc) {                                         \
+  VLONG c0 = s[ 0] ^ s[ 5] ^ s[10] ^ s[15] ^ s[20];                \
+  VLONG c1 = s[ 1] ^ s[ 6] ^ s[11] ^ s[16] ^ s[21];                \
+  VLONG c2 = s[ 2] ^ s[ 7] ^ s[12] ^ s[17] ^ s[22];                \
+  VLONG c3 = s[ 3] ^ s[ 8] ^ s[13] ^ s[18] ^ s[23];                \
+  VLONG c4 = s[ 4] ^ s[ 9] ^ s[14] ^ s[19] ^ s[24];                \
+  VLONG d0 = c4 ^ ROTL64(c1, 1);                                   \
+  VLONG d1 = c0 ^ ROTL64(c2, 1);                                   \
+  VLONG d2 = c1 ^ ROTL64(c3, 1);                                   \
+  VLONG d3 = c2 ^ ROTL64(c4, 1);                                   \
+  VLONG d4 = c3 ^ ROTL64(c0, 1);                                   \
+  s[ 0] ^= d0; s[ 1] ^= d1; s[ 2] ^= d2; s[ 3] ^= d3; s[ 4] ^= d4; \
+  s[ 5] ^= d0; s[ 6] ^= d1; s[ 7] ^= d2; s[ 8] ^= d3; s[ 9] ^= d4; \
+  s[10] ^= d0; s[11] ^= d1; s[12] ^= d2; s[13] ^= d3; s[14] ^= d4; \
+  s[15] ^= d0; s[16] ^= d1; s[17] ^= d2; s[18] ^= d3; s[19] ^= d4; \
+  s[20] ^= d0; s[21] ^= d1; s[22] ^= d2; s[23] ^= d3; s[24] ^= d4; \
+  VLONG b0  = s[ 0];                                               \
+  VLONG b10 = ROTL64(s[ 1],  1);                                   \
+  VLONG b20 = ROTL64(s[ 2], 62);                                   \
+  VLONG b5  = ROTL64(s[ 3], 28);                                   \
+  VLONG b15 = ROTL64(s[ 4], 27);                                   \
+  VLONG b16 = ROTL64(s[ 5], 36);                                   \
+  VLONG b1  = ROTL64(s[ 6], 44);                                   \
+  VLONG b11 = ROTL64(s[ 7],  6);                                   \
+  VLONG b21 = ROTL64(s[ 8], 55);                                   \
+  VLONG b6  = ROTL64(s[ 9], 20);                                   \
+  VLONG b7  = ROTL64(s[10],  3);                                   \
+  VLONG b17 = ROTL64(s[11], 10);                                   \
+  VLONG b2  = ROTL64(s[12], 43);                                   \
+  VLONG b12 = ROTL64(s[13], 25);                                   \
+  VLONG b22 = ROTL64(s[14], 39);                                   \
+  VLONG b23 = ROTL64(s[15], 41);                                   \
+  VLONG b8  = ROTL64(s[16], 45);                                   \
+  VLONG b18 = ROTL64(s[17], 15);                                   \
+  VLONG b3  = ROTL64(s[18], 21);                                   \
+  VLONG b13 = ROTL64(s[19],  8);                                   \
+  VLONG b14 = ROTL64(s[20], 18);                                   \
+  VLONG b24 = ROTL64(s[21],  2);                                   \
+  VLONG b9  = ROTL64(s[22], 61);                                   \
+  VLONG b19 = ROTL64(s[23], 56);                                   \
+  VLONG b4  = ROTL64(s[24], 14);                                   \
+  s[ 0] = b0  ^ (~b1  & b2 );                                      \
+  s[ 1] = b1  ^ (~b2  & b3 );                                      \
+  s[ 2] = b2  ^ (~b3  & b4 );                                      \
+  s[ 3] = b3  ^ (~b4  & b0 );                                      \
+  s[ 4] = b4  ^ (~b0  & b1 );                                      \
+  s[ 5] = b5  ^ (~b6  & b7 );                                      \
+  s[ 6] = b6  ^ (~b7  & b8 );                                      \
+  s[ 7] = b7  ^ (~b8  & b9 );                                      \
+  s[ 8] = b8  ^ (~b9  & b5 );                                      \
+  s[ 9] = b9  ^ (~b5  & b6 );                                      \
+  s[10] = b10 ^ (~b11 & b12);                                      \
+  s[11] = b11 ^ (~b12 & b13);                                      \
+  s[12] = b12 ^ (~b13 & b14);                                      \
+  s[13] = b13 ^ (~b14 & b10);                                      \
+  s[14] = b14 ^ (~b10 & b11);                                      \
+  s[15] = b15 ^ (~b16 & b17);                                      \
+  s[16] = b16 ^ (~b17 & b18);                                      \
+  s[17] = b17 ^ (~b18 & b19);                                      \
+  s[18] = b18 ^ (~b19 & b15);                                      \
+  s[19] = b19 ^ (~b15 & b16);                                      \
+  s[20] = b20 ^ (~b21 & b22);                                      \
+  s[21] = b21 ^ (~b22 & b23);                                      \
+  s[22] = b22 ^ (~b23 & b24);                                      \
+  s[23] = b23 ^ (~b24 & b20);                                      \
+  s[24] = b24 ^ (~b20 & b21);                                      \
+  s[ 0] ^= rc;                                                     \
 }
 
-#define KECCAK_ROUND 24
-#define KECCAK_STATE_SIZE 25
-#define KECCAK_Q_SIZE 192
-
-constant LONG CUDA_KECCAK_CONSTS[24] = {
-  0x0000000000000001, 0x0000000000008082, 0x800000000000808a,
-  0x8000000080008000, 0x000000000000808b, 0x0000000080000001,
-  0x8000000080008081, 0x8000000000008009, 0x000000000000008a,
-  0x0000000000000088, 0x0000000080008009, 0x000000008000000a,
-  0x000000008000808b, 0x800000000000008b, 0x8000000000008089,
-  0x8000000000008003, 0x8000000000008002, 0x8000000000000080,
-  0x000000000000800a, 0x800000008000000a, 0x8000000080008081,
-  0x8000000000008080, 0x0000000080000001, 0x8000000080008008
+__constant LONG keccak_rc[24] = {
+  0x0000000000000001UL, 0x0000000000008082UL,
+  0x800000000000808aUL, 0x8000000080008000UL,
+  0x000000000000808bUL, 0x0000000080000001UL,
+  0x8000000080008081UL, 0x8000000000008009UL,
+  0x000000000000008aUL, 0x0000000000000088UL,
+  0x0000000080008009UL, 0x000000008000000aUL,
+  0x000000008000808bUL, 0x800000000000008bUL,
+  0x8000000000008089UL, 0x8000000000008003UL,
+  0x8000000000008002UL, 0x8000000000000080UL,
+  0x000000000000800aUL, 0x800000008000000aUL,
+  0x8000000080008081UL, 0x8000000000008080UL,
+  0x0000000080000001UL, 0x8000000080008008UL
 };
 
-typedef struct {
-  BYTE sha3_flag;
-  WORD digestbitlen;
-  LONG rate_bits;
-  LONG rate_bytes;
-  LONG absorb_round;
-
-  long state[KECCAK_STATE_SIZE];
-  BYTE q[KECCAK_Q_SIZE];
-
-  LONG bits_in_queue;
-} opencl_keccak_ctx_t;
-
-typedef opencl_keccak_ctx_t OPENCL_KECCAK_CTX;
-
-inline LONG
-opencl_keccak_leuint64(void *in) {
-  LONG a;
-  opencl_memcpy(&a, in, 8);
-  return a;
-}
-
-inline long
-opencl_keccak_MIN(long a, long b) {
-  if (a > b) return b;
-  return a;
-}
-
-inline LONG
-opencl_keccak_UMIN(ulong a, ulong b) {
-  if (a > b) return b;
-  return a;
-}
-
 inline void
-opencl_keccak_extract(OPENCL_KECCAK_CTX *ctx) {
-  LONG len = ctx->rate_bits >> 6;
-  long a;
-  int s = sizeof(LONG);
-
-  for (int i = 0;i < len;i++) {
-    a = opencl_keccak_leuint64((long *)&ctx->state[i]);
-    opencl_memcpy(ctx->q + (i * s), &a, s);
+opencl_keccakf(VLONG *s) {
+#if KECCAK_UNROLL == 24
+  KECCAK_ROUND(0x0000000000000001UL);
+  KECCAK_ROUND(0x0000000000008082UL);
+  KECCAK_ROUND(0x800000000000808aUL);
+  KECCAK_ROUND(0x8000000080008000UL);
+  KECCAK_ROUND(0x000000000000808bUL);
+  KECCAK_ROUND(0x0000000080000001UL);
+  KECCAK_ROUND(0x8000000080008081UL);
+  KECCAK_ROUND(0x8000000000008009UL);
+  KECCAK_ROUND(0x000000000000008aUL);
+  KECCAK_ROUND(0x0000000000000088UL);
+  KECCAK_ROUND(0x0000000080008009UL);
+  KECCAK_ROUND(0x000000008000000aUL);
+  KECCAK_ROUND(0x000000008000808bUL);
+  KECCAK_ROUND(0x800000000000008bUL);
+  KECCAK_ROUND(0x8000000000008089UL);
+  KECCAK_ROUND(0x8000000000008003UL);
+  KECCAK_ROUND(0x8000000000008002UL);
+  KECCAK_ROUND(0x8000000000000080UL);
+  KECCAK_ROUND(0x000000000000800aUL);
+  KECCAK_ROUND(0x800000008000000aUL);
+  KECCAK_ROUND(0x8000000080008081UL);
+  KECCAK_ROUND(0x8000000000008080UL);
+  KECCAK_ROUND(0x0000000080000001UL);
+  KECCAK_ROUND(0x8000000080008008UL);
+#else
+  for (int r = 0; r < 24; r += KECCAK_UNROLL) {
+#pragma unroll
+    for (int i = 0; i < KECCAK_UNROLL; i++)
+      KECCAK_ROUND(keccak_rc[r + i]);
   }
+#endif
 }
 
-inline LONG
-opencl_keccak_ROTL64(ulong a, ulong b) {
-  return (a << b) | (a >> (64 - b));
-}
+#undef KECCAK_ROUND
 
-inline void
-opencl_keccak_permutations(OPENCL_KECCAK_CTX *ctx) {
-  long *A = ctx->state;
-
-  long *a00 = A, *a01 = A + 1, *a02 = A + 2, *a03 = A + 3, *a04 = A + 4;
-  long *a05 = A + 5, *a06 = A + 6, *a07 = A + 7, *a08 = A + 8, *a09 = A + 9;
-  long *a10 = A + 10, *a11 = A + 11, *a12 = A + 12, *a13 = A + 13, *a14 = A + 14;
-  long *a15 = A + 15, *a16 = A + 16, *a17 = A + 17, *a18 = A + 18, *a19 = A + 19;
-  long *a20 = A + 20, *a21 = A + 21, *a22 = A + 22, *a23 = A + 23, *a24 = A + 24;
-
-  for (int i = 0; i < KECCAK_ROUND; i++) {
-    /* Theta */
-    long c0 = *a00 ^ *a05 ^ *a10 ^ *a15 ^ *a20;
-    long c1 = *a01 ^ *a06 ^ *a11 ^ *a16 ^ *a21;
-    long c2 = *a02 ^ *a07 ^ *a12 ^ *a17 ^ *a22;
-    long c3 = *a03 ^ *a08 ^ *a13 ^ *a18 ^ *a23;
-    long c4 = *a04 ^ *a09 ^ *a14 ^ *a19 ^ *a24;
-
-    long d1 = opencl_keccak_ROTL64(c1, 1) ^ c4;
-    long d2 = opencl_keccak_ROTL64(c2, 1) ^ c0;
-    long d3 = opencl_keccak_ROTL64(c3, 1) ^ c1;
-    long d4 = opencl_keccak_ROTL64(c4, 1) ^ c2;
-    long d0 = opencl_keccak_ROTL64(c0, 1) ^ c3;
-
-    *a00 ^= d1;
-    *a05 ^= d1;
-    *a10 ^= d1;
-    *a15 ^= d1;
-    *a20 ^= d1;
-    *a01 ^= d2;
-    *a06 ^= d2;
-    *a11 ^= d2;
-    *a16 ^= d2;
-    *a21 ^= d2;
-    *a02 ^= d3;
-    *a07 ^= d3;
-    *a12 ^= d3;
-    *a17 ^= d3;
-    *a22 ^= d3;
-    *a03 ^= d4;
-    *a08 ^= d4;
-    *a13 ^= d4;
-    *a18 ^= d4;
-    *a23 ^= d4;
-    *a04 ^= d0;
-    *a09 ^= d0;
-    *a14 ^= d0;
-    *a19 ^= d0;
-    *a24 ^= d0;
-
-    /* Rho pi */
-    c1 = opencl_keccak_ROTL64(*a01, 1);
-    *a01 = opencl_keccak_ROTL64(*a06, 44);
-    *a06 = opencl_keccak_ROTL64(*a09, 20);
-    *a09 = opencl_keccak_ROTL64(*a22, 61);
-    *a22 = opencl_keccak_ROTL64(*a14, 39);
-    *a14 = opencl_keccak_ROTL64(*a20, 18);
-    *a20 = opencl_keccak_ROTL64(*a02, 62);
-    *a02 = opencl_keccak_ROTL64(*a12, 43);
-    *a12 = opencl_keccak_ROTL64(*a13, 25);
-    *a13 = opencl_keccak_ROTL64(*a19, 8);
-    *a19 = opencl_keccak_ROTL64(*a23, 56);
-    *a23 = opencl_keccak_ROTL64(*a15, 41);
-    *a15 = opencl_keccak_ROTL64(*a04, 27);
-    *a04 = opencl_keccak_ROTL64(*a24, 14);
-    *a24 = opencl_keccak_ROTL64(*a21, 2);
-    *a21 = opencl_keccak_ROTL64(*a08, 55);
-    *a08 = opencl_keccak_ROTL64(*a16, 45);
-    *a16 = opencl_keccak_ROTL64(*a05, 36);
-    *a05 = opencl_keccak_ROTL64(*a03, 28);
-    *a03 = opencl_keccak_ROTL64(*a18, 21);
-    *a18 = opencl_keccak_ROTL64(*a17, 15);
-    *a17 = opencl_keccak_ROTL64(*a11, 10);
-    *a11 = opencl_keccak_ROTL64(*a07, 6);
-    *a07 = opencl_keccak_ROTL64(*a10, 3);
-    *a10 = c1;
-
-    /* Chi */
-    c0 = *a00 ^ (~*a01 & *a02);
-    c1 = *a01 ^ (~*a02 & *a03);
-    *a02 ^= ~*a03 & *a04;
-    *a03 ^= ~*a04 & *a00;
-    *a04 ^= ~*a00 & *a01;
-    *a00 = c0;
-    *a01 = c1;
-
-    c0 = *a05 ^ (~*a06 & *a07);
-    c1 = *a06 ^ (~*a07 & *a08);
-    *a07 ^= ~*a08 & *a09;
-    *a08 ^= ~*a09 & *a05;
-    *a09 ^= ~*a05 & *a06;
-    *a05 = c0;
-    *a06 = c1;
-
-    c0 = *a10 ^ (~*a11 & *a12);
-    c1 = *a11 ^ (~*a12 & *a13);
-    *a12 ^= ~*a13 & *a14;
-    *a13 ^= ~*a14 & *a10;
-    *a14 ^= ~*a10 & *a11;
-    *a10 = c0;
-    *a11 = c1;
-
-    c0 = *a15 ^ (~*a16 & *a17);
-    c1 = *a16 ^ (~*a17 & *a18);
-    *a17 ^= ~*a18 & *a19;
-    *a18 ^= ~*a19 & *a15;
-    *a19 ^= ~*a15 & *a16;
-    *a15 = c0;
-    *a16 = c1;
-
-    c0 = *a20 ^ (~*a21 & *a22);
-    c1 = *a21 ^ (~*a22 & *a23);
-    *a22 ^= ~*a23 & *a24;
-    *a23 ^= ~*a24 & *a20;
-    *a24 ^= ~*a20 & *a21;
-    *a20 = c0;
-    *a21 = c1;
-
-    /* Iota */
-    *a00 ^= CUDA_KECCAK_CONSTS[i];
-  }
-}
+/**
+ * The twelve BLAKE2b rounds over a single
+ * block. With SIGMA 0 the sigma permutation
+ * is applied at compile time, otherwise the
+ * rounds loop over a table.
+ */
+#define G(a, b, c, d, x, y) \
+  a = a + b + x;            \
+  d = ROTR64(d ^ a, 32);    \
+  c = c + d;                \
+  b = ROTR64(b ^ c, 24);    \
+  a = a + b + y;            \
+  d = ROTR64(d ^ a, 16);    \
+  c = c + d;                \
+  b = ROTR64(b ^ c, 63);
+
+#define ROUND(s0, s1, s2, s3, s4, s5, s6, s7,                \
+              s8, s9, s10, s11, s12, s13, s14, s15)          \
+  G(v[0], v[4], v[ 8], v[12], m[s0],  m[s1]);                \
+  G(v[1], v[5], v[ 9], v[13], m[s2],  m[s3]);                \
+  G(v[2], v[6], v[10], v[14], m[s4],  m[s5]);                \
+  G(v[3], v[7], v[11], v[15], m[s6],  m[s7]);                \
+  G(v[0], v[5], v[10], v[15], m[s8],  m[s9]);                \
+  G(v[1], v[6], v[11], v[12], m[s10], m[s11]);               \
+  G(v[2], v[7], v[ 8], v[13], m[s12], m[s13]);               \
+  G(v[3], v[4], v[ 9], v[14], m[s14], m[s15]);
+
+#if SIGMA == 0
 
 inline void
-opencl_keccak_absorb(OPENCL_KECCAK_CTX *ctx, BYTE *in) {
-  LONG offset = 0;
-  for (LONG i = 0; i < ctx->absorb_round; ++i) {
-    ctx->state[i] ^= opencl_keccak_leuint64(in + offset);
-    offset += 8;
-  }
-
-  opencl_keccak_permutations(ctx);
+opencl_blake2b_rounds(VLONG *v, const VLONG *m) {
+  ROUND( 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15);
+  ROUND(14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3);
+  ROUND(11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4);
+  ROUND( 7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8);
+  ROUND( 9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13);
+  ROUND( 2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9);
+  ROUND(12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11);
+  ROUND(13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10);
+  ROUND( 6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5);
+  ROUND(10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13,  0);
+  ROUND( 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15);
+  ROUND(14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3);
 }
 
-inline void
-opencl_keccak_pad(OPENCL_KECCAK_CTX *ctx) {
-  ctx->q[ctx->bits_in_queue >> 3] |= (1L << (ctx->bits_in_queue & 7));
-
-  if (++(ctx->bits_in_queue) == ctx->rate_bits) {
-    opencl_keccak_absorb(ctx, ctx->q);
-    ctx->bits_in_queue = 0;
-  }
-
-  LONG full = ctx->bits_in_queue >> 6;
-  LONG partial = ctx->bits_in_queue & 63;
-
-  LONG offset = 0;
-  for (LONG i = 0; i < full; ++i) {
-    ctx->state[i] ^= opencl_keccak_leuint64(ctx->q + offset);
-    offset += 8;
-  }
-
-  if (partial > 0) {
-    LONG mask = (1L << partial) - 1;
-    ctx->state[full] ^= opencl_keccak_leuint64(ctx->q + offset) & mask;
-  }
-
-  ctx->state[(ctx->rate_bits - 1) >> 6] ^= 9223372036854775808UL; /* 1 << 63 */
-
-  opencl_keccak_permutations(ctx);
-  opencl_keccak_extract(ctx);
+#else
+
+__constant uchar blake2b_sigma[12 * 16] = {
+   0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15,
+  14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3,
+  11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4,
+   7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8,
+   9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13,
+   2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9,
+  12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11,
+  13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10,
+   6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5,
+  10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13,  0,
+   0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15,
+  14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3
+};
 
-  ctx->bits_in_queue = ctx->rate_bits;
-}
+#if SIGMA == 2
+#define SIGMA_SPACE __local
+#else
+#define SIGMA_SPACE __constant
+#endif
 
-/*
- * digestbitlen must be 128 224 256 288 384 512
- */
-inline void
-opencl_keccak_init(OPENCL_KECCAK_CTX *ctx, WORD digestbitlen) {
-  opencl_memset(ctx, 0, sizeof(OPENCL_KECCAK_CTX));
-  ctx->sha3_flag = 1;
-  ctx->digestbitlen = digestbitlen;
-  ctx->rate_bits = 1600 - ((ctx->digestbitlen) << 1);
-  ctx->rate_bytes = ctx->rate_bits >> 3;
-  ctx->absorb_round = ctx->rate_bits >> 6;
-  ctx->bits_in_queue = 0;
-}
-
-/*
- * digestbitlen must be 224 256 384 512
- */
-inline void
-opencl_keccak_sha3_init(OPENCL_KECCAK_CTX *ctx, WORD digestbitlen) {
-  opencl_keccak_init(ctx, digestbitlen);
-  ctx->sha3_flag = 1;
-}
+#define ROW(i) sigma[r * 16 + i]
 
 inline void
-opencl_keccak_update(
-  OPENCL_KECCAK_CTX *ctx,
-  BYTE *in,
-  LONG inlen
-) {
-  long bytes = ctx->bits_in_queue >> 3;
-  long count = 0;
-
-  while (count < inlen) {
-    if (bytes == 0 && count <= ((long)(inlen - ctx->rate_bytes))) {
-      do {
-        opencl_keccak_absorb(ctx, in + count);
-        count += ctx->rate_bytes;
-      } while (count <= ((long)(inlen - ctx->rate_bytes)));
-    } else {
-      long partial = opencl_keccak_MIN(ctx->rate_bytes - bytes, inlen - count);
-      opencl_memcpy(ctx->q + bytes, in + count, partial);
-
-      bytes += partial;
-      count += partial;
-
-      if (bytes == ctx->rate_bytes) {
-        opencl_keccak_absorb(ctx, ctx->q);
-        bytes = 0;
-      }
-    }
+opencl_blake2b_rounds(VLONG *v, const VLONG *m, SIGMA_SPACE uchar *sigma) {
+  for (int r = 0; r < 12; r++) {
+    ROUND(ROW( 0), ROW( 1), ROW( 2), ROW( 3), ROW( 4), ROW( 5), ROW( 6), ROW( 7),
+          ROW( 8), ROW( 9), ROW(10), ROW(11), ROW(12), ROW(13), ROW(14), ROW(15));
   }
-  ctx->bits_in_queue = bytes << 3;
 }
 
-inline void
-opencl_keccak_final(OPENCL_KECCAK_CTX *ctx, BYTE *out) {
-  if (ctx->sha3_flag) {
-    int mask = (1 << 2) - 1;
-    ctx->q[ctx->bits_in_queue >> 3] = (uchar)(0x02 & mask);
-    ctx->bits_in_queue += 2;
-  }
+#undef ROW
 
-  opencl_keccak_pad(ctx);
-  LONG i = 0;
+#endif
 
-  while (i < ctx->digestbitlen) {
-    if (ctx->bits_in_queue == 0) {
-      opencl_keccak_permutations(ctx);
-      opencl_keccak_extract(ctx);
-      ctx->bits_in_queue = ctx->rate_bits;
-    }
-
-    LONG partial = opencl_keccak_UMIN(ctx->bits_in_queue, ctx->digestbitlen - i);
-    opencl_memcpy(out + (i >> 3), ctx->q + (ctx->rate_bytes - (ctx->bits_in_queue >> 3)), partial >> 3);
-    ctx->bits_in_queue -= partial;
-    i += partial;
-  }
-}
+#undef G
+#undef ROUND
 
-inline LONG
-rotr64(const LONG a, const BYTE b) {
-  return (a >> b) | (a << (64 - b));
-}
+#if SIGMA == 0
+#define BLAKE2B_ROUNDS(v, m) opencl_blake2b_rounds(v, m)
+#else
+#define BLAKE2B_ROUNDS(v, m) opencl_blake2b_rounds(v, m, SIGMA_TABLE)
+#endif
 
 __kernel void
 pow_ng(
-  __global LONG *g_header,
-  __global WORD *g_nonce,
-  __global WORD *g_start_nonce,
-  __global WORD *g_range,
-  __global bool *g_match
+  __constant LONG *c_header,
+  __global WORD *g_results,
+  const WORD start_nonce,
+  const WORD range,
+  const WORD nonces,
+  const WORD extra_start
 ) {
-  if (*g_match)
-    return;
-
-#define G(r,i,a,b,c,d)                     \
-  a = a + b + m[blake2b_sigmas[r][2*i]];   \
-  d = rotr64(d ^ a, 32);                   \
-  c = c + d;                               \
-  b = rotr64(b ^ c, 24);                   \
-  a = a + b + m[blake2b_sigmas[r][2*i+1]]; \
-  d = rotr64(d ^ a, 16);                   \
-  c = c + d;                               \
-  b = rotr64(b ^ c, 63);
-
-#define ROUND(r)                \
-  G(r,0,v[0],v[4],v[ 8],v[12]); \
-  G(r,1,v[1],v[5],v[ 9],v[13]); \
-  G(r,2,v[2],v[6],v[10],v[14]); \
-  G(r,3,v[3],v[7],v[11],v[15]); \
-  G(r,4,v[0],v[5],v[10],v[15]); \
-  G(r,5,v[1],v[6],v[11],v[12]); \
-  G(r,6,v[2],v[7],v[ 8],v[13]); \
-  G(r,7,v[3],v[4],v[ 9],v[14]);
-
-  const BYTE blake2b_sigmas[12][16] = {
-    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
-    { 14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3 },
-    { 11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4 },
-    { 7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8 },
-    { 9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13 },
-    { 2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9 },
-    { 12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11 },
-    { 13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10 },
-    { 6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5 },
-    { 10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0 },
-    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
-    { 14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3 }
-  };
-
-  LONG v[16] = {
-    0x6a09e667f2bdc948UL, 0xbb67ae8584caa73bUL,
-    0x3c6ef372fe94f82bUL, 0xa54ff53a5f1d36f1UL,
-    0x510e527fade682d1UL, 0x9b05688c2b3e6c1fUL,
-    0x1f83d9abfb41bd6bUL, 0x5be0cd19137e2179UL,
-    0x6a09e667f3bcc908UL, 0xbb67ae8584caa73bUL,
-    0x3c6ef372fe94f82bUL, 0xa54ff53a5f1d36f1UL,
-    0x510e527fade68251UL, 0x9b05688c2b3e6c1fUL,
-    0xe07c265404be4294UL, 0x5be0cd19137e2179UL
-  };
-
-  LONG m[16] = {
-    g_header[ 0], g_header[ 1],
-    g_header[ 2], g_header[ 3],
-    g_header[ 4], g_header[ 5],
-    g_header[ 6], g_header[ 7],
-    g_header[ 8], g_header[ 9],
-    g_header[10], g_header[11],
-    g_header[12], g_header[13],
-    g_header[14], g_header[15]
-  };
-
-  WORD nonce = get_global_id(0) + *g_start_nonce;
-
-  if ((*g_range + *g_start_nonce) <= nonce)
-    return;
-
-  opencl_memcpy(m, &nonce, 4);
-
+#if SIGMA == 2
   /**
-   * Generate the left hash by calculating
-   * the blake2b-512 hash of the preheader
-   * and commit hash.
+   * Copy sigma into local memory before any
+   * work-item can leave the kernel.
    */
+  __local uchar l_sigma[12 * 16];
 
-  ROUND( 0 );
-  ROUND( 1 );
-  ROUND( 2 );
-  ROUND( 3 );
-  ROUND( 4 );
-  ROUND( 5 );
-  ROUND( 6 );
-  ROUND( 7 );
-  ROUND( 8 );
-  ROUND( 9 );
-  ROUND( 10 );
-  ROUND( 11 );
-
-  LONG l[8] = {
-    0x6a09e667f2bdc948UL ^ v[0] ^ v[ 8],
-    0xbb67ae8584caa73bUL ^ v[1] ^ v[ 9],
-    0x3c6ef372fe94f82bUL ^ v[2] ^ v[10],
-    0xa54ff53a5f1d36f1UL ^ v[3] ^ v[11],
-    0x510e527fade682d1UL ^ v[4] ^ v[12],
-    0x9b05688c2b3e6c1fUL ^ v[5] ^ v[13],
-    0x1f83d9abfb41bd6bUL ^ v[6] ^ v[14],
-    0x5be0cd19137e2179UL ^ v[7] ^ v[15]
-  };
+  for (uint i = get_local_id(0); i < 12 * 16; i += get_local_size(0))
+    l_sigma[i] = blake2b_sigma[i];
+
+  barrier(CLK_LOCAL_MEM_FENCE);
+#define SIGMA_TABLE l_sigma
+#elif SIGMA == 1
+#define SIGMA_TABLE blake2b_sigma
+#endif
 
   /**
-   * Generate the right hash by calculating
-   * the sha3-256 hash of the preheader,
-   * commit hash, and 8 bytes of padding.
+   * In a 2D launch dimension 1 picks the extra
+   * nonce: the last 4 bytes of the header's
+   * extra nonce, plus extra_start plus the row,
+   * as a little-endian number. Work-groups are
+   * one row high, so the first work-item of each
+   * group hashes the group's sub-header into the
+   * commit hash and shares it in local memory.
+   * A 1D launch uses the host's commit hash.
    */
+  __local LONG l_commit[4];
+  LONG commit[4] = {c_header[12], c_header[13], c_header[14], c_header[15]};
+  WORD extra = extra_start;
+
+  if (get_work_dim() > 1) {
+    extra += get_global_id(1);
+
+    if (get_local_id(0) == 0) {
+      WORD hi = (WORD)(c_header[30] >> 32) + extra;
+
+      /**
+       * sub_hash: blake2b-256 of the 128 byte
+       * sub-header, a single final block.
+       */
+      VLONG m[16] = {
+        c_header[28], c_header[29],
+        (c_header[30] & 0xffffffffUL) | ((LONG)hi << 32), c_header[31],
+        c_header[32], c_header[33],
+        c_header[34], c_header[35],
+        c_header[36], c_header[37],
+        c_header[38], c_header[39],
+        c_header[40], c_header[41],
+        c_header[42], c_header[43]
+      };
+
+      VLONG v[16] = {
+        0x6a09e667f2bdc928UL, 0xbb67ae8584caa73bUL,
+        0x3c6ef372fe94f82bUL, 0xa54ff53a5f1d36f1UL,
+        0x510e527fade682d1UL, 0x9b05688c2b3e6c1fUL,
+        0x1f83d9abfb41bd6bUL, 0x5be0cd19137e2179UL,
+        0x6a09e667f3bcc908UL, 0xbb67ae8584caa73bUL,
+        0x3c6ef372fe94f82bUL, 0xa54ff53a5f1d36f1UL,
+        0x510e527fade68251UL, 0x9b05688c2b3e6c1fUL,
+        0xe07c265404be4294UL, 0x5be0cd19137e2179UL
+      };
+
+      BLAKE2B_ROUNDS(v, m);
+
+      /**
+       * commit_hash: blake2b-256 of the sub_hash
+       * and the mask hash, 64 bytes.
+       */
+      m[0] = 0x6a09e667f2bdc928UL ^ v[0] ^ v[ 8];
+      m[1] = 0xbb67ae8584caa73bUL ^ v[1] ^ v[ 9];
+      m[2] = 0x3c6ef372fe94f82bUL ^ v[2] ^ v[10];
+      m[3] = 0xa54ff53a5f1d36f1UL ^ v[3] ^ v[11];
+      m[4] = c_header[44];
+      m[5] = c_header[45];
+      m[6] = c_header[46];
+      m[7] = c_header[47];
+
+      for (int i = 8; i < 16; i++)
+        m[i] = 0;
+
+      v[ 0] = 0x6a09e667f2bdc928UL;
+      v[ 1] = 0xbb67ae8584caa73bUL;
+      v[ 2] = 0x3c6ef372fe94f82bUL;
+      v[ 3] = 0xa54ff53a5f1d36f1UL;
+      v[ 4] = 0x510e527fade682d1UL;
+      v[ 5] = 0x9b05688c2b3e6c1fUL;
+      v[ 6] = 0x1f83d9abfb41bd6bUL;
+      v[ 7] = 0x5be0cd19137e2179UL;
+      v[ 8] = 0x6a09e667f3bcc908UL;
+      v[ 9] = 0xbb67ae8584caa73bUL;
+      v[10] = 0x3c6ef372fe94f82bUL;
+      v[11] = 0xa54ff53a5f1d36f1UL;
+      v[12] = 0x510e527fade68291UL;
+      v[13] = 0x9b05688c2b3e6c1fUL;
+      v[14] = 0xe07c265404be4294UL;
+      v[15] = 0x5be0cd19137e2179UL;
+
+      BLAKE2B_ROUNDS(v, m);
+
+      l_commit[0] = LANE0(0x6a09e667f2bdc928UL ^ v[0] ^ v[ 8]);
+      l_commit[1] = LANE0(0xbb67ae8584caa73bUL ^ v[1] ^ v[ 9]);
+      l_commit[2] = LANE0(0x3c6ef372fe94f82bUL ^ v[2] ^ v[10]);
+      l_commit[3] = LANE0(0xa54ff53a5f1d36f1UL ^ v[3] ^ v[11]);
+    }
 
-  LONG r[4];
-  LONG p[4] = {g_header[16], g_header[17], g_header[18], g_header[19]};
+    barrier(CLK_LOCAL_MEM_FENCE);
 
-  OPENCL_KECCAK_CTX kctx;
-  opencl_keccak_init(&kctx, 256);
-  opencl_keccak_update(&kctx, m, 128);
-  opencl_keccak_update(&kctx, p, 8);
-  opencl_keccak_final(&kctx, r);
+    for (int i = 0; i < 4; i++)
+      commit[i] = l_commit[i];
+  }
 
   /**
-   * Generate share hash by calculating
-   * the blake2b-256 hash of the the left,
-   * 32 bytes of padding, and the right.
+   * The job block is read once per work-item,
+   * not once per nonce. Only the nonce changes
+   * between iterations.
    */
-
-  m[ 0] = l[0];
-  m[ 1] = l[1];
-  m[ 2] = l[2];
-  m[ 3] = l[3],
-  m[ 4] = l[4];
-  m[ 5] = l[5];
-  m[ 6] = l[6];
-  m[ 7] = l[7];
-  m[ 8] = p[0];
-  m[ 9] = p[1];
-  m[10] = p[2];
-  m[11] = p[3];
-  m[12] = r[0];
-  m[13] = r[1];
-  m[14] = r[2];
-  m[15] = r[3];
-
-  v[ 0] = 0x6a09e667f2bdc928UL;
-  v[ 1] = 0xbb67ae8584caa73bUL;
-  v[ 2] = 0x3c6ef372fe94f82bUL;
-  v[ 3] = 0xa54ff53a5f1d36f1UL;
-  v[ 4] = 0x510e527fade682d1UL;
-  v[ 5] = 0x9b05688c2b3e6c1fUL;
-  v[ 6] = 0x1f83d9abfb41bd6bUL;
-  v[ 7] = 0x5be0cd19137e2179UL;
-  v[ 8] = 0x6a09e667f3bcc908UL;
-  v[ 9] = 0xbb67ae8584caa73bUL;
-  v[10] = 0x3c6ef372fe94f82bUL;
-  v[11] = 0xa54ff53a5f1d36f1UL;
-  v[12] = 0x510e527fade68251UL;
-  v[13] = 0x9b05688c2b3e6c1fUL;
-  v[14] = 0xe07c265404be4294UL;
-  v[15] = 0x5be0cd19137e2179UL;
-
-  ROUND( 0 );
-  ROUND( 1 );
-  ROUND( 2 );
-  ROUND( 3 );
-  ROUND( 4 );
-  ROUND( 5 );
-  ROUND( 6 );
-  ROUND( 7 );
-  ROUND( 8 );
-  ROUND( 9 );
-  ROUND( 10 );
-  ROUND( 11 );
-#undef G
-#undef ROUND
-
-  LONG pow    = 0x6a09e667f2bdc928UL ^ v[0] ^ v[8];
-  LONG target = g_header[20];
+  const LONG job[28] = {
+    HDR( 0) & 0xffffffff00000000UL, HDR( 1),
+    HDR( 2), HDR( 3),
+    HDR( 4), HDR( 5),
+    HDR( 6), HDR( 7),
+    HDR( 8), HDR( 9),
+    HDR(10), HDR(11),
+    commit[0], commit[1],
+    commit[2], commit[3],
+    HDR(16), HDR(17),
+    HDR(18), HDR(19),
+    HDR(20), HDR(21),
+    HDR(22), HDR(23),
+    HDR(24), HDR(25),
+    HDR(26), HDR(27)
+  };
 
   /**
-   * Do a bytewise comparison to see if the
-   * pow satisfies the target. We only compare
-   * the first 64 bits. This should be fine until
-   * asics render this code obsolete.
+   * Each work-item hashes `nonces` consecutive
+   * nonces, LANES at a time. The offset is
+   * checked against the range rather than the
+   * nonce so the range may wrap.
    */
-  if (opencl_memcmp(&pow, &target, 8) <= 0) {
-    *g_nonce = nonce;
-    *g_match = true;
-    return;
+  const WORD base = get_global_id(0) * nonces;
+
+  for (WORD k = 0; k < nonces; k += LANES) {
+    WORD offset = base + k;
+
+    if (offset >= range)
+      return;
+
+    WORD nonce = start_nonce + offset;
+
+    /**
+     * The share: preheader with the nonce in
+     * the low half of the first word, and the
+     * commit hash. Lane i hashes nonce + i.
+     */
+    VLONG first = job[0] | nonce;
+#if LANES == 2
+    first.s1 = job[0] | (WORD)(nonce + 1);
+#endif
+
+    VLONG m[16] = {
+      first, job[ 1],
+      job[ 2], job[ 3],
+      job[ 4], job[ 5],
+      job[ 6], job[ 7],
+      job[ 8], job[ 9],
+      job[10], job[11],
+      job[12], job[13],
+      job[14], job[15]
+    };
+
+    /**
+     * Generate the left hash by calculating
+     * the blake2b-512 hash of the share. The
+     * state starts from the parameter block
+     * for a 64 byte digest, with the counter
+     * at 128 and the final block flag set.
+     */
+    VLONG v[16] = {
+      0x6a09e667f2bdc948UL, 0xbb67ae8584caa73bUL,
+      0x3c6ef372fe94f82bUL, 0xa54ff53a5f1d36f1UL,
+      0x510e527fade682d1UL, 0x9b05688c2b3e6c1fUL,
+      0x1f83d9abfb41bd6bUL, 0x5be0cd19137e2179UL,
+      0x6a09e667f3bcc908UL, 0xbb67ae8584caa73bUL,
+      0x3c6ef372fe94f82bUL, 0xa54ff53a5f1d36f1UL,
+      0x510e527fade68251UL, 0x9b05688c2b3e6c1fUL,
+      0xe07c265404be4294UL, 0x5be0cd19137e2179UL
+    };
+
+    BLAKE2B_ROUNDS(v, m);
+
+    VLONG l[8] = {
+      0x6a09e667f2bdc948UL ^ v[0] ^ v[ 8],
+      0xbb67ae8584caa73bUL ^ v[1] ^ v[ 9],
+      0x3c6ef372fe94f82bUL ^ v[2] ^ v[10],
+      0xa54ff53a5f1d36f1UL ^ v[3] ^ v[11],
+      0x510e527fade682d1UL ^ v[4] ^ v[12],
+      0x9b05688c2b3e6c1fUL ^ v[5] ^ v[13],
+      0x1f83d9abfb41bd6bUL ^ v[6] ^ v[14],
+      0x5be0cd19137e2179UL ^ v[7] ^ v[15]
+    };
+
+    /**
+     * Generate the right hash by calculating
+     * the sha3-256 hash of the share and 8
+     * bytes of padding. The 136 byte input is
+     * exactly one rate block, so it is absorbed
+     * whole and followed by a padding-only block.
+     */
+    VLONG s[25] = {
+      m[ 0], m[ 1], m[ 2], m[ 3], m[ 4],
+      m[ 5], m[ 6], m[ 7], m[ 8], m[ 9],
+      m[10], m[11], m[12], m[13], m[14],
+      m[15], job[16], 0, 0, 0,
+      0, 0, 0, 0, 0
+    };
+
+    opencl_keccakf(s);
+
+    s[ 0] ^= 0x0000000000000006UL;
+    s[16] ^= 0x8000000000000000UL;
+
+    opencl_keccakf(s);
+
+    /**
+     * Generate share hash by calculating
+     * the blake2b-256 hash of the the left,
+     * 32 bytes of padding, and the right.
+     */
+    m[ 0] = l[0];
+    m[ 1] = l[1];
+    m[ 2] = l[2];
+    m[ 3] = l[3];
+    m[ 4] = l[4];
+    m[ 5] = l[5];
+    m[ 6] = l[6];
+    m[ 7] = l[7];
+    m[ 8] = job[16];
+    m[ 9] = job[17];
+    m[10] = job[18];
+    m[11] = job[19];
+    m[12] = s[0];
+    m[13] = s[1];
+    m[14] = s[2];
+    m[15] = s[3];
+
+    v[ 0] = 0x6a09e667f2bdc928UL;
+    v[ 1] = 0xbb67ae8584caa73bUL;
+    v[ 2] = 0x3c6ef372fe94f82bUL;
+    v[ 3] = 0xa54ff53a5f1d36f1UL;
+    v[ 4] = 0x510e527fade682d1UL;
+    v[ 5] = 0x9b05688c2b3e6c1fUL;
+    v[ 6] = 0x1f83d9abfb41bd6bUL;
+    v[ 7] = 0x5be0cd19137e2179UL;
+    v[ 8] = 0x6a09e667f3bcc908UL;
+    v[ 9] = 0xbb67ae8584caa73bUL;
+    v[10] = 0x3c6ef372fe94f82bUL;
+    v[11] = 0xa54ff53a5f1d36f1UL;
+    v[12] = 0x510e527fade68251UL;
+    v[13] = 0x9b05688c2b3e6c1fUL;
+    v[14] = 0xe07c265404be4294UL;
+    v[15] = 0x5be0cd19137e2179UL;
+
+    BLAKE2B_ROUNDS(v, m);
+
+    VLONG hash[4] = {
+      0x6a09e667f2bdc928UL ^ v[0] ^ v[ 8],
+      0xbb67ae8584caa73bUL ^ v[1] ^ v[ 9],
+      0x3c6ef372fe94f82bUL ^ v[2] ^ v[10],
+      0xa54ff53a5f1d36f1UL ^ v[3] ^ v[11]
+    };
+
+#if LANES == 2
+    LONG pows[2][4] = {
+      {hash[0].s0, hash[1].s0, hash[2].s0, hash[3].s0},
+      {hash[0].s1, hash[1].s1, hash[2].s1, hash[3].s1}
+    };
+#else
+    LONG pows[1][4] = {
+      {hash[0], hash[1], hash[2], hash[3]}
+    };
+#endif
+
+    LONG target[4] = {job[20], job[21], job[22], job[23]};
+    LONG block[4]  = {job[24], job[25], job[26], job[27]};
+
+    /**
+     * Compare the pow against the target. With
+     * FULL_COMPARE disabled only the first 64
+     * bits are compared, which leaves rare false
+     * positives for the host to weed out.
+     */
+#if FULL_COMPARE
+#define POW_WORDS 4
+#else
+#define POW_WORDS 1
+#endif
+
+#pragma unroll
+    for (int i = 0; i < LANES; i++) {
+      /* A trailing lane may belong to the next item. */
+      if (k + i >= nonces || offset + i >= range)
+        break;
+
+      LONG *pow = pows[i];
+
+      if (opencl_hashcmp(pow, target, POW_WORDS) <= 0) {
+        /**
+         * Append the hit to the result buffer:
+         *
+         * count:  1 word
+         * hits:   MAX_RESULTS * (nonce, extra, block)
+         *
+         * The counter keeps counting past the
+         * capacity so the host can tell hits
+         * were dropped.
+         */
+        WORD slot = atomic_inc(&g_results[0]);
+
+        if (slot < MAX_RESULTS) {
+          g_results[1 + slot * 3] = nonce + i;
+          g_results[2 + slot * 3] = extra;
+          g_results[3 + slot * 3] = opencl_hashcmp(pow, block, POW_WORDS) <= 0;
+        }
+      }
+    }
+#undef POW_WORDS
   }
 }
@@ -0,0 +1,43 @@
+#ifndef _HS_MINER_PROBES_H
+#define _HS_MINER_PROBES_H
+
+// USDT probes under the `hs_miner` provider. With <sys/sdt.h>
+// (systemtap-sdt-dev) each probe is a single nop plus an ELF
+// note, so they cost nothing until bpftrace or perf attach:
+//
+//   $ bpftrace -l 'usdt:build/Release/hs-miner.node:*'
+//
+// Without the header, or with HS_NO_USDT defined, they
+// compile to nothing.
+//
+//   job_start(device, backend)
+//   job_done(device, rc, match, ns)
+//   batch_start(device, thread, nonce)
+//   batch_done(device, thread, hashes)
+//   found(device, nonce, block)
+//   enqueue(device, slot, hashes)
+//   readback(device, slot, hits)
+//   verify_start(device, nonce)
+//   verify_done(device, nonce, valid)
+
+#if !defined(HS_NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define HS_USDT 1
+#endif
+#endif
+
+#ifdef HS_USDT
+#define HS_PROBE2(name, a, b) \
+  DTRACE_PROBE2(hs_miner, name, a, b)
+#define HS_PROBE3(name, a, b, c) \
+  DTRACE_PROBE3(hs_miner, name, a, b, c)
+#define HS_PROBE4(name, a, b, c, d) \
+  DTRACE_PROBE4(hs_miner, name, a, b, c, d)
+#else
+#define HS_PROBE2(name, a, b) do {} while (0)
+#define HS_PROBE3(name, a, b, c) do {} while (0)
+#define HS_PROBE4(name, a, b, c, d) do {} while (0)
+#endif
+
+#endif
@@ -0,0 +1,330 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "common.h"
+#include "error.h"
+#include "shm.h"
+
+// One segment per process, republished by its own thread so
+// the mining threads only ever touch their stats counters.
+static pthread_mutex_t hs_shm_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t hs_shm_wait_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t hs_shm_cond = PTHREAD_COND_INITIALIZER;
+static hs_shm_t *hs_shm = NULL;
+static char *hs_shm_path = NULL;
+static pthread_t hs_shm_thread;
+static uint32_t hs_shm_interval = 0;
+static bool hs_shm_running = false;
+
+// PCI address of a device, from its backend. Devices
+// without one (the CPU, or drivers that hide it) get no
+// temperature rather than another card's.
+static bool
+hs_shm_pci_bus_id(uint32_t backend, uint32_t device, char *out) {
+  hs_device_info_t info;
+
+  (void)device;
+
+  memset(&info, 0, sizeof(info));
+
+  switch (backend) {
+#ifdef HS_HAS_CUDA
+    case HS_BACKEND_CUDA:
+      if (!hs_cuda_device_info(device, &info))
+        return false;
+      break;
+#endif
+#ifdef HS_HAS_OPENCL
+    case HS_BACKEND_OPENCL:
+      if (!hs_opencl_device_info(device, &info))
+        return false;
+      break;
+#endif
+    default:
+      return false;
+  }
+
+  if (info.pci_bus_id[0] == '\0')
+    return false;
+
+  memcpy(out, info.pci_bus_id, sizeof(info.pci_bus_id));
+
+  return true;
+}
+
+// The DRM card whose device link resolves to the PCI
+// address, or -1.
+static int
+hs_shm_card(const char *pci_bus_id) {
+  char path[64];
+  char link[256];
+
+  for (int card = 0; card < 64; card++) {
+    snprintf(path, sizeof(path), "/sys/class/drm/card%d/device", card);
+
+    // A relative link ending in the PCI address.
+    ssize_t len = readlink(path, link, sizeof(link) - 1);
+
+    if (len <= 0)
+      continue;
+
+    link[len] = '\0';
+
+    const char *name = strrchr(link, '/');
+
+    name = name != NULL ? name + 1 : link;
+
+    if (strcasecmp(name, pci_bus_id) == 0)
+      return card;
+  }
+
+  return -1;
+}
+
+// Best effort: the first hwmon sensor of the DRM card on
+// the device's PCI address. Neither OpenCL nor the CUDA
+// runtime report temperatures. The card is looked up once
+// per device, since the device list is fixed.
+static int32_t
+hs_shm_temperature(uint32_t backend, uint32_t device) {
+  static int cards[HS_BACKENDS][HS_SHM_DEVICES];
+  static bool resolved[HS_BACKENDS][HS_SHM_DEVICES];
+  char pci_bus_id[16];
+  char path[128];
+  int card = -1;
+
+  if (device < HS_SHM_DEVICES && resolved[backend][device]) {
+    card = cards[backend][device];
+  } else {
+    if (hs_shm_pci_bus_id(backend, device, pci_bus_id))
+      card = hs_shm_card(pci_bus_id);
+
+    if (device < HS_SHM_DEVICES) {
+      cards[backend][device] = card;
+      resolved[backend][device] = true;
+    }
+  }
+
+  if (card < 0)
+    return HS_SHM_NO_TEMP;
+
+  for (int i = 0; i < 16; i++) {
+    snprintf(path, sizeof(path),
+      "/sys/class/drm/card%d/device/hwmon/hwmon%d/temp1_input", card, i);
+
+    FILE *fp = fopen(path, "r");
+
+    if (fp == NULL)
+      continue;
+
+    long temp;
+    int ret = fscanf(fp, "%ld", &temp);
+
+    fclose(fp);
+
+    if (ret == 1)
+      return (int32_t)temp;
+  }
+
+  return HS_SHM_NO_TEMP;
+}
+
+static uint64_t
+hs_shm_time(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void
+hs_shm_publish(hs_shm_t *shm) {
+  static hs_shm_device_t devices[HS_SHM_DEVICES];
+  uint32_t len = 0;
+
+  // Gather first so the write side stays short. Only
+  // devices that have mined get an entry.
+  for (uint32_t b = 0; b < HS_BACKENDS; b++) {
+    uint32_t count = hs_stats_device_count(b);
+
+    for (uint32_t i = 0; i < count && len < HS_SHM_DEVICES; i++) {
+      hs_shm_device_t *dev = &devices[len];
+      hs_stats_t stats;
+
+      if (!hs_stats_get(b, i, &stats))
+        continue;
+
+      dev->backend = b;
+      dev->device = i;
+      dev->hashes = stats.hashes;
+      dev->hits = stats.hits;
+      dev->jobs = stats.jobs;
+      dev->epoch = stats.epoch;
+      dev->last_hit = stats.last_hit;
+      dev->busy = stats.busy;
+      memcpy(dev->rates, stats.rates, sizeof(dev->rates));
+      dev->temperature = hs_shm_temperature(b, i);
+      dev->threads_len = 0;
+
+      for (uint32_t j = 0; j < HS_SHM_THREADS; j++) {
+        dev->threads[j] = stats.threads[j];
+
+        if (stats.threads[j] != 0)
+          dev->threads_len = j + 1;
+      }
+
+      len += 1;
+    }
+  }
+
+  uint64_t seq = shm->seq;
+
+  __atomic_store_n(&shm->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  shm->updated = hs_shm_time();
+  shm->devices_len = len;
+  memcpy(shm->devices, devices, len * sizeof(hs_shm_device_t));
+
+  __atomic_store_n(&shm->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static void *
+hs_shm_run(void *arg) {
+  hs_shm_t *shm = (hs_shm_t *)arg;
+
+  pthread_mutex_lock(&hs_shm_wait_lock);
+
+  while (hs_shm_running) {
+    pthread_mutex_unlock(&hs_shm_wait_lock);
+
+    hs_shm_publish(shm);
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += hs_shm_interval / 1000;
+    ts.tv_nsec += (long)(hs_shm_interval % 1000) * 1000000;
+
+    if (ts.tv_nsec >= 1000000000) {
+      ts.tv_sec += 1;
+      ts.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&hs_shm_wait_lock);
+
+    if (hs_shm_running)
+      pthread_cond_timedwait(&hs_shm_cond, &hs_shm_wait_lock, &ts);
+  }
+
+  pthread_mutex_unlock(&hs_shm_wait_lock);
+
+  return NULL;
+}
+
+// Caller must hold hs_shm_lock.
+static void
+hs_shm_stop(void) {
+  if (hs_shm == NULL)
+    return;
+
+  pthread_mutex_lock(&hs_shm_wait_lock);
+  hs_shm_running = false;
+  pthread_cond_signal(&hs_shm_cond);
+  pthread_mutex_unlock(&hs_shm_wait_lock);
+
+  pthread_join(hs_shm_thread, NULL);
+
+  munmap(hs_shm, sizeof(hs_shm_t));
+  unlink(hs_shm_path);
+  free(hs_shm_path);
+
+  hs_shm = NULL;
+  hs_shm_path = NULL;
+}
+
+// Create (or replace) the segment at `path` and start
+// republishing every `interval` milliseconds.
+int32_t
+hs_shm_open(const char *path, uint32_t interval) {
+  int32_t rc = HS_EFAILURE;
+
+  if (interval == 0)
+    interval = 1000;
+
+  pthread_mutex_lock(&hs_shm_lock);
+
+  hs_shm_stop();
+
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+  if (fd < 0)
+    goto done;
+
+  if (ftruncate(fd, sizeof(hs_shm_t)) != 0) {
+    close(fd);
+    goto fail;
+  }
+
+  hs_shm_t *shm = (hs_shm_t *)mmap(NULL, sizeof(hs_shm_t),
+    PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+  close(fd);
+
+  if (shm == MAP_FAILED)
+    goto fail;
+
+  hs_shm_path = strdup(path);
+
+  if (hs_shm_path == NULL) {
+    munmap(shm, sizeof(hs_shm_t));
+    rc = HS_ENOMEM;
+    goto fail;
+  }
+
+  shm->version = HS_SHM_VERSION;
+  shm->size = sizeof(hs_shm_t);
+  shm->pid = (uint32_t)getpid();
+  shm->interval = interval;
+
+  // Readers check the magic last.
+  __atomic_store_n(&shm->magic, HS_SHM_MAGIC, __ATOMIC_RELEASE);
+
+  hs_shm_interval = interval;
+  hs_shm_running = true;
+
+  if (pthread_create(&hs_shm_thread, NULL, hs_shm_run, shm) != 0) {
+    hs_shm_running = false;
+    munmap(shm, sizeof(hs_shm_t));
+    free(hs_shm_path);
+    hs_shm_path = NULL;
+    goto fail;
+  }
+
+  hs_shm = shm;
+  rc = HS_SUCCESS;
+  goto done;
+
+fail:
+  unlink(path);
+done:
+  pthread_mutex_unlock(&hs_shm_lock);
+  return rc;
+}
+
+// Stop publishing and remove the segment.
+void
+hs_shm_close(void) {
+  pthread_mutex_lock(&hs_shm_lock);
+  hs_shm_stop();
+  pthread_mutex_unlock(&hs_shm_lock);
+}
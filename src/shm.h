@@ -0,0 +1,98 @@
+#ifndef _HS_MINER_SHM_H
+#define _HS_MINER_SHM_H
+
+// Layout of the shared-memory stats segment. The miner maps
+// a file (e.g. /dev/shm/hs-miner) and republishes its counters
+// into it every `interval` milliseconds. Monitoring agents map
+// the same file read-only and never touch the miner process.
+//
+// Every field is naturally aligned and little-endian on the
+// supported platforms, so the layout is the same for any
+// compiler. Readers should check `magic`, `version` and
+// `size`, then copy the segment with hs_shm_read().
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HS_SHM_MAGIC 0x4d485348 // "HSHM"
+#define HS_SHM_VERSION 2
+#define HS_SHM_DEVICES 32
+#define HS_SHM_THREADS 64
+#define HS_SHM_PATH "/dev/shm/hs-miner"
+
+// No temperature sensor was found for the device.
+#define HS_SHM_NO_TEMP INT32_MIN
+
+typedef struct hs_shm_device_s {
+  uint64_t hashes;
+  uint64_t hits;
+  uint64_t jobs;
+  // Changes of work (previous block, tree root or mask hash).
+  uint64_t epoch;
+  // Unix time of the last hit in milliseconds, 0 for none.
+  uint64_t last_hit;
+  // Nanoseconds spent mining, summed over threads.
+  uint64_t busy;
+  // Hashes per second over the last 1, 10 and 60 seconds.
+  double rates[3];
+  // Millidegrees Celsius, or HS_SHM_NO_TEMP.
+  int32_t temperature;
+  uint32_t threads_len;
+  // HS_BACKEND_* and the device index on that backend.
+  uint32_t backend;
+  uint32_t device;
+  uint64_t threads[HS_SHM_THREADS];
+} hs_shm_device_t;
+
+typedef struct hs_shm_s {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t size;
+  uint32_t pid;
+  // Odd while the miner is writing.
+  uint64_t seq;
+  // Unix time of the last update in milliseconds.
+  uint64_t updated;
+  uint32_t devices_len;
+  uint32_t interval;
+  hs_shm_device_t devices[HS_SHM_DEVICES];
+} hs_shm_t;
+
+// Offsets are part of the format; readers in other
+// languages hard-code them. lib/shm.js mirrors them for
+// JavaScript readers (hs-top and the tests).
+typedef char hs_shm_check_device_[
+  sizeof(hs_shm_device_t) == 600 ? 1 : -1];
+typedef char hs_shm_check_segment_[
+  sizeof(hs_shm_t) == 40 + 600 * HS_SHM_DEVICES ? 1 : -1];
+
+// Copy a consistent snapshot of the segment. Returns 0 on
+// success, or -1 if the miner kept writing for every try.
+static inline int
+hs_shm_read(const hs_shm_t *shm, hs_shm_t *out) {
+  for (int i = 0; i < 1000; i++) {
+    uint64_t seq = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+
+    if (seq & 1)
+      continue;
+
+    memcpy(out, (const void *)shm, sizeof(hs_shm_t));
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    if (__atomic_load_n(&shm->seq, __ATOMIC_RELAXED) == seq)
+      return 0;
+  }
+
+  return -1;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
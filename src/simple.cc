@@ -6,6 +6,7 @@
 #include "header.h"
 #include "error.h"
 #include "utils.h"
+#include "probes.h"
 
 typedef struct hs_thread_args_s {
   hs_options_t *options;
@@ -50,6 +51,9 @@ hs_simple_thread(void *ptr) {
   uint8_t target[32];
   memcpy(target, options->target, 32);
 
+  uint8_t block_target[32];
+  memcpy(block_target, options->block_target, 32);
+
   // Cache padding
   uint8_t pad32[32];
   hs_header_padding(header, pad32, 32);
@@ -58,26 +62,88 @@ hs_simple_thread(void *ptr) {
   uint8_t share[128];
   hs_header_share_encode(header, share);
 
+  // Counted locally and flushed every HS_STATS_BATCH hashes.
+  hs_counter_t *counter =
+    hs_stats_counter(HS_BACKEND_SIMPLE, options->device, thread);
+  uint64_t hashes = 0;
+  uint64_t hits = 0;
+  uint64_t then = hs_stats_now();
+  uint64_t born = then;
+  uint64_t total = 0;
+  int32_t rc = HS_ENOSOLUTION;
+  hs_perf_t perf;
+
+  hs_trace_thread("simple");
+
+  hs_latency_first(options, HS_BACKEND_SIMPLE);
+  hs_perf_begin(&perf, HS_BACKEND_SIMPLE);
+
+  HS_PROBE3(batch_start, options->device, thread, nonce);
+
   for (; nonce < max; nonce++) {
-    if (!options->running)
-      return (void *)HS_EABORT;
+    if (!options->running) {
+      hs_trace_instant("stop", nonce);
+      rc = HS_EABORT;
+      break;
+    }
+
+    if (hashes == HS_STATS_BATCH) {
+      HS_PROBE3(batch_done, options->device, thread, hashes);
+      hs_trace_span("batch", then, hashes);
+      total += hashes;
+      hs_stats_flush(counter, options, &hashes, &hits, &then);
+      HS_PROBE3(batch_start, options->device, thread, nonce);
+    }
 
     // Insert nonce into share
     memcpy(share, &nonce, 4);
 
     hs_header_share_pow(share, pad32, hash);
+    hashes += 1;
 
     if (memcmp(hash, target, 32) <= 0) {
+      bool block = memcmp(hash, block_target, 32) <= 0;
+
+      hits += 1;
+
+      HS_PROBE3(found, options->device, nonce, block);
+
+      // When streaming, hand the hit off and keep going
+      // through the range unless it's a block. Under a
+      // verifier, blocks end the job once confirmed.
+      if (options->share_func != NULL) {
+        hs_share_t hit;
+        hit.nonce = nonce;
+        memcpy(hit.extra_nonce, options->header + 128, EXTRA_NONCE_SIZE);
+        hit.block = block;
+        hit.found = hs_stats_now();
+        hs_trace_instant("share", nonce);
+        options->share_func(&hit, options->share_arg);
+
+        if (!block || options->verified)
+          continue;
+      }
+
       // WINNER!
+      hs_trace_instant("match", nonce);
       options->running = false;
+      options->block = block;
 
       *match = true;
       *result = nonce;
-      return (void *)HS_SUCCESS;
+      rc = HS_SUCCESS;
+      break;
     }
   }
 
-  return (void *)HS_ENOSOLUTION;
+  HS_PROBE3(batch_done, options->device, thread, hashes);
+  hs_trace_span("batch", then, hashes);
+  total += hashes;
+  hs_stats_flush(counter, options, &hashes, &hits, &then);
+  hs_perf_end(&perf, total);
+  hs_trace_span("thread", born, thread);
+
+  return (void *)(intptr_t)rc;
 }
 
 // Return code for hs_simple_thread() threads must be in scope
@@ -97,6 +163,8 @@ hs_simple_run(
   // Array of args structs for each thread
   hs_thread_args_t args[NUM_THREADS];
 
+  hs_stats_job(HS_BACKEND_SIMPLE, options->device, options);
+
   for(uint8_t i = 0; i < NUM_THREADS; i++) {
     // Create new args object in memory for each thread so we can add
     // thread IDs to it and return different nonces.
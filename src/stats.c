@@ -0,0 +1,288 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include "common.h"
+
+// Hashrate samples kept per device. A sample is taken at
+// most once a second (by a job, a flush or a read), so the
+// ring covers the longest window.
+#define HS_STATS_SAMPLES 64
+
+// Devices at or past this index are not tracked. This bounds
+// the slot arrays, and a `device` of -1 from JavaScript wraps
+// to UINT32_MAX.
+#define HS_STATS_DEVICES 1024
+
+static const uint64_t hs_stats_windows[3] = { 1, 10, 60 };
+
+typedef struct hs_stats_sample_s {
+  uint64_t time;
+  uint64_t hashes;
+} hs_stats_sample_t;
+
+// Counters come first, each on its own cache line. The rest
+// is only touched when a sample is taken or stats are read.
+typedef struct hs_stats_device_s {
+  hs_counter_t counters[HS_STATS_THREADS];
+  pthread_mutex_t lock;
+  uint64_t jobs;
+  uint64_t epoch;
+  uint64_t last_hit;
+  uint8_t work[96];
+  uint64_t second;
+  hs_stats_sample_t samples[HS_STATS_SAMPLES];
+  size_t head;
+  size_t len;
+} hs_stats_device_t;
+
+// Slots are keyed by backend and device index, since the
+// same index names different hardware on each backend.
+static pthread_mutex_t hs_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static hs_stats_device_t **hs_stats_devices[HS_BACKENDS];
+static uint32_t hs_stats_devices_len[HS_BACKENDS];
+
+uint64_t
+hs_stats_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Unix time in milliseconds.
+static uint64_t
+hs_stats_time(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+uint32_t
+hs_stats_device_count(uint32_t backend) {
+  uint32_t len = 0;
+
+  if (backend >= HS_BACKENDS)
+    return 0;
+
+  pthread_mutex_lock(&hs_stats_lock);
+  len = hs_stats_devices_len[backend];
+  pthread_mutex_unlock(&hs_stats_lock);
+
+  return len;
+}
+
+static hs_stats_device_t *
+hs_stats_device(uint32_t backend, uint32_t device, bool create) {
+  hs_stats_device_t *dev = NULL;
+
+  if (backend >= HS_BACKENDS || device >= HS_STATS_DEVICES)
+    return NULL;
+
+  pthread_mutex_lock(&hs_stats_lock);
+
+  uint32_t len = hs_stats_devices_len[backend];
+
+  if (device < len)
+    dev = hs_stats_devices[backend][device];
+
+  if (dev != NULL || !create)
+    goto done;
+
+  if (device >= len) {
+    hs_stats_device_t **devices = (hs_stats_device_t **)realloc(
+      hs_stats_devices[backend], (device + 1) * sizeof(hs_stats_device_t *));
+
+    if (devices == NULL)
+      goto done;
+
+    for (uint32_t i = len; i <= device; i++)
+      devices[i] = NULL;
+
+    hs_stats_devices[backend] = devices;
+    hs_stats_devices_len[backend] = device + 1;
+  }
+
+  if (posix_memalign((void **)&dev, HS_CACHE_LINE,
+                     sizeof(hs_stats_device_t)) != 0) {
+    dev = NULL;
+    goto done;
+  }
+
+  memset(dev, 0, sizeof(hs_stats_device_t));
+  pthread_mutex_init(&dev->lock, NULL);
+
+  for (size_t i = 0; i < HS_STATS_THREADS; i++)
+    dev->counters[i].device = dev;
+
+  hs_stats_devices[backend][device] = dev;
+
+done:
+  pthread_mutex_unlock(&hs_stats_lock);
+  return dev;
+}
+
+static uint64_t
+hs_stats_hashes(hs_stats_device_t *dev) {
+  uint64_t hashes = 0;
+
+  for (size_t i = 0; i < HS_STATS_THREADS; i++)
+    hashes += __atomic_load_n(&dev->counters[i].hashes, __ATOMIC_RELAXED);
+
+  return hashes;
+}
+
+// Caller must hold the device lock.
+static void
+hs_stats_sample(hs_stats_device_t *dev, uint64_t now) {
+  hs_stats_sample_t *sample = &dev->samples[dev->head];
+
+  sample->time = now;
+  sample->hashes = hs_stats_hashes(dev);
+
+  dev->head = (dev->head + 1) % HS_STATS_SAMPLES;
+
+  if (dev->len < HS_STATS_SAMPLES)
+    dev->len += 1;
+
+  __atomic_store_n(&dev->second, now / 1000000000, __ATOMIC_RELAXED);
+}
+
+// Claim the counter for a mining thread. Threads beyond
+// HS_STATS_THREADS share slots, which stays correct since
+// every update is atomic.
+hs_counter_t *
+hs_stats_counter(uint32_t backend, uint32_t device, uint32_t thread) {
+  hs_stats_device_t *dev = hs_stats_device(backend, device, true);
+
+  if (dev == NULL)
+    return NULL;
+
+  return &dev->counters[thread % HS_STATS_THREADS];
+}
+
+// Count a job and mark where its hashing starts, unless a
+// sample was already taken this second. The epoch moves on
+// when the job's previous block, tree root or mask hash
+// differ from the last job's.
+void
+hs_stats_job(uint32_t backend, uint32_t device, const hs_options_t *options) {
+  hs_stats_device_t *dev = hs_stats_device(backend, device, true);
+
+  if (dev == NULL)
+    return;
+
+  uint64_t now = hs_stats_now();
+
+  pthread_mutex_lock(&dev->lock);
+  dev->jobs += 1;
+
+  if (dev->epoch == 0 || memcmp(dev->work, options->header + 32, 96) != 0) {
+    memcpy(dev->work, options->header + 32, 96);
+    dev->epoch += 1;
+  }
+
+  if (dev->second != now / 1000000000)
+    hs_stats_sample(dev, now);
+
+  pthread_mutex_unlock(&dev->lock);
+}
+
+// Add a thread's local counts to its counter and the job,
+// then reset them. Takes a sample when a new second has
+// started, unless another thread already is.
+void
+hs_stats_flush(
+  hs_counter_t *counter,
+  hs_options_t *options,
+  uint64_t *hashes,
+  uint64_t *hits,
+  uint64_t *then
+) {
+  uint64_t now = hs_stats_now();
+
+  if (options != NULL)
+    __atomic_fetch_add(&options->hashes, *hashes, __ATOMIC_RELAXED);
+
+  if (counter != NULL) {
+    hs_stats_device_t *dev = (hs_stats_device_t *)counter->device;
+    uint64_t second = now / 1000000000;
+
+    __atomic_fetch_add(&counter->hashes, *hashes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&counter->hits, *hits, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&counter->busy, now - *then, __ATOMIC_RELAXED);
+
+    if (*hits > 0)
+      __atomic_store_n(&dev->last_hit, hs_stats_time(), __ATOMIC_RELAXED);
+
+    if (__atomic_load_n(&dev->second, __ATOMIC_RELAXED) != second
+        && pthread_mutex_trylock(&dev->lock) == 0) {
+      if (dev->second != second)
+        hs_stats_sample(dev, now);
+
+      pthread_mutex_unlock(&dev->lock);
+    }
+  }
+
+  *hashes = 0;
+  *hits = 0;
+  *then = now;
+}
+
+bool
+hs_stats_get(uint32_t backend, uint32_t device, hs_stats_t *stats) {
+  hs_stats_device_t *dev = hs_stats_device(backend, device, false);
+
+  memset(stats, 0, sizeof(hs_stats_t));
+
+  if (dev == NULL)
+    return false;
+
+  pthread_mutex_lock(&dev->lock);
+
+  uint64_t now = hs_stats_now();
+
+  if (dev->second != now / 1000000000)
+    hs_stats_sample(dev, now);
+
+  for (size_t i = 0; i < HS_STATS_THREADS; i++) {
+    hs_counter_t *counter = &dev->counters[i];
+
+    stats->threads[i] = __atomic_load_n(&counter->hashes, __ATOMIC_RELAXED);
+    stats->hashes += stats->threads[i];
+    stats->hits += __atomic_load_n(&counter->hits, __ATOMIC_RELAXED);
+    stats->busy += __atomic_load_n(&counter->busy, __ATOMIC_RELAXED);
+  }
+
+  stats->jobs = dev->jobs;
+  stats->epoch = dev->epoch;
+  stats->last_hit = __atomic_load_n(&dev->last_hit, __ATOMIC_RELAXED);
+
+  // Rate since the newest sample at least a window old,
+  // or since the oldest sample when none is.
+  for (size_t w = 0; w < 3; w++) {
+    uint64_t window = hs_stats_windows[w] * 1000000000;
+    hs_stats_sample_t *base = NULL;
+
+    for (size_t i = 1; i <= dev->len; i++) {
+      size_t j = (dev->head + HS_STATS_SAMPLES - i) % HS_STATS_SAMPLES;
+
+      base = &dev->samples[j];
+
+      if (now - base->time >= window)
+        break;
+    }
+
+    if (base != NULL && now > base->time && stats->hashes >= base->hashes) {
+      stats->rates[w] = (double)(stats->hashes - base->hashes) * 1e9
+                      / (double)(now - base->time);
+    }
+  }
+
+  pthread_mutex_unlock(&dev->lock);
+
+  return true;
+}
@@ -0,0 +1,404 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "common.h"
+
+// Events kept per thread buffer. Older events are
+// overwritten, so a dump shows the latest activity.
+#define HS_TRACE_EVENTS 16384
+#define HS_TRACE_NAMES 256
+
+typedef struct hs_trace_event_s {
+  const char *name;
+  uint64_t ts;
+  uint64_t dur;
+  uint64_t arg;
+  uint32_t tid;
+  char ph;
+} hs_trace_event_t;
+
+// A ring written only by the thread that owns it. `len`
+// counts every event written and is published with a
+// release store after each one, so a dump can copy the
+// ring at any time and keep the events that were not
+// overwritten meanwhile. Buffers are handed back when
+// their thread exits and reused by the next one, as
+// mining threads come and go with every job.
+typedef struct hs_trace_buf_s {
+  struct hs_trace_buf_s *next;
+  int owned;
+  uint64_t gen;
+  uint64_t len;
+  hs_trace_event_t events[HS_TRACE_EVENTS];
+} hs_trace_buf_t;
+
+static hs_trace_buf_t *hs_trace_bufs = NULL;
+static int hs_trace_on = 0;
+static uint64_t hs_trace_gen = 0;
+static uint32_t hs_trace_tids = 0;
+static pthread_once_t hs_trace_once = PTHREAD_ONCE_INIT;
+static pthread_key_t hs_trace_key;
+static __thread hs_trace_buf_t *hs_trace_local = NULL;
+static __thread uint32_t hs_trace_tid = 0;
+
+// Names recorded from JS need to outlive the call.
+static pthread_mutex_t hs_trace_names_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *hs_trace_names[HS_TRACE_NAMES];
+static size_t hs_trace_names_len = 0;
+
+static void
+hs_trace_release(void *arg) {
+  hs_trace_buf_t *buf = (hs_trace_buf_t *)arg;
+  __atomic_store_n(&buf->owned, 0, __ATOMIC_RELEASE);
+}
+
+static void
+hs_trace_init(void) {
+  pthread_key_create(&hs_trace_key, hs_trace_release);
+}
+
+static hs_trace_buf_t *
+hs_trace_claim(void) {
+  hs_trace_buf_t *buf;
+
+  pthread_once(&hs_trace_once, hs_trace_init);
+
+  if (hs_trace_tid == 0)
+    hs_trace_tid = __atomic_add_fetch(&hs_trace_tids, 1, __ATOMIC_RELAXED);
+
+  for (buf = __atomic_load_n(&hs_trace_bufs, __ATOMIC_ACQUIRE);
+       buf != NULL; buf = buf->next) {
+    int owned = 0;
+
+    if (__atomic_compare_exchange_n(&buf->owned, &owned, 1, false,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      break;
+    }
+  }
+
+  if (buf == NULL) {
+    buf = (hs_trace_buf_t *)calloc(1, sizeof(hs_trace_buf_t));
+
+    if (buf == NULL)
+      return NULL;
+
+    buf->owned = 1;
+    buf->next = __atomic_load_n(&hs_trace_bufs, __ATOMIC_RELAXED);
+
+    while (!__atomic_compare_exchange_n(&hs_trace_bufs, &buf->next, buf, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+      continue;
+    }
+  }
+
+  pthread_setspecific(hs_trace_key, buf);
+
+  return buf;
+}
+
+static void
+hs_trace_push(
+  const char *name,
+  char ph,
+  uint64_t ts,
+  uint64_t dur,
+  uint64_t arg
+) {
+  if (!__atomic_load_n(&hs_trace_on, __ATOMIC_RELAXED))
+    return;
+
+  hs_trace_buf_t *buf = hs_trace_local;
+
+  if (buf == NULL) {
+    buf = hs_trace_claim();
+
+    if (buf == NULL)
+      return;
+
+    hs_trace_local = buf;
+  }
+
+  // A new trace was started: this thread clears its own
+  // buffer before writing to it.
+  uint64_t gen = __atomic_load_n(&hs_trace_gen, __ATOMIC_ACQUIRE);
+
+  if (buf->gen != gen) {
+    __atomic_store_n(&buf->len, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&buf->gen, gen, __ATOMIC_RELEASE);
+  }
+
+  uint64_t len = buf->len;
+  hs_trace_event_t *event = &buf->events[len % HS_TRACE_EVENTS];
+
+  event->name = name;
+  event->ts = ts;
+  event->dur = dur;
+  event->arg = arg;
+  event->tid = hs_trace_tid;
+  event->ph = ph;
+
+  __atomic_store_n(&buf->len, len + 1, __ATOMIC_RELEASE);
+}
+
+// Clear every buffer and start recording.
+void
+hs_trace_start(void) {
+  __atomic_add_fetch(&hs_trace_gen, 1, __ATOMIC_RELEASE);
+  __atomic_store_n(&hs_trace_on, 1, __ATOMIC_RELEASE);
+}
+
+// Stop recording. Events are kept for hs_trace_dump().
+void
+hs_trace_stop(void) {
+  __atomic_store_n(&hs_trace_on, 0, __ATOMIC_RELEASE);
+}
+
+bool
+hs_trace_enabled(void) {
+  return __atomic_load_n(&hs_trace_on, __ATOMIC_RELAXED) != 0;
+}
+
+// Name the calling thread in the trace.
+void
+hs_trace_thread(const char *name) {
+  hs_trace_push(name, 'M', hs_stats_now(), 0, 0);
+}
+
+// A span from `start` to `end`, from hs_stats_now().
+void
+hs_trace_complete(const char *name, uint64_t start, uint64_t end, uint64_t arg) {
+  hs_trace_push(name, 'X', start, end > start ? end - start : 0, arg);
+}
+
+// A span from `start` until now.
+void
+hs_trace_span(const char *name, uint64_t start, uint64_t arg) {
+  if (!hs_trace_enabled())
+    return;
+
+  hs_trace_complete(name, start, hs_stats_now(), arg);
+}
+
+void
+hs_trace_instant(const char *name, uint64_t arg) {
+  if (!hs_trace_enabled())
+    return;
+
+  hs_trace_push(name, 'i', hs_stats_now(), 0, arg);
+}
+
+// Copy a name into storage that lives as long as the
+// process. Returns NULL once the table is full.
+const char *
+hs_trace_intern(const char *name) {
+  const char *ret = NULL;
+
+  pthread_mutex_lock(&hs_trace_names_lock);
+
+  for (size_t i = 0; i < hs_trace_names_len; i++) {
+    if (strcmp(hs_trace_names[i], name) == 0) {
+      ret = hs_trace_names[i];
+      goto done;
+    }
+  }
+
+  if (hs_trace_names_len < HS_TRACE_NAMES) {
+    char *copy = strdup(name);
+
+    if (copy != NULL) {
+      hs_trace_names[hs_trace_names_len++] = copy;
+      ret = copy;
+    }
+  }
+
+done:
+  pthread_mutex_unlock(&hs_trace_names_lock);
+  return ret;
+}
+
+typedef struct hs_trace_out_s {
+  char *data;
+  size_t len;
+  size_t size;
+  bool failed;
+} hs_trace_out_t;
+
+static void
+hs_trace_write(hs_trace_out_t *out, const char *str, size_t len) {
+  if (out->failed)
+    return;
+
+  if (out->len + len + 1 > out->size) {
+    size_t size = out->size ? out->size : 65536;
+
+    while (out->len + len + 1 > size)
+      size *= 2;
+
+    char *data = (char *)realloc(out->data, size);
+
+    if (data == NULL) {
+      out->failed = true;
+      return;
+    }
+
+    out->data = data;
+    out->size = size;
+  }
+
+  memcpy(out->data + out->len, str, len);
+  out->len += len;
+  out->data[out->len] = '\0';
+}
+
+static void
+hs_trace_string(hs_trace_out_t *out, const char *str) {
+  hs_trace_write(out, "\"", 1);
+
+  for (; *str; str++) {
+    char esc[8];
+
+    if (*str == '"' || *str == '\\') {
+      esc[0] = '\\';
+      esc[1] = *str;
+      hs_trace_write(out, esc, 2);
+    } else if ((unsigned char)*str < 0x20) {
+      int n = snprintf(esc, sizeof(esc), "\\u%04x", (unsigned char)*str);
+      hs_trace_write(out, esc, (size_t)n);
+    } else {
+      hs_trace_write(out, str, 1);
+    }
+  }
+
+  hs_trace_write(out, "\"", 1);
+}
+
+// Copy the events of a buffer that are still intact,
+// oldest first. Returns the number copied.
+static size_t
+hs_trace_copy(hs_trace_buf_t *buf, hs_trace_event_t *events, uint64_t *lost) {
+  uint64_t end = __atomic_load_n(&buf->len, __ATOMIC_ACQUIRE);
+  uint64_t start = end > HS_TRACE_EVENTS ? end - HS_TRACE_EVENTS : 0;
+
+  for (uint64_t i = start; i < end; i++)
+    events[i - start] = buf->events[i % HS_TRACE_EVENTS];
+
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+  // The owner may have moved on while copying. The slot
+  // it is writing now held the event HS_TRACE_EVENTS back.
+  uint64_t now = __atomic_load_n(&buf->len, __ATOMIC_RELAXED);
+  uint64_t safe = now >= HS_TRACE_EVENTS ? now - HS_TRACE_EVENTS + 1 : 0;
+
+  // Restarted by its owner for a new trace.
+  if (now < end)
+    return 0;
+
+  if (safe > start) {
+    if (safe >= end)
+      return 0;
+
+    memmove(events, events + (safe - start),
+            (size_t)(end - safe) * sizeof(hs_trace_event_t));
+    start = safe;
+  }
+
+  *lost += start;
+
+  return (size_t)(end - start);
+}
+
+// Render the current trace as Chrome trace_event JSON.
+// Timestamps are in microseconds from the monotonic clock.
+// Safe while recording. The caller frees the result.
+char *
+hs_trace_dump(size_t *len) {
+  hs_trace_out_t out = { NULL, 0, 0, false };
+  uint64_t gen = __atomic_load_n(&hs_trace_gen, __ATOMIC_ACQUIRE);
+  unsigned long pid = (unsigned long)getpid();
+  uint64_t lost = 0;
+  bool first = true;
+  char line[256];
+
+  hs_trace_event_t *events = (hs_trace_event_t *)malloc(
+    HS_TRACE_EVENTS * sizeof(hs_trace_event_t));
+
+  if (events == NULL)
+    return NULL;
+
+  hs_trace_write(&out, "{\"traceEvents\":[", 16);
+
+  for (hs_trace_buf_t *buf = __atomic_load_n(&hs_trace_bufs, __ATOMIC_ACQUIRE);
+       buf != NULL; buf = buf->next) {
+    if (__atomic_load_n(&buf->gen, __ATOMIC_ACQUIRE) != gen)
+      continue;
+
+    size_t n = hs_trace_copy(buf, events, &lost);
+
+    for (size_t i = 0; i < n; i++) {
+      hs_trace_event_t *event = &events[i];
+      int size;
+
+      if (!first)
+        hs_trace_write(&out, ",", 1);
+
+      first = false;
+
+      if (event->ph == 'M') {
+        size = snprintf(line, sizeof(line),
+          "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%lu,\"tid\":%u,"
+          "\"args\":{\"name\":", pid, event->tid);
+        hs_trace_write(&out, line, (size_t)size);
+        hs_trace_string(&out, event->name);
+        hs_trace_write(&out, "}}", 2);
+        continue;
+      }
+
+      hs_trace_write(&out, "{\"name\":", 8);
+      hs_trace_string(&out, event->name);
+
+      size = snprintf(line, sizeof(line),
+        ",\"cat\":\"hs\",\"ph\":\"%c\",\"ts\":%llu.%03llu,\"pid\":%lu,"
+        "\"tid\":%u",
+        event->ph,
+        (unsigned long long)(event->ts / 1000),
+        (unsigned long long)(event->ts % 1000),
+        pid, event->tid);
+      hs_trace_write(&out, line, (size_t)size);
+
+      if (event->ph == 'X') {
+        size = snprintf(line, sizeof(line), ",\"dur\":%llu.%03llu",
+          (unsigned long long)(event->dur / 1000),
+          (unsigned long long)(event->dur % 1000));
+        hs_trace_write(&out, line, (size_t)size);
+      } else {
+        hs_trace_write(&out, ",\"s\":\"t\"", 8);
+      }
+
+      size = snprintf(line, sizeof(line), ",\"args\":{\"value\":%llu}}",
+        (unsigned long long)event->arg);
+      hs_trace_write(&out, line, (size_t)size);
+    }
+  }
+
+  int size = snprintf(line, sizeof(line),
+    "],\"displayTimeUnit\":\"ns\",\"otherData\":{\"overwritten\":%llu}}",
+    (unsigned long long)lost);
+  hs_trace_write(&out, line, (size_t)size);
+
+  free(events);
+
+  if (out.failed) {
+    free(out.data);
+    return NULL;
+  }
+
+  *len = out.len;
+
+  return out.data;
+}
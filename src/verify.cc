@@ -1,8 +1,10 @@
 #include <unistd.h>
 #include <stdbool.h>
+#include <pthread.h>
 #include "common.h"
 #include "header.h"
 #include "error.h"
+#include "probes.h"
 
 int32_t
 hs_verify(
@@ -11,3 +13,208 @@ hs_verify(
 ) {
   return hs_header_verify_pow(hdr, target);
 }
+
+// Rebuild the full header for a candidate and run the
+// complete proof of work check against the job's target.
+bool
+hs_verify_share(const hs_options_t *options, const hs_share_t *share, bool *block) {
+  uint8_t raw[HEADER_SIZE];
+  hs_header_t hdr;
+  uint8_t hash[32];
+  bool valid = false;
+
+  HS_PROBE2(verify_start, options->device, share->nonce);
+
+  memcpy(raw, options->header, HEADER_SIZE);
+  memcpy(raw, &share->nonce, 4);
+  memcpy(raw + 128, share->extra_nonce, EXTRA_NONCE_SIZE);
+
+  if (!hs_header_decode(raw, HEADER_SIZE, &hdr))
+    goto done;
+
+  hs_header_pow(&hdr, hash);
+
+  if (memcmp(hash, options->target, 32) > 0)
+    goto done;
+
+  if (block)
+    *block = memcmp(hash, options->block_target, 32) <= 0;
+
+  valid = true;
+done:
+  HS_PROBE3(verify_done, options->device, share->nonce, valid);
+  return valid;
+}
+
+struct hs_verifier_s {
+  hs_options_t *options;
+  hs_share_func share_func;
+  void *share_arg;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  hs_share_t *pending;
+  size_t pending_len;
+  size_t pending_size;
+  bool closed;
+  uint64_t candidates;
+  uint64_t rejected;
+  bool found;
+  hs_share_t block;
+};
+
+static void *
+hs_verifier_thread(void *ptr) {
+  hs_verifier_t *verifier = (hs_verifier_t *)ptr;
+  hs_share_t *batch = NULL;
+  size_t batch_size = 0;
+
+  for (;;) {
+    pthread_mutex_lock(&verifier->lock);
+
+    while (verifier->pending_len == 0 && !verifier->closed)
+      pthread_cond_wait(&verifier->cond, &verifier->lock);
+
+    if (verifier->pending_len == 0) {
+      pthread_mutex_unlock(&verifier->lock);
+      break;
+    }
+
+    // Swap buffers so the mining threads can keep
+    // pushing while this batch is being hashed.
+    hs_share_t *items = verifier->pending;
+    size_t len = verifier->pending_len;
+    size_t size = verifier->pending_size;
+
+    verifier->pending = batch;
+    verifier->pending_size = batch_size;
+    verifier->pending_len = 0;
+
+    pthread_mutex_unlock(&verifier->lock);
+
+    for (size_t i = 0; i < len; i++) {
+      hs_share_t *share = &items[i];
+
+      if (!hs_verify_share(verifier->options, share, &share->block)) {
+        verifier->rejected += 1;
+        continue;
+      }
+
+      verifier->share_func(share, verifier->share_arg);
+
+      // Only a confirmed block ends the job.
+      if (share->block && !verifier->found) {
+        verifier->found = true;
+        verifier->block = *share;
+        verifier->options->running = false;
+      }
+    }
+
+    batch = items;
+    batch_size = size;
+  }
+
+  free(batch);
+
+  return NULL;
+}
+
+hs_verifier_t *
+hs_verifier_alloc(
+  hs_options_t *options,
+  hs_share_func share_func,
+  void *share_arg
+) {
+  hs_verifier_t *verifier = (hs_verifier_t *)malloc(sizeof(hs_verifier_t));
+
+  if (verifier == NULL)
+    return NULL;
+
+  verifier->options = options;
+  verifier->share_func = share_func;
+  verifier->share_arg = share_arg;
+  verifier->pending = NULL;
+  verifier->pending_len = 0;
+  verifier->pending_size = 0;
+  verifier->closed = false;
+  verifier->candidates = 0;
+  verifier->rejected = 0;
+  verifier->found = false;
+
+  pthread_mutex_init(&verifier->lock, NULL);
+  pthread_cond_init(&verifier->cond, NULL);
+
+  if (pthread_create(&verifier->thread, NULL,
+                     hs_verifier_thread, verifier) != 0) {
+    pthread_cond_destroy(&verifier->cond);
+    pthread_mutex_destroy(&verifier->lock);
+    free(verifier);
+    return NULL;
+  }
+
+  return verifier;
+}
+
+// Matches hs_share_func so it can be handed to a backend directly.
+void
+hs_verifier_push(const hs_share_t *share, void *arg) {
+  hs_verifier_t *verifier = (hs_verifier_t *)arg;
+
+  pthread_mutex_lock(&verifier->lock);
+
+  if (verifier->pending_len == verifier->pending_size) {
+    size_t size = verifier->pending_size ? verifier->pending_size * 2 : 16;
+    hs_share_t *pending = (hs_share_t *)realloc(verifier->pending,
+                                                size * sizeof(hs_share_t));
+
+    // Out of memory: drop the candidate rather than the job.
+    if (pending == NULL) {
+      pthread_mutex_unlock(&verifier->lock);
+      return;
+    }
+
+    verifier->pending = pending;
+    verifier->pending_size = size;
+  }
+
+  verifier->pending[verifier->pending_len++] = *share;
+  verifier->candidates += 1;
+
+  pthread_cond_signal(&verifier->cond);
+  pthread_mutex_unlock(&verifier->lock);
+}
+
+// Drains the queue, joins the thread and reports the counters.
+// Returns true with the first confirmed block in `block`.
+bool
+hs_verifier_free(
+  hs_verifier_t *verifier,
+  uint64_t *candidates,
+  uint64_t *rejected,
+  hs_share_t *block
+) {
+  pthread_mutex_lock(&verifier->lock);
+  verifier->closed = true;
+  pthread_cond_signal(&verifier->cond);
+  pthread_mutex_unlock(&verifier->lock);
+
+  pthread_join(verifier->thread, NULL);
+
+  if (candidates)
+    *candidates = verifier->candidates;
+
+  if (rejected)
+    *rejected = verifier->rejected;
+
+  bool found = verifier->found;
+
+  if (found && block)
+    *block = verifier->block;
+
+  pthread_cond_destroy(&verifier->cond);
+  pthread_mutex_destroy(&verifier->lock);
+  free(verifier->pending);
+  free(verifier);
+
+  return found;
+}
@@ -7,12 +7,23 @@
 'use strict';
 
 const assert = require('bsert');
+const cp = require('child_process');
+const fs = require('fs');
+const os = require('os');
+const path = require('path');
 const miner = require('../');
+const shm = require('../lib/shm');
 const sha3 = require('./vendor/sha3');
 const blake2b = require('./vendor/blake2b');
 const {header} = require('./data/header');
 const {powHash} = require('./vendor/powHash');
 
+// Kernel variants in src/opencl.c.
+const OPENCL_VARIANTS = 5;
+
+const HAS_OPENCL_DEVICE = miner.HAS_OPENCL
+  && miner.getDeviceCount('opencl') > 0;
+
 describe('Bindings', function () {
   it('sha3', () => {
     const input = Buffer.from('00', 'hex');
@@ -33,4 +44,452 @@ describe('Bindings', function () {
     const expect = powHash(header);
     assert.bufferEqual(output, expect);
   });
+
+  it('should stream shares and keep mining', async () => {
+    const target = Buffer.alloc(32, 0x00);
+    target[1] = 0x30;
+
+    const shares = [];
+
+    const [nonce, , match] = await miner.mineAsync(header, {
+      backend: 'simple',
+      target: target,
+      range: 50000,
+      threads: 2,
+      onShare: share => shares.push(share)
+    });
+
+    // Shares do not end the job.
+    assert.strictEqual(nonce, 0);
+    assert.strictEqual(match, false);
+    assert(shares.length > 1);
+
+    for (const [nonce, extraNonce] of shares) {
+      const hdr = Buffer.from(header);
+      hdr.writeUInt32LE(nonce, 0);
+      extraNonce.copy(hdr, miner.EXTRA_NONCE_START);
+      assert(miner.verify(hdr, target));
+    }
+  });
+
+  it('should count hashes', async () => {
+    const result = await miner.mineAsync(header, {
+      backend: 'simple',
+      target: Buffer.alloc(32, 0x00),
+      range: 50000,
+      threads: 2,
+      device: 7
+    });
+
+    assert.strictEqual(result[2], false);
+    assert.strictEqual(result[4], 50000);
+
+    const stats = miner.getStats(7, 'simple');
+
+    assert.strictEqual(stats.hashes, 50000);
+    assert.strictEqual(stats.hits, 0);
+    assert.strictEqual(stats.jobs, 1);
+    assert.deepStrictEqual(stats.threads, [25000, 25000]);
+    assert(stats.hashrate['60s'] > 0);
+  });
+
+  it('should not count hashes for untracked devices', async () => {
+    const result = await miner.mineAsync(header, {
+      backend: 'simple',
+      target: Buffer.alloc(32, 0x00),
+      range: 1000,
+      threads: 1,
+      device: -1
+    });
+
+    assert.strictEqual(result[4], 1000);
+    assert.strictEqual(miner.getStats(-1, 'simple').hashes, 0);
+  });
+
+  it('should publish shared stats', async () => {
+    const file = path.join(os.tmpdir(), `hs-miner-test-${process.pid}`);
+
+    await miner.mineAsync(header, {
+      backend: 'simple',
+      target: Buffer.alloc(32, 0x00),
+      range: 1000,
+      threads: 1,
+      device: 9
+    });
+
+    miner.openSharedStats(file, 10);
+
+    await new Promise(resolve => setTimeout(resolve, 50));
+
+    const raw = fs.readFileSync(file);
+
+    miner.closeSharedStats();
+
+    const seg = shm.parse(raw);
+    const dev = seg.devices.find((entry) => {
+      return entry.backend === 'simple' && entry.id === 9;
+    });
+
+    assert.strictEqual(raw.readUInt32LE(shm.segment.magic), shm.MAGIC);
+    assert.strictEqual(seg.pid, process.pid);
+    assert.strictEqual(seg.interval, 10);
+    assert(dev);
+    assert(dev.hashes >= 1000);
+    assert.strictEqual(dev.threads.length, 1);
+    assert.strictEqual(dev.temperature, null);
+    assert(!fs.existsSync(file));
+  });
+
+  it('should record stop and start latency', async () => {
+    miner.resetLatency();
+
+    // About one hit in 256 hashes. The job is stopped from
+    // the first streamed hit, so it has hashed by then.
+    const target = Buffer.alloc(32, 0xff);
+    target[0] = 0x00;
+
+    let stopped = null;
+
+    const result = await miner.mineAsync(header, {
+      backend: 'simple',
+      target: target,
+      range: 0xffffffff,
+      threads: 2,
+      device: 8,
+      onShare: () => {
+        if (stopped === null)
+          stopped = miner.stop(8);
+      }
+    });
+
+    assert.strictEqual(stopped, true);
+    assert.strictEqual(result[2], false);
+
+    const {stop, start} = miner.getLatency('simple');
+
+    assert.strictEqual(stop.count, 1);
+    assert.strictEqual(start.count, 1);
+    assert(stop.p50 <= stop.p99 && stop.p99 <= stop.max);
+    assert(start.p50 <= start.p99 && start.p99 <= start.max);
+  });
+
+  describe('Energy', function() {
+    const range = 262143328850;
+    let root, counter;
+
+    // Mine until the first streamed hit, then run `hit`,
+    // which bumps the counter and stops the job.
+    const job = (device, threads, hit) => {
+      const target = Buffer.alloc(32, 0xff);
+      target[0] = 0x00;
+
+      let stopped = false;
+
+      return miner.mineAsync(header, {
+        backend: 'simple',
+        target: target,
+        range: 0xffffffff,
+        threads: threads,
+        device: device,
+        onShare: () => {
+          if (stopped)
+            return;
+
+          stopped = true;
+          hit();
+        }
+      });
+    };
+
+    const write = (uj) => {
+      fs.writeFileSync(counter, `${uj}\n`);
+    };
+
+    beforeEach(() => {
+      root = fs.mkdtempSync(path.join(os.tmpdir(), 'hs-miner-rapl-'));
+
+      const domain = path.join(root, 'intel-rapl:0');
+
+      fs.mkdirSync(domain);
+      fs.writeFileSync(path.join(domain, 'max_energy_range_uj'), `${range}\n`);
+
+      counter = path.join(domain, 'energy_uj');
+
+      miner.resetEnergy();
+      miner.enableEnergy(true, root);
+    });
+
+    afterEach(() => {
+      const domain = path.join(root, 'intel-rapl:0');
+
+      miner.enableEnergy(false);
+
+      for (const file of fs.readdirSync(domain))
+        fs.unlinkSync(path.join(domain, file));
+
+      fs.rmdirSync(domain);
+      fs.rmdirSync(root);
+    });
+
+    it('should meter a job across a counter wrap', async () => {
+      // 0.5J before the wrap and 1.5J after it.
+      write(range - 500000);
+
+      await job(12, 2, () => {
+        write(1500000);
+        miner.stop(12);
+      });
+
+      const {error, runs} = miner.getEnergy();
+
+      assert.strictEqual(error, null);
+      assert.strictEqual(runs.length, 1);
+      assert.strictEqual(runs[0].backend, 'simple');
+      assert.strictEqual(runs[0].threads, 2);
+      assert.strictEqual(runs[0].jobs, 1);
+      assert(runs[0].hashes > 0);
+      assert.strictEqual(runs[0].joules, 2);
+      assert(runs[0].seconds > 0);
+      assert(runs[0].watts > 0);
+      assert(runs[0].hashesPerJoule > 0);
+    });
+
+    it('should split energy between overlapping jobs', async () => {
+      write(1000000);
+
+      // Once both jobs are hashing, 3J are used and both stop.
+      let hashing = 0;
+
+      const both = () => {
+        hashing += 1;
+
+        if (hashing < 2)
+          return;
+
+        write(4000000);
+        miner.stop(13);
+        miner.stop(14);
+      };
+
+      await Promise.all([job(13, 1, both), job(14, 2, both)]);
+
+      const {error, runs} = miner.getEnergy();
+
+      assert.strictEqual(error, null);
+      assert.strictEqual(runs.length, 2);
+
+      const joules = runs.reduce((sum, run) => sum + run.joules, 0);
+
+      // The package counter is charged once, not per job.
+      assert(Math.abs(joules - 3) < 1e-5);
+
+      for (const run of runs) {
+        assert.strictEqual(run.jobs, 1);
+        assert(run.hashes > 0);
+      }
+    });
+  });
+
+  it('should trace a job', async () => {
+    miner.startTrace();
+
+    const start = miner.traceBegin();
+
+    await miner.mineAsync(header, {
+      backend: 'simple',
+      target: Buffer.alloc(32, 0xff),
+      range: 100000,
+      threads: 2
+    });
+
+    miner.traceEnd('test', start, 1);
+    miner.stopTrace();
+
+    const {traceEvents} = JSON.parse(miner.dumpTrace());
+    const names = new Set(traceEvents.map(event => event.name));
+
+    assert(names.has('job'));
+    assert(names.has('thread'));
+    assert(names.has('match'));
+    assert(names.has('test'));
+
+    for (const event of traceEvents) {
+      if (event.ph === 'X')
+        assert(event.dur >= 0);
+    }
+  });
+
+  it('should classify shares and end the job on a block', async () => {
+    const target = Buffer.alloc(32, 0x00);
+    target[1] = 0x30;
+
+    const blockTarget = Buffer.alloc(32, 0x00);
+    blockTarget[1] = 0x03;
+
+    const shares = [];
+
+    const [nonce, extraNonce, match, block] = await miner.mineAsync(header, {
+      backend: 'simple',
+      target: target,
+      blockTarget: blockTarget,
+      range: 1000000,
+      threads: 2,
+      onShare: share => shares.push(share)
+    });
+
+    assert.strictEqual(match, true);
+    assert.strictEqual(block, true);
+
+    const hdr = Buffer.from(header);
+    hdr.writeUInt32LE(nonce, 0);
+    extraNonce.copy(hdr, miner.EXTRA_NONCE_START);
+    assert(miner.verify(hdr, blockTarget));
+
+    for (const [nonce, extraNonce, block] of shares) {
+      const hdr = Buffer.from(header);
+      hdr.writeUInt32LE(nonce, 0);
+      extraNonce.copy(hdr, miner.EXTRA_NONCE_START);
+      assert(miner.verify(hdr, target));
+      assert.strictEqual(miner.verify(hdr, blockTarget), block);
+    }
+
+    assert(shares.some(([, , block]) => block));
+  });
+
+  it('should reject bad candidates in the verifier', () => {
+    const target = Buffer.alloc(32, 0x00);
+    target[1] = 0x30;
+
+    const device = 7;
+    const extraNonce = header.slice(miner.EXTRA_NONCE_START,
+                                    miner.EXTRA_NONCE_END);
+
+    const [good, , match] = miner.mine(header, {
+      backend: 'simple',
+      target: target,
+      range: 1000000,
+      threads: 1
+    });
+
+    assert.strictEqual(match, true);
+
+    // A nonce that misses the target, as a
+    // device false positive would.
+    const hdr = Buffer.from(header);
+    let bad = good + 1;
+
+    for (;;) {
+      hdr.writeUInt32LE(bad, 0);
+      if (!miner.verify(hdr, target))
+        break;
+      bad += 1;
+    }
+
+    const before = miner.getVerifyStats(device);
+
+    assert.deepStrictEqual(
+      miner.verifyShare(header, good, extraNonce, { target, device }),
+      { valid: true, block: true });
+
+    assert.deepStrictEqual(
+      miner.verifyShare(header, bad, extraNonce, { target, device }),
+      { valid: false, block: false });
+
+    const after = miner.getVerifyStats(device);
+
+    assert.strictEqual(after.candidates - before.candidates, 2);
+    assert.strictEqual(after.rejected - before.rejected, 1);
+    assert.strictEqual(after.confirmed - before.confirmed, 1);
+  });
+
+  if (HAS_OPENCL_DEVICE) {
+    it('should match hashHeader in every OpenCL kernel variant', function() {
+      this.timeout(10 * 60 * 1000);
+
+      // About one hit in 64 hashes, so the result
+      // buffer also overflows on some launches.
+      const target = Buffer.alloc(32, 0xff);
+      target[0] = 0x03;
+
+      const range = 4096;
+
+      // [nonces per work-item, jit, extra nonces, repeat
+      // until the JIT specialization runs the whole job]
+      const cases = [
+        [1, false, 0, false],
+        [2, false, 0, false],
+        [3, false, 0, false],
+        [1, true, 0, false],
+        [1, true, 0, true],
+        [2, false, 3, false],
+        [2, true, 3, true]
+      ];
+
+      const expect = cases.map(([, , extraNonces]) => {
+        const hits = [];
+        const hdr = Buffer.from(header);
+        const base = header.readUInt32LE(miner.EXTRA_NONCE_END - 4);
+
+        for (let row = 0; row < Math.max(extraNonces, 1); row++) {
+          hdr.writeUInt32LE((base + row) >>> 0, miner.EXTRA_NONCE_END - 4);
+
+          const extraNonce = hdr.toString('hex', miner.EXTRA_NONCE_START,
+                                          miner.EXTRA_NONCE_END);
+
+          for (let nonce = 0; nonce < range; nonce++) {
+            hdr.writeUInt32LE(nonce, 0);
+
+            if (miner.hashHeader(hdr).compare(target) <= 0)
+              hits.push([nonce, extraNonce]);
+          }
+        }
+
+        return hits.sort().map(String);
+      });
+
+      const variants = new Set();
+
+      for (let i = 0; i < OPENCL_VARIANTS; i++) {
+        const script = path.join(__dirname, 'util', 'opencl-hits.js');
+        const args = JSON.stringify([range, target.toString('hex'), cases]);
+
+        const out = cp.execFileSync(process.execPath, [script, args], {
+          env: Object.assign({}, process.env, {
+            HS_OPENCL_VARIANT: String(i),
+            HS_OPENCL_CACHE: ''
+          })
+        });
+
+        const {variant, jobs} = JSON.parse(out.toString('utf8'));
+
+        variants.add(variant);
+
+        for (let j = 0; j < cases.length; j++) {
+          assert.deepStrictEqual(jobs[j].sort().map(String), expect[j],
+            `variant ${variant}, case ${cases[j]}`);
+        }
+      }
+
+      assert.strictEqual(variants.size, OPENCL_VARIANTS);
+    });
+  }
+
+  it('should validate the device list', () => {
+    assert.throws(() => miner.mine(header, {
+      backend: 'simple',
+      devices: [0, 0]
+    }), /Duplicate device/);
+
+    assert.throws(() => miner.mine(header, {
+      backend: 'simple',
+      devices: [0, 1]
+    }), /OpenCL backend/);
+  });
+
+  it('should validate extra nonces', () => {
+    assert.throws(() => miner.mine(header, {
+      backend: 'simple',
+      extraNonces: 16
+    }), /OpenCL backend/);
+  });
 });
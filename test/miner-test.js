@@ -1,7 +1,10 @@
 'use strict';
 
 const assert = require('bsert');
+const http = require('http');
+const lib = require('../');
 const Miner = require('../bin/miner');
+const Metrics = require('../bin/metrics');
 const {header} = require('./data/header');
 const {powHash} = require('./vendor/powHash');
 
@@ -58,4 +61,151 @@ describe('Miner', function() {
       });
     });
   }
+
+  describe('Devices', function() {
+    const lane = hdr => hdr.toString('hex', 140, 152);
+
+    function create() {
+      const miner = new Miner({
+        backend: 'simple',
+        target: target,
+        range: 10000,
+        threads: 1
+      });
+
+      // Two "devices" on the CPU backend.
+      miner.count = 2;
+      miner.log = () => {};
+
+      return miner;
+    }
+
+    it('should stop the other devices on a match', async () => {
+      const miner = create();
+      const stop = lib.stop;
+      const lanes = new Map();
+      const stopped = [];
+      const job = miner.job;
+
+      miner.job = function(index, hdr, target) {
+        lanes.set(index, lane(hdr));
+        return job.call(this, index, hdr, target);
+      };
+
+      lib.stop = (index) => {
+        stopped.push(index);
+        return stop(index);
+      };
+
+      let result;
+
+      try {
+        do {
+          result = await miner.mine(Buffer.from(header), target);
+        } while (!result[2]);
+      } finally {
+        lib.stop = stop;
+      }
+
+      const [nonce, extraNonce] = result;
+      const hdr = miner.toBlock(Buffer.from(header), nonce, extraNonce);
+
+      assert(miner.verify(hdr, target));
+
+      // Each device searched its own extra nonce lane.
+      assert.strictEqual(lanes.size, 2);
+      assert.notStrictEqual(lanes.get(0), lanes.get(1));
+
+      // Only the device without the match was stopped.
+      assert.strictEqual(stopped.length, 1);
+      assert(stopped[0] === 0 || stopped[0] === 1);
+      assert(lanes.get(stopped[0]) !== lane(hdr));
+    });
+
+    it('should re-randomize lanes on a new epoch', async () => {
+      const miner = create();
+      const seen = new Map([[0, []], [1, []]]);
+      const job = miner.job;
+
+      miner.job = function(index, hdr) {
+        const lanes = seen.get(index);
+
+        lanes.push(lane(hdr));
+
+        // New work after every device ran a job,
+        // then stop after the next round.
+        if (seen.get(0).length === 1 && seen.get(1).length === 1) {
+          miner.hdr = Buffer.from(header);
+          miner.epoch += 1;
+        }
+
+        if (seen.get(0).length >= 2 && seen.get(1).length >= 2)
+          miner.mining = false;
+
+        // A zero target never matches.
+        return job.call(this, index, hdr, Buffer.alloc(32, 0x00));
+      };
+
+      miner.hdr = Buffer.from(header);
+      miner.epoch = 1;
+      miner.mining = true;
+
+      await miner.work();
+
+      const [a0, a1] = seen.get(0);
+      const [b0, b1] = seen.get(1);
+
+      assert.notStrictEqual(a0, b0);
+      assert.notStrictEqual(a1, b1);
+      assert.notStrictEqual(a0, a1);
+      assert.notStrictEqual(b0, b1);
+    });
+  });
+
+  describe('Metrics', function() {
+    it('should serve metrics', async () => {
+      const miner = new Miner({
+        backend: 'simple',
+        target: target,
+        range: 10000,
+        threads: 2,
+        device: 0
+      });
+
+      await miner.job(0, header, Buffer.alloc(32, 0x00));
+
+      miner.found = 2;
+      miner.submitted = 2;
+      miner.accepted = 1;
+      miner.reject('high-hash');
+      miner.rpc.set('getwork', new Metrics.Histogram());
+      miner.rpc.get('getwork').observe(0.02);
+
+      const metrics = new Metrics(miner, { port: 0 });
+      const {port} = await metrics.open();
+
+      const body = await new Promise((resolve, reject) => {
+        http.get(`http://127.0.0.1:${port}/metrics`, (res) => {
+          let data = '';
+          res.setEncoding('utf8');
+          res.on('data', chunk => data += chunk);
+          res.on('end', () => resolve(data));
+        }).on('error', reject);
+      });
+
+      await metrics.close();
+
+      const hashes = /^hs_miner_hashes_total\{device="0"\} (\d+)$/m.exec(body);
+
+      assert(hashes && Number(hashes[1]) >= 10000);
+      assert(body.includes('# TYPE hs_miner_hashrate gauge'));
+      assert(body.includes('hs_miner_thread_hashes_total{device="0",thread="1"}'));
+      assert(body.includes('hs_miner_shares_found_total 2'));
+      assert(body.includes('hs_miner_shares_rejected_total{reason="high-hash"} 1'));
+      assert(body.includes(
+        'hs_miner_rpc_seconds_bucket{method="getwork",le="0.025"} 1'));
+      assert(body.includes(
+        'hs_miner_latency_seconds_count{backend="simple",event="start"}'));
+    });
+  });
 });
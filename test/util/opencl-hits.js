@@ -0,0 +1,74 @@
+/**
+ * test/util/opencl-hits - print the hits the OpenCL kernel finds.
+ * Copyright (c) 2019-2020, The Handshake Developers (MIT License).
+ *
+ * The kernel variant is picked once per device and process, so
+ * bindings-test runs this once per variant with HS_OPENCL_VARIANT
+ * set. Prints `{variant, jobs}` as JSON, one entry in `jobs` per
+ * case, each a list of `[nonce, extraNonce]` hits.
+ *
+ * A JIT job starts on the generic kernel while its specialization
+ * builds. Cases that ask for it repeat the job until every launch
+ * ran the specialization and report the hits of that run.
+ */
+
+'use strict';
+
+const miner = require('../../');
+const {header} = require('../data/header');
+
+const [range, target, cases] = JSON.parse(process.argv[2]);
+
+async function mine(nonces, jit, extraNonces) {
+  const hits = [];
+
+  await miner.mineAsync(header, {
+    backend: 'opencl',
+    target: Buffer.from(target, 'hex'),
+    range: range,
+    nonces: nonces,
+    jit: jit,
+    extraNonces: extraNonces,
+    device: 0,
+    onShare: ([nonce, extraNonce]) => {
+      hits.push([nonce, extraNonce.toString('hex')]);
+    }
+  });
+
+  return hits;
+}
+
+(async () => {
+  const jobs = [];
+
+  for (const [nonces, jit, extraNonces, specialized] of cases) {
+    if (!specialized) {
+      jobs.push(await mine(nonces, jit, extraNonces));
+      continue;
+    }
+
+    const count = jobs.length;
+
+    // Builds take seconds; give up after about a minute.
+    for (let i = 0; i < 600 && jobs.length === count; i++) {
+      const before = miner.getOpenCLStats(0);
+      const hits = await mine(nonces, jit, extraNonces);
+      const after = miner.getOpenCLStats(0);
+
+      if (after.jit - before.jit === after.dispatches - before.dispatches)
+        jobs.push(hits);
+      else
+        await new Promise(resolve => setTimeout(resolve, 100));
+    }
+
+    if (jobs.length === count)
+      throw new Error('The JIT specialization was never used.');
+  }
+
+  const {variant} = miner.getOpenCLStats(0);
+
+  process.stdout.write(JSON.stringify({ variant, jobs }));
+})().catch((err) => {
+  console.error(err.stack);
+  process.exit(1);
+});